@@ -28,19 +28,29 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 200809L /* for mmap() */
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "app.h"
+#include "autotune.h"
+#include "incremental.h"
 #include "options.h"
 #include "../backend/backend.h"
 #include "../frontend/parser.h"
+#include "../interpreter/async_io.h"
 #include "../interpreter/jit.h"
+#include "../interpreter/server.h"
 #include "../interpreter/slow.h"
 #include "../interpreter/tree.h"
 #include "../ir/node.h"
+#include "../ir/serialize.h"
 #include "../optimizations/optimizations.h"
 
 static struct node *read_program(const char *filename) {
@@ -58,6 +68,87 @@ static struct node *read_program(const char *filename) {
     return program;
 }
 
+/* The records are read from a mapping of the file, without a copy. */
+static struct node *read_ir(const char *filename, int *optimization_level) {
+    int fd = open(filename, O_RDONLY);
+    
+    if(fd < 0) {
+        fprintf(stderr, "Error opening input file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    struct stat status;
+    
+    if(fstat(fd, &status) < 0) {
+        fprintf(stderr, "Error: fstat(): %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    size_t size = status.st_size;
+    void *data = NULL;
+    
+    if(size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        
+        if(data == MAP_FAILED) {
+            fprintf(stderr, "Error: mmap() of input file: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    close(fd);
+    
+    struct node *program;
+    bool valid = tree_deserialize(&program, optimization_level, data, size);
+    
+    if(size > 0) {
+        munmap(data, size);
+    }
+    
+    if(!valid) {
+        fprintf(stderr, "Error: invalid or incompatible IR file (-from-ir)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return program;
+}
+
+static void write_ir(const struct node *root, const struct options *options) {
+    FILE *f = stdout;
+    
+    if(options->ofilename != NULL) {
+        f = fopen(options->ofilename, "wb");
+        
+        if(f == NULL) {
+            fprintf(stderr, "Error opening output file (fopen()): %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    bool success = tree_serialize(f, root, options->optimization_level);
+    
+    /* the last records are only written when the stream is flushed */
+    if(f != stdout) {
+        success = fclose(f) == 0 && success;
+    } else {
+        success = fflush(f) == 0 && success;
+    }
+    
+    if(!success) {
+        perror("Error: file write error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Remarks and dumps would refer to the parts of the program instead of the
+ * whole, and autotuning needs the unoptimized program. */
+static bool use_incremental(const struct options *options) {
+    return options->incremental
+        && options->action != ACTION_AUTOTUNE
+        && !options->remarks_missed
+        && !options->print_after_all;
+}
+
 static void usage(enum app app, int argc, char *argv[]) {
     const char *argv0;
     
@@ -75,13 +166,11 @@ static void usage(enum app app, int argc, char *argv[]) {
 }
 
 static void set_defaults(struct options *options, enum app app) {
+    options_set_defaults(options);
+    
     if(app == APP_BFC) {
         options->action = ACTION_COMPILE;
-    } else {
-        options->action = ACTION_JIT;
     }
-    options->optimization_level = 3;
-    options->backend = BACKEND_ELF64;
 }
 
 int run_app(enum app app, int argc, char *argv[]) {
@@ -93,23 +182,105 @@ int run_app(enum app app, int argc, char *argv[]) {
         usage(app, argc, argv);
     }
     
+    /* The client has no program of its own to look at. */
+    if(options.action == ACTION_CONNECT) {
+        return server_connect(&options);
+    }
+    
+    /* If the program was tuned with -autotune, the tuned options take
+     * precedence over the defaults but not over the command line, which is
+     * parsed again on top of them. */
+    if(options.action != ACTION_AUTOTUNE && autotune_load_options(&options)) {
+        parse_options(&options, argc, argv);
+    }
+    
+    if(options.from_ir && (options.action == ACTION_SLOW || options.action == ACTION_AUTOTUNE)) {
+        fprintf(stderr, "Error: -from-ir cannot be used with -slow or -autotune\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if(options.batch_dir != NULL && options.action != ACTION_JIT) {
+        fprintf(stderr, "Error: -batch can only be used with the JIT compiler\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if(options.server_socket != NULL && options.action != ACTION_JIT) {
+        fprintf(stderr, "Error: -server can only be used with the JIT compiler\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if(options.server_socket != NULL && options.batch_dir != NULL) {
+        fprintf(stderr, "Error: -server cannot be used with -batch\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if(options.batch_dir != NULL && options.output_dir == NULL) {
+        fprintf(stderr, "Error: -batch requires -outdir\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if(options.async_io && (options.batch_dir != NULL || options.server_socket != NULL)) {
+        fprintf(stderr, "Error: -async-io cannot be used with -batch or -server\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    bool runs_program = options.action == ACTION_JIT
+        || options.action == ACTION_TREE
+        || options.action == ACTION_SLOW;
+    
+    if(options.async_io && runs_program) {
+        async_io_start();
+    }
+    
     if(options.action == ACTION_SLOW) {
         slow_interpreter_run_program(options.filename);
         return EXIT_SUCCESS;
     }
     
-    struct node *program = read_program(options.filename);
+    /* An IR file holds an already optimized program. The optimization level
+     * it was optimized at selects the code generation defaults, unless the
+     * command line says otherwise. */
+    struct node *optimized = NULL;
     
-    struct node *optimized = run_optimizations(program, &options);
+    if(options.from_ir) {
+        optimized = read_ir(options.filename, &options.optimization_level);
+        parse_options(&options, argc, argv);
+    }
+    
+    /* On a cache hit, the program is run without being parsed. */
+    if(options.action == ACTION_JIT && jit_interpreter_run_cached_program(&options)) {
+        node_free(optimized);
+        return EXIT_SUCCESS;
+    }
     
-    node_free(program);
+    bool is_optimized = options.from_ir;
+    
+    if(!is_optimized && use_incremental(&options)) {
+        is_optimized = incremental_optimize(&optimized, &options);
+    }
+    
+    if(!is_optimized) {
+        struct node *program = read_program(options.filename);
+        
+        if(options.action == ACTION_AUTOTUNE) {
+            autotune_program(program, &options);
+            node_free(program);
+            return EXIT_SUCCESS;
+        }
+        
+        optimized = run_optimizations(program, &options);
+        
+        node_free(program);
+    }
     
     if(options.action == ACTION_COMPILE) {
         backend_generate(optimized, &options);
+    } else if (options.action == ACTION_EMIT_IR) {
+        write_ir(optimized, &options);
     } else if (options.action == ACTION_TREE) {
         tree_interpreter_run_program(optimized);
     } else {
-        jit_interpreter_run_program(optimized);
+        jit_interpreter_run_program(optimized, &options);
     }
     
     node_free(optimized);
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for mkstemp() */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "autotune.h"
+#include "../backend/backend.h"
+#include "../optimizations/optimizations.h"
+
+#define TUNE_SUFFIX         ".tune"
+#define MAX_VARIANT_ARGS    4
+#define MAX_TUNE_ARGS       32
+#define MAX_TUNE_LENGTH     1024
+
+/* number of times each variant is run, the best time is kept */
+#define RUNS_PER_VARIANT    3
+
+/* The candidate configurations. The options specified on the command line
+ * apply to all of them, so they can be used to fix some settings (e.g.
+ * -no-check) while tuning the others. */
+static const char *variants[][MAX_VARIANT_ARGS] = {
+    {"-O1", NULL},
+    {"-O2", NULL},
+    {"-O2", "-align-loops", NULL},
+    {"-O3", NULL},
+    {"-O3", "-no-align-loops", NULL},
+    {"-O3", "-no-promote-registers", NULL},
+    {"-O3", "-no-vectorize", NULL},
+    {"-O3", "-no-absolute-pointer", NULL},
+    {"-O3", "-no-outline-loops", NULL},
+    {"-O3", "-march=native", NULL},
+    {"-O3", "-passes=rle,dce,offsets,(loops,constants)*", NULL},
+};
+
+#define NUM_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static int count_variant_args(const char **args) {
+    int count = 0;
+    
+    while(count < MAX_VARIANT_ARGS && args[count] != NULL) {
+        ++count;
+    }
+    
+    return count;
+}
+
+static void format_variant(char *buffer, size_t size, const char **args) {
+    buffer[0] = '\0';
+    
+    for(int idx = 0; idx < count_variant_args(args); ++idx) {
+        if(idx > 0) {
+            strncat(buffer, " ", size - strlen(buffer) - 1);
+        }
+        strncat(buffer, args[idx], size - strlen(buffer) - 1);
+    }
+}
+
+static char *get_tune_filename(const char *filename) {
+    char *tune_filename = malloc(strlen(filename) + sizeof(TUNE_SUFFIX));
+    
+    if(tune_filename == NULL) {
+        fprintf(stderr, "Error: memory allocation (autotune)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    strcpy(tune_filename, filename);
+    strcat(tune_filename, TUNE_SUFFIX);
+    
+    return tune_filename;
+}
+
+static double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void redirect(const char *filename, int flags, int target) {
+    int fd = open(filename, flags);
+    
+    if(fd < 0) {
+        fprintf(stderr, "Error opening %s: %s\n", filename, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    
+    dup2(fd, target);
+    close(fd);
+}
+
+/* Run the executable once and return the elapsed time in seconds, or a
+ * negative value if it did not exit successfully. */
+static double time_executable(const char *executable, const char *input) {
+    double start = get_time();
+    
+    pid_t pid = fork();
+    
+    if(pid < 0) {
+        fprintf(stderr, "Error: fork(): %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    if(pid == 0) {
+        redirect(input, O_RDONLY, STDIN_FILENO);
+        redirect("/dev/null", O_WRONLY, STDOUT_FILENO);
+        execl(executable, executable, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    
+    int status;
+    
+    if(waitpid(pid, &status, 0) < 0) {
+        fprintf(stderr, "Error: waitpid(): %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    double elapsed = get_time() - start;
+    
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        return -1.0;
+    }
+    
+    return elapsed;
+}
+
+static double time_variant(
+    const struct node *program,
+    const struct options *options,
+    const char **args,
+    const char *executable
+) {
+    struct options variant = *options;
+    
+    /* the option table is never modified through argv */
+    if(!parse_options_without_program(&variant, count_variant_args(args), (char **)args)) {
+        fprintf(stderr, "Error: invalid autotune variant\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    variant.action = ACTION_COMPILE;
+    variant.backend = BACKEND_ELF64;
+    variant.ofilename = executable;
+    
+    struct node *optimized = run_optimizations((struct node *)program, &variant);
+    backend_generate(optimized, &variant);
+    node_free(optimized);
+    
+    chmod(executable, S_IRWXU);
+    
+    double best = -1.0;
+    
+    for(int run = 0; run < RUNS_PER_VARIANT; ++run) {
+        double elapsed = time_executable(executable, variant.ifilename);
+        
+        if(elapsed < 0.0) {
+            return -1.0;
+        }
+        
+        if(best < 0.0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    
+    return best;
+}
+
+static void write_tune_file(const char *filename, const char **args) {
+    char *tune_filename = get_tune_filename(filename);
+    
+    FILE *f = fopen(tune_filename, "w");
+    
+    if(f == NULL) {
+        fprintf(stderr, "Error opening tuning file %s: %s\n", tune_filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    char buffer[MAX_TUNE_LENGTH];
+    format_variant(buffer, sizeof(buffer), args);
+    
+    fprintf(f, "# options selected by -autotune, remove this file to use the defaults\n");
+    fprintf(f, "%s\n", buffer);
+    
+    fclose(f);
+    
+    fprintf(stderr, "autotune: wrote '%s' to %s\n", buffer, tune_filename);
+    free(tune_filename);
+}
+
+void autotune_program(const struct node *program, const struct options *options) {
+    struct options base = *options;
+    
+    /* without a representative input, time the program with an empty one */
+    if(base.ifilename == NULL) {
+        base.ifilename = "/dev/null";
+    }
+    
+    char executable[] = "/tmp/bfc-autotune-XXXXXX";
+    int fd = mkstemp(executable);
+    
+    if(fd < 0) {
+        fprintf(stderr, "Error creating temporary file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    close(fd);
+    
+    int best_variant = -1;
+    double best_time = 0.0;
+    
+    for(int idx = 0; idx < NUM_VARIANTS; ++idx) {
+        char buffer[MAX_TUNE_LENGTH];
+        format_variant(buffer, sizeof(buffer), variants[idx]);
+        
+        double elapsed = time_variant(program, &base, variants[idx], executable);
+        
+        if(elapsed < 0.0) {
+            fprintf(stderr, "autotune: %-48s failed\n", buffer);
+            continue;
+        }
+        
+        fprintf(stderr, "autotune: %-48s %.6fs\n", buffer, elapsed);
+        
+        if(best_variant < 0 || elapsed < best_time) {
+            best_variant = idx;
+            best_time = elapsed;
+        }
+    }
+    
+    unlink(executable);
+    
+    if(best_variant < 0) {
+        fprintf(stderr, "Error: program did not run successfully with any variant\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    write_tune_file(options->filename, variants[best_variant]);
+}
+
+bool autotune_load_options(struct options *options) {
+    char *tune_filename = get_tune_filename(options->filename);
+    
+    FILE *f = fopen(tune_filename, "r");
+    
+    if(f == NULL) {
+        free(tune_filename);
+        return false;
+    }
+    
+    char buffer[MAX_TUNE_LENGTH];
+    char *args[MAX_TUNE_ARGS];
+    int num_args = 0;
+    
+    while(fgets(buffer, sizeof(buffer), f) != NULL) {
+        /* comments run to the end of the line */
+        buffer[strcspn(buffer, "#")] = '\0';
+        
+        for(char *arg = strtok(buffer, " \t\r\n"); arg != NULL; arg = strtok(NULL, " \t\r\n")) {
+            if(num_args >= MAX_TUNE_ARGS) {
+                fprintf(stderr, "Error: too many options in tuning file %s\n", tune_filename);
+                exit(EXIT_FAILURE);
+            }
+            
+            /* the options keep pointers to their arguments */
+            args[num_args++] = strdup(arg);
+        }
+    }
+    
+    fclose(f);
+    
+    if(!parse_options_without_program(options, num_args, args)) {
+        fprintf(stderr, "Error: invalid options in tuning file %s\n", tune_filename);
+        exit(EXIT_FAILURE);
+    }
+    
+    free(tune_filename);
+    return true;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for st_mtim */
+#include <string.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+uint64_t hash_bytes(uint64_t hash, const void *bytes, size_t size) {
+    const unsigned char *current = bytes;
+    
+    for(size_t idx = 0; idx < size; ++idx) {
+        hash ^= current[idx];
+        hash *= FNV_PRIME;
+    }
+    
+    return hash;
+}
+
+uint64_t hash_int(uint64_t hash, int64_t value) {
+    return hash_bytes(hash, &value, sizeof(value));
+}
+
+uint64_t hash_string(uint64_t hash, const char *string) {
+    if(string == NULL) {
+        return hash_int(hash, 0);
+    }
+    
+    hash = hash_int(hash, 1);
+    return hash_bytes(hash, string, strlen(string) + 1);
+}
+
+uint64_t hash_executable(uint64_t hash) {
+    struct stat status;
+    
+    if(stat("/proc/self/exe", &status) < 0) {
+        return hash_int(hash, 0);
+    }
+    
+    hash = hash_int(hash, status.st_dev);
+    hash = hash_int(hash, status.st_ino);
+    hash = hash_int(hash, status.st_size);
+    hash = hash_int(hash, status.st_mtim.tv_sec);
+    return hash_int(hash, status.st_mtim.tv_nsec);
+}
@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for fmemopen() and mkstemp() */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash.h"
+#include "incremental.h"
+#include "../frontend/parser.h"
+#include "../ir/builder.h"
+#include "../ir/serialize.h"
+#include "../optimizations/optimizations.h"
+
+/* The program is split into parts that each end with a top-level loop, plus
+ * whatever follows the last one. Since the parts are optimized on their own,
+ * the optimized IR of a part only depends on its text, on whether it is the
+ * first part and on the optimization options. The state file, next to the
+ * program, maps a hash of these to the IR of each part of the last
+ * compilation:
+ *
+ *  - a header;
+ *  - the parts, sorted by key, without duplicates;
+ *  - the IR records of the parts (see ir/serialize.h). */
+
+#define STATE_SUFFIX        ".bfinc"
+#define STATE_TEMP_SUFFIX   ".XXXXXX"
+/* to be incremented whenever the format or the way parts are optimized
+ * changes */
+#define STATE_VERSION       1
+#define BYTE_ORDER_MARK     0x01020304
+
+struct state_header {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t num_parts;
+};
+
+struct state_part {
+    uint64_t key;
+    /* length of the text of the part, to tell apart parts whose keys
+     * collide */
+    uint32_t length;
+    uint32_t first_record;
+    uint32_t num_records;
+    uint32_t padding;
+};
+
+static const char state_magic[8] = {'B', 'F', 'I', 'N', 'C', 0, 0, STATE_VERSION};
+
+/* a part of the program being compiled */
+struct part {
+    const char *text;
+    size_t length;
+    uint64_t key;
+    struct node *optimized;
+};
+
+/* the state file of the last compilation, mapped in memory */
+struct previous_state {
+    void *data;
+    size_t size;
+    const struct state_part *parts;
+    uint32_t num_parts;
+    const unsigned char *records;
+    uint32_t num_records;
+};
+
+static void *allocate(size_t size) {
+    /* never ask malloc() for zero bytes so NULL always means failure */
+    void *memory = malloc(size > 0 ? size : 1);
+    
+    if(memory == NULL) {
+        fprintf(stderr, "Error: memory allocation (incremental)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return memory;
+}
+
+static char *get_state_filename(const char *filename, const char *suffix) {
+    char *state_filename = allocate(strlen(filename) + strlen(STATE_SUFFIX) + strlen(suffix) + 1);
+    
+    strcpy(state_filename, filename);
+    strcat(state_filename, STATE_SUFFIX);
+    strcat(state_filename, suffix);
+    
+    return state_filename;
+}
+
+static char *read_source(const char *filename, size_t *length) {
+    FILE *f = fopen(filename, "r");
+    
+    if(f == NULL) {
+        fprintf(stderr, "Error opening input file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    size_t capacity = 4096;
+    char *text = allocate(capacity);
+    size_t size = 0;
+    size_t count;
+    
+    while((count = fread(&text[size], 1, capacity - size, f)) > 0) {
+        size += count;
+        
+        if(size == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+            
+            if(text == NULL) {
+                fprintf(stderr, "Error: memory allocation (incremental)\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    
+    if(ferror(f)) {
+        fprintf(stderr, "Error reading file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    fclose(f);
+    
+    *length = size;
+    return text;
+}
+
+/* Splits the text after each top-level loop. Returns the number of parts, or
+ * zero if the brackets are not balanced. */
+static size_t split_program(struct part **parts, const char *text, size_t length) {
+    size_t capacity = 16;
+    size_t num_parts = 0;
+    struct part *result = allocate(capacity * sizeof(struct part));
+    
+    size_t start = 0;
+    int depth = 0;
+    
+    for(size_t idx = 0; idx <= length; ++idx) {
+        bool is_end = (idx == length);
+        
+        if(!is_end && text[idx] == '[') {
+            ++depth;
+            continue;
+        }
+        
+        if(!is_end && text[idx] != ']') {
+            continue;
+        }
+        
+        if(!is_end && --depth > 0) {
+            continue;
+        }
+        
+        if(depth != 0) {
+            free(result);
+            return 0;
+        }
+        
+        if(num_parts == capacity) {
+            capacity *= 2;
+            result = realloc(result, capacity * sizeof(struct part));
+            
+            if(result == NULL) {
+                fprintf(stderr, "Error: memory allocation (incremental)\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        size_t end = is_end ? length : idx + 1;
+        
+        result[num_parts].text = &text[start];
+        result[num_parts].length = end - start;
+        result[num_parts].optimized = NULL;
+        ++num_parts;
+        
+        start = end;
+    }
+    
+    *parts = result;
+    return num_parts;
+}
+
+/* Only the options that change the optimized IR are part of the key. */
+static uint64_t hash_options(const struct options *options) {
+    uint64_t hash = hash_int(HASH_INITIAL, STATE_VERSION);
+    hash = hash_executable(hash);
+    hash = hash_int(hash, options->optimization_level);
+    hash = hash_int(hash, options->no_check);
+    return hash_string(hash, options->passes);
+}
+
+static uint64_t compute_key(uint64_t options_hash, const struct part *part, bool is_first) {
+    uint64_t hash = hash_int(options_hash, is_first);
+    return hash_bytes(hash, part->text, part->length);
+}
+
+static void load_previous_state(struct previous_state *state, const char *filename) {
+    memset(state, 0, sizeof(struct previous_state));
+    
+    char *state_filename = get_state_filename(filename, "");
+    int fd = open(state_filename, O_RDONLY);
+    
+    free(state_filename);
+    
+    if(fd < 0) {
+        return;
+    }
+    
+    struct stat status;
+    
+    if(fstat(fd, &status) < 0 || (size_t)status.st_size < sizeof(struct state_header)) {
+        close(fd);
+        return;
+    }
+    
+    size_t size = status.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    
+    close(fd);
+    
+    if(data == MAP_FAILED) {
+        return;
+    }
+    
+    const struct state_header *header = data;
+    size_t parts_size = (size_t)header->num_parts * sizeof(struct state_part);
+    size_t records_size = size - sizeof(struct state_header) - parts_size;
+    
+    if(
+        memcmp(header->magic, state_magic, sizeof(state_magic)) != 0 ||
+        header->byte_order != BYTE_ORDER_MARK ||
+        parts_size > size - sizeof(struct state_header) ||
+        records_size % IR_RECORD_SIZE != 0
+    ) {
+        munmap(data, size);
+        return;
+    }
+    
+    state->data = data;
+    state->size = size;
+    state->parts = (const struct state_part *)(header + 1);
+    state->num_parts = header->num_parts;
+    state->records = (const unsigned char *)(state->parts + state->num_parts);
+    state->num_records = records_size / IR_RECORD_SIZE;
+}
+
+static void free_previous_state(struct previous_state *state) {
+    if(state->data != NULL) {
+        munmap(state->data, state->size);
+    }
+}
+
+/* Looks up the part in the state of the last compilation and builds its
+ * tree. Returns false if the part is not there. */
+static bool reuse_part(struct part *part, const struct previous_state *state) {
+    uint32_t low = 0;
+    uint32_t high = state->num_parts;
+    
+    while(low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        
+        if(state->parts[middle].key < part->key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    if(low == state->num_parts) {
+        return false;
+    }
+    
+    const struct state_part *entry = &state->parts[low];
+    
+    if(entry->key != part->key || entry->length != part->length) {
+        return false;
+    }
+    
+    if(entry->first_record > state->num_records || entry->num_records > state->num_records - entry->first_record) {
+        return false;
+    }
+    
+    const unsigned char *records = &state->records[(size_t)entry->first_record * IR_RECORD_SIZE];
+    return tree_read_records(&part->optimized, records, entry->num_records);
+}
+
+static struct node *optimize_part(const struct part *part, const struct options *options, bool is_first) {
+    struct options part_options = *options;
+    part_options.program_part = is_first ? PART_FIRST : PART_NEXT;
+    
+    struct node *program = NULL;
+    
+    /* fmemopen() does not accept an empty buffer */
+    if(part->length > 0) {
+        FILE *f = fmemopen((void *)part->text, part->length, "r");
+        
+        if(f == NULL) {
+            fprintf(stderr, "Error: fmemopen(): %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        
+        program = parse_program(f);
+        fclose(f);
+    }
+    
+    struct node *optimized = run_optimizations(program, &part_options);
+    
+    node_free(program);
+    
+    return optimized;
+}
+
+static int compare_parts(const void *left, const void *right) {
+    const struct part *const *left_part = left;
+    const struct part *const *right_part = right;
+    uint64_t left_key = (*left_part)->key;
+    uint64_t right_key = (*right_part)->key;
+    
+    return (left_key > right_key) - (left_key < right_key);
+}
+
+/* Returns the parts sorted by key, so identical parts are next to each
+ * other. */
+static struct part **sort_parts(struct part *parts, size_t num_parts) {
+    struct part **sorted = allocate(num_parts * sizeof(struct part *));
+    
+    for(size_t idx = 0; idx < num_parts; ++idx) {
+        sorted[idx] = &parts[idx];
+    }
+    
+    qsort(sorted, num_parts, sizeof(struct part *), compare_parts);
+    
+    return sorted;
+}
+
+static bool is_same_part(const struct part *left, const struct part *right) {
+    return
+        left->key == right->key &&
+        left->length == right->length &&
+        memcmp(left->text, right->text, left->length) == 0;
+}
+
+static bool write_state(FILE *f, struct part *const *sorted, size_t num_parts) {
+    /* Identical parts, which are common in generated programs, are only
+     * recorded once. */
+    struct part **unique = allocate(num_parts * sizeof(struct part *));
+    size_t num_unique = 0;
+    
+    for(size_t idx = 0; idx < num_parts; ++idx) {
+        if(num_unique == 0 || unique[num_unique - 1]->key != sorted[idx]->key) {
+            unique[num_unique++] = sorted[idx];
+        }
+    }
+    
+    struct state_header header;
+    memcpy(header.magic, state_magic, sizeof(header.magic));
+    header.byte_order = BYTE_ORDER_MARK;
+    header.num_parts = num_unique;
+    
+    fwrite(&header, sizeof(header), 1, f);
+    
+    uint32_t first_record = 0;
+    
+    for(size_t idx = 0; idx < num_unique; ++idx) {
+        struct state_part entry;
+        entry.key = unique[idx]->key;
+        entry.length = unique[idx]->length;
+        entry.first_record = first_record;
+        entry.num_records = tree_count_records(unique[idx]->optimized);
+        entry.padding = 0;
+        
+        fwrite(&entry, sizeof(entry), 1, f);
+        
+        first_record += entry.num_records;
+    }
+    
+    bool success = true;
+    
+    for(size_t idx = 0; idx < num_unique && success; ++idx) {
+        success = tree_write_records(f, unique[idx]->optimized);
+    }
+    
+    free(unique);
+    
+    return success && !ferror(f);
+}
+
+/* The state file is written under a temporary name and renamed once
+ * complete, so an interrupted compilation leaves the previous one. The state
+ * only saves work for the next run, so failing to write it, e.g. when the
+ * program is in a read-only directory, is not an error. */
+static void save_state(const char *filename, struct part *const *sorted, size_t num_parts) {
+    char *temp_filename = get_state_filename(filename, STATE_TEMP_SUFFIX);
+    int fd = mkstemp(temp_filename);
+    
+    if(fd < 0) {
+        fprintf(stderr, "Warning: cannot create incremental state file: %s\n", strerror(errno));
+        free(temp_filename);
+        return;
+    }
+    
+    /* mkstemp() creates the file readable by its owner only */
+    fchmod(fd, 0644);
+    
+    FILE *f = fdopen(fd, "wb");
+    
+    if(f == NULL) {
+        close(fd);
+        unlink(temp_filename);
+        free(temp_filename);
+        return;
+    }
+    
+    bool success = write_state(f, sorted, num_parts);
+    
+    if(fclose(f) != 0) {
+        success = false;
+    }
+    
+    char *state_filename = get_state_filename(filename, "");
+    
+    if(!success || rename(temp_filename, state_filename) < 0) {
+        fprintf(stderr, "Warning: cannot write incremental state file %s\n", state_filename);
+        unlink(temp_filename);
+    }
+    
+    free(state_filename);
+    free(temp_filename);
+}
+
+bool incremental_optimize(struct node **optimized, const struct options *options) {
+    size_t length;
+    char *text = read_source(options->filename, &length);
+    
+    struct part *parts;
+    size_t num_parts = split_program(&parts, text, length);
+    
+    if(num_parts == 0) {
+        free(text);
+        return false;
+    }
+    
+    struct previous_state state;
+    load_previous_state(&state, options->filename);
+    
+    uint64_t options_hash = hash_options(options);
+    
+    for(size_t idx = 0; idx < num_parts; ++idx) {
+        parts[idx].key = compute_key(options_hash, &parts[idx], idx == 0);
+    }
+    
+    /* Identical parts within the program are only optimized, or taken from
+     * the state file, once. The others get a copy of the tree. */
+    struct part **sorted = sort_parts(parts, num_parts);
+    
+    for(size_t idx = 0; idx < num_parts; ++idx) {
+        struct part *part = sorted[idx];
+        
+        if(idx > 0 && is_same_part(sorted[idx - 1], part)) {
+            part->optimized = node_clone_tree(sorted[idx - 1]->optimized);
+        } else if(!reuse_part(part, &state)) {
+            part->optimized = optimize_part(part, options, part == &parts[0]);
+        }
+    }
+    
+    free_previous_state(&state);
+    
+    save_state(options->filename, sorted, num_parts);
+    free(sorted);
+    
+    struct builder builder;
+    builder_initialize_empty(&builder);
+    
+    for(size_t idx = 0; idx < num_parts; ++idx) {
+        builder_append_tree(&builder, parts[idx].optimized);
+    }
+    
+    *optimized = builder_get_first(&builder);
+    
+    free(parts);
+    free(text);
+    
+    return true;
+}
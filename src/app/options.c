@@ -28,8 +28,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "options.h"
 
@@ -39,32 +41,90 @@ typedef struct {
 } enum_value;
 
 typedef enum {
+    OPTION_ABSOLUTE_POINTER,
+    OPTION_ALIGN_LOOPS,
+    OPTION_ASYNC_IO,
+    OPTION_AUTOTUNE,
     OPTION_BACKEND,
+    OPTION_BASELINE_JIT,
+    OPTION_BATCH,
     OPTION_COMPILE,
+    OPTION_CONNECT,
+    OPTION_EMIT_IR,
+    OPTION_FROM_IR,
+    OPTION_INCREMENTAL,
+    OPTION_INPUT,
+    OPTION_J,
     OPTION_JIT,
+    OPTION_JIT_CACHE,
+    OPTION_MARCH,
+    OPTION_NO_ABSOLUTE_POINTER,
+    OPTION_NO_ALIGN_LOOPS,
+    OPTION_NO_BASELINE_JIT,
     OPTION_NO_CHECK,
+    OPTION_NO_OUTLINE_LOOPS,
+    OPTION_NO_PROMOTE_REGISTERS,
+    OPTION_NO_VECTORIZE,
     OPTION_O,
     OPTION_O0,
     OPTION_O1,
     OPTION_O2,
     OPTION_O3,
+    OPTION_OUTDIR,
+    OPTION_OUTLINE_LOOPS,
+    OPTION_PASSES,
+    OPTION_PRINT_AFTER_ALL,
+    OPTION_PROMOTE_REGISTERS,
+    OPTION_RPASS_MISSED,
+    OPTION_SERVER,
     OPTION_SLOW,
+    OPTION_STATIC,
     OPTION_TREE,
+    OPTION_VECTORIZE,
     OPTION_UNKNOWN
 } option_name;
 
 static const enum_value option_names[] = {
+    {"-absolute-pointer", OPTION_ABSOLUTE_POINTER},
+    {"-align-loops", OPTION_ALIGN_LOOPS},
+    {"-async-io",   OPTION_ASYNC_IO},
+    {"-autotune",   OPTION_AUTOTUNE},
     {"-backend",    OPTION_BACKEND},
+    {"-baseline-jit", OPTION_BASELINE_JIT},
+    {"-batch",      OPTION_BATCH},
     {"-compile",    OPTION_COMPILE},
+    {"-connect",    OPTION_CONNECT},
+    {"-emit-ir",    OPTION_EMIT_IR},
+    {"-from-ir",    OPTION_FROM_IR},
+    {"-incremental", OPTION_INCREMENTAL},
+    {"-input",      OPTION_INPUT},
+    {"-j",          OPTION_J},
     {"-jit",        OPTION_JIT},
+    {"-jit-cache",  OPTION_JIT_CACHE},
+    {"-march",      OPTION_MARCH},
+    {"-no-absolute-pointer", OPTION_NO_ABSOLUTE_POINTER},
+    {"-no-align-loops", OPTION_NO_ALIGN_LOOPS},
+    {"-no-baseline-jit", OPTION_NO_BASELINE_JIT},
     {"-no-check",   OPTION_NO_CHECK},
+    {"-no-outline-loops", OPTION_NO_OUTLINE_LOOPS},
+    {"-no-promote-registers", OPTION_NO_PROMOTE_REGISTERS},
+    {"-no-vectorize", OPTION_NO_VECTORIZE},
     {"-o",          OPTION_O},
     {"-O0",         OPTION_O0},
     {"-O1",         OPTION_O1},
     {"-O2",         OPTION_O2},
     {"-O3",         OPTION_O3},
+    {"-outdir",     OPTION_OUTDIR},
+    {"-outline-loops", OPTION_OUTLINE_LOOPS},
+    {"-passes",     OPTION_PASSES},
+    {"-print-after-all", OPTION_PRINT_AFTER_ALL},
+    {"-promote-registers", OPTION_PROMOTE_REGISTERS},
+    {"-Rpass-missed", OPTION_RPASS_MISSED},
+    {"-server",     OPTION_SERVER},
     {"-slow",       OPTION_SLOW},
+    {"-static",     OPTION_STATIC},
     {"-tree",       OPTION_TREE},
+    {"-vectorize",  OPTION_VECTORIZE},
     {NULL,          OPTION_UNKNOWN},
 };
 
@@ -75,6 +135,13 @@ static const enum_value backend_names[] = {
     {NULL,          BACKEND_UKNOWN},
 };
 
+static const enum_value march_names[] = {
+    {"avx2",        MARCH_AVX2},
+    {"baseline",    MARCH_BASELINE},
+    {"native",      MARCH_NATIVE},
+    {NULL,          MARCH_UNKNOWN},
+};
+
 int parse_enum_value(const char *name, const enum_value *values) {
     const enum_value *current = values;
     
@@ -92,25 +159,62 @@ static int parse_option_name(const char *arg) {
         ++arg;
     }
     
-    return parse_enum_value(arg, option_names);
+    /* The argument of an option can be specified after an equal sign (e.g.
+     * -passes=rle,offsets), in which case the name is what comes before. */
+    const char *equal = strchr(arg, '=');
+    
+    if(equal == NULL) {
+        return parse_enum_value(arg, option_names);
+    }
+    
+    char name[32];
+    size_t length = equal - arg;
+    
+    if(length >= sizeof(name)) {
+        return OPTION_UNKNOWN;
+    }
+    
+    memcpy(name, arg, length);
+    name[length] = '\0';
+    
+    return parse_enum_value(name, option_names);
 }
 
-bool parse_options(struct options *options, int argc, char *argv[]) {
-    options->no_check = false;
-    options->ofilename = NULL;
+static const char *get_option_argument(const char *arg, int argc, char *argv[], int *index) {
+    const char *equal = strchr(arg, '=');
     
-    if(argc < 2) {
-        return false;
+    if(equal != NULL) {
+        return equal + 1;
+    }
+    
+    ++*index;
+    
+    if(*index >= argc) {
+        return NULL;
     }
     
-    int index = 1;
+    return argv[*index];
+}
+
+/* Returns -1 unless the whole string is a positive decimal number. */
+static int parse_count(const char *value) {
+    char *end;
+    long count = strtol(value, &end, 10);
+    
+    if(*value == '\0' || *end != '\0' || count < 1 || count > INT_MAX) {
+        return -1;
+    }
     
+    return count;
+}
+
+static int parse_option_list(struct options *options, int argc, char *argv[], int index) {
     while(index < argc) {
         const char *arg = argv[index];
         int length = strlen(arg);
         
         if(length < 1) {
-            return false;
+            return -1;
         }
         
         if(arg[0] != '-') {
@@ -118,41 +222,155 @@ bool parse_options(struct options *options, int argc, char *argv[]) {
         }
         
         int option = parse_option_name(arg);
+        const char *value;
         
         switch(option) {
+        case OPTION_ABSOLUTE_POINTER:
+            options->absolute_pointer = TOGGLE_ON;
+            break;
+        case OPTION_ALIGN_LOOPS:
+            options->align_loops = TOGGLE_ON;
+            break;
+        case OPTION_ASYNC_IO:
+            options->async_io = true;
+            break;
+        case OPTION_AUTOTUNE:
+            options->action = ACTION_AUTOTUNE;
+            break;
         case OPTION_BACKEND:
-            ++index;
+            value = get_option_argument(arg, argc, argv, &index);
             
-            if(index >= argc) {
+            if(value == NULL) {
                 fprintf(stderr, "Empty -backend argument\n");
-                return false;
+                return -1;
             }
             
-            options->backend = parse_enum_value(argv[index], backend_names);
+            options->backend = parse_enum_value(value, backend_names);
             
             if(options->backend == BACKEND_UKNOWN) {
-                fprintf(stderr, "Unknown backend '%s'\n", argv[index]);
-                return false;
+                fprintf(stderr, "Unknown backend '%s'\n", value);
+                return -1;
             }
             break;
+        case OPTION_BASELINE_JIT:
+            options->baseline_jit = TOGGLE_ON;
+            break;
+        case OPTION_BATCH:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -batch argument\n");
+                return -1;
+            }
+            
+            options->batch_dir = value;
+            break;
         case OPTION_COMPILE:
             options->action = ACTION_COMPILE;
             break;
+        case OPTION_CONNECT:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -connect argument\n");
+                return -1;
+            }
+            
+            options->action = ACTION_CONNECT;
+            options->server_socket = value;
+            break;
+        case OPTION_EMIT_IR:
+            options->action = ACTION_EMIT_IR;
+            break;
+        case OPTION_FROM_IR:
+            options->from_ir = true;
+            break;
+        case OPTION_INCREMENTAL:
+            options->incremental = true;
+            break;
+        case OPTION_INPUT:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -input argument\n");
+                return -1;
+            }
+            
+            options->ifilename = value;
+            break;
+        case OPTION_J:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -j argument\n");
+                return -1;
+            }
+            
+            options->jobs = parse_count(value);
+            
+            if(options->jobs < 0) {
+                fprintf(stderr, "Invalid -j argument '%s'\n", value);
+                return -1;
+            }
+            break;
         case OPTION_JIT:
             options->action = ACTION_JIT;
             break;
+        case OPTION_JIT_CACHE:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -jit-cache argument\n");
+                return -1;
+            }
+            
+            options->jit_cache = value;
+            break;
+        case OPTION_MARCH:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -march argument\n");
+                return -1;
+            }
+            
+            options->march = parse_enum_value(value, march_names);
+            
+            if(options->march == MARCH_UNKNOWN) {
+                fprintf(stderr, "Unknown architecture '%s'\n", value);
+                return -1;
+            }
+            break;
+        case OPTION_NO_ABSOLUTE_POINTER:
+            options->absolute_pointer = TOGGLE_OFF;
+            break;
+        case OPTION_NO_ALIGN_LOOPS:
+            options->align_loops = TOGGLE_OFF;
+            break;
+        case OPTION_NO_BASELINE_JIT:
+            options->baseline_jit = TOGGLE_OFF;
+            break;
         case OPTION_NO_CHECK:
             options->no_check = true;
             break;
+        case OPTION_NO_OUTLINE_LOOPS:
+            options->outline_loops = TOGGLE_OFF;
+            break;
+        case OPTION_NO_PROMOTE_REGISTERS:
+            options->promote_registers = TOGGLE_OFF;
+            break;
+        case OPTION_NO_VECTORIZE:
+            options->vectorize = TOGGLE_OFF;
+            break;
         case OPTION_O:
-            ++index;
+            value = get_option_argument(arg, argc, argv, &index);
             
-            if(index >= argc) {
+            if(value == NULL) {
                 fprintf(stderr, "Empty -o argument\n");
-                return false;
+                return -1;
             }
             
-            options->ofilename = argv[index];
+            options->ofilename = value;
             break;
         case OPTION_O0:
             options->optimization_level = 0;
@@ -166,20 +384,114 @@ bool parse_options(struct options *options, int argc, char *argv[]) {
         case OPTION_O3:
             options->optimization_level = 3;
             break;
+        case OPTION_OUTDIR:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -outdir argument\n");
+                return -1;
+            }
+            
+            options->output_dir = value;
+            break;
+        case OPTION_OUTLINE_LOOPS:
+            options->outline_loops = TOGGLE_ON;
+            break;
+        case OPTION_PASSES:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -passes argument\n");
+                return -1;
+            }
+            
+            options->passes = value;
+            break;
+        case OPTION_PRINT_AFTER_ALL:
+            options->print_after_all = true;
+            break;
+        case OPTION_PROMOTE_REGISTERS:
+            options->promote_registers = TOGGLE_ON;
+            break;
+        case OPTION_RPASS_MISSED:
+            options->remarks_missed = true;
+            break;
+        case OPTION_SERVER:
+            value = get_option_argument(arg, argc, argv, &index);
+            
+            if(value == NULL) {
+                fprintf(stderr, "Empty -server argument\n");
+                return -1;
+            }
+            
+            options->server_socket = value;
+            break;
         case OPTION_SLOW:
             options->action = ACTION_SLOW;
             break;
+        case OPTION_STATIC:
+            options->static_executable = true;
+            break;
         case OPTION_TREE:
             options->action = ACTION_TREE;
             break;
+        case OPTION_VECTORIZE:
+            options->vectorize = TOGGLE_ON;
+            break;
         case OPTION_UNKNOWN:
             fprintf(stderr, "Unknown argument: %s\n", arg);
-            return false;
+            return -1;
         }
         
         ++index;
     }
     
+    return index;
+}
+
+void options_set_defaults(struct options *options) {
+    options->action = ACTION_JIT;
+    options->filename = NULL;
+    options->optimization_level = 3;
+    options->backend = BACKEND_ELF64;
+    options->ofilename = NULL;
+    options->ifilename = NULL;
+    options->no_check = false;
+    options->remarks_missed = false;
+    options->passes = NULL;
+    options->print_after_all = false;
+    options->align_loops = TOGGLE_DEFAULT;
+    options->promote_registers = TOGGLE_DEFAULT;
+    options->vectorize = TOGGLE_DEFAULT;
+    options->outline_loops = TOGGLE_DEFAULT;
+    options->absolute_pointer = TOGGLE_DEFAULT;
+    options->march = MARCH_DEFAULT;
+    options->baseline_jit = TOGGLE_DEFAULT;
+    options->jit_cache = NULL;
+    options->from_ir = false;
+    options->incremental = false;
+    options->program_part = PART_WHOLE;
+    options->static_executable = false;
+    options->batch_dir = NULL;
+    options->output_dir = NULL;
+    options->jobs = 0;
+    options->server_socket = NULL;
+    options->async_io = false;
+}
+
+bool parse_options(struct options *options, int argc, char *argv[]) {
+    if(argc < 2) {
+        return false;
+    }
+    
+    int index = parse_option_list(options, argc, argv, 1);
+    
+    /* the program is the one of the server */
+    if(index == argc && options->action == ACTION_CONNECT) {
+        options->filename = NULL;
+        return true;
+    }
+    
     if(index != argc - 1) {
         return false;
     }
@@ -187,3 +499,7 @@ bool parse_options(struct options *options, int argc, char *argv[]) {
     options->filename = argv[index];
     return true;
 }
+
+bool parse_options_without_program(struct options *options, int argc, char *argv[]) {
+    return parse_option_list(options, argc, argv, 0) == argc;
+}
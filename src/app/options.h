@@ -34,7 +34,10 @@
 #include <stdbool.h>
 
 typedef enum {
+    ACTION_AUTOTUNE,
     ACTION_COMPILE,
+    ACTION_CONNECT,
+    ACTION_EMIT_IR,
     ACTION_JIT,
     ACTION_SLOW,
     ACTION_TREE
@@ -47,15 +50,93 @@ typedef enum {
     BACKEND_UKNOWN
 } option_backend;
 
+/* instruction set extensions the generated x86 code may use */
+typedef enum {
+    /* native for the JIT, baseline otherwise */
+    MARCH_DEFAULT,
+    /* x86-64 with SSE2 */
+    MARCH_BASELINE,
+    MARCH_AVX2,
+    /* whatever the machine running the compiler supports */
+    MARCH_NATIVE,
+    MARCH_UNKNOWN
+} option_march;
+
+/* With -incremental, each top-level loop nest is optimized on its own. */
+typedef enum {
+    PART_WHOLE,
+    /* the first nest, which has to leave the data pointer where the next one
+     * expects it */
+    PART_FIRST,
+    /* a later nest, which starts right after a loop: only the current cell is
+     * known to be zero */
+    PART_NEXT
+} option_part;
+
+/* for options that can be forced on or off, or left to depend on the
+ * optimization level */
+typedef enum {
+    TOGGLE_DEFAULT,
+    TOGGLE_ON,
+    TOGGLE_OFF
+} option_toggle;
+
 struct options {
     option_action action;
     option_backend backend;
     const char *filename;
     const char *ofilename;
+    /* representative input for -autotune */
+    const char *ifilename;
     int optimization_level;
     bool no_check;
+    bool remarks_missed;
+    /* comma-separated list of optimization passes or NULL for the default
+     * pipeline of the optimization level */
+    const char *passes;
+    bool print_after_all;
+    option_toggle align_loops;
+    option_toggle promote_registers;
+    option_toggle vectorize;
+    option_toggle absolute_pointer;
+    option_toggle outline_loops;
+    option_march march;
+    /* JIT from pre-assembled stencils instead of the x86 code generator */
+    option_toggle baseline_jit;
+    /* directory where the JIT compiler keeps the code of the programs it
+     * runs, NULL for no cache */
+    const char *jit_cache;
+    /* the program file is an optimized program written by -emit-ir */
+    bool from_ir;
+    /* reuse the optimized IR of the top-level loop nests that did not change
+     * since the last compilation */
+    bool incremental;
+    /* part of the program being optimized */
+    option_part program_part;
+    /* with -batch, directory of the inputs the program is run on and
+     * directory where the output for each of them is written */
+    const char *batch_dir;
+    const char *output_dir;
+    /* number of threads that run the inputs of -batch, 0 for one per
+     * processor */
+    int jobs;
+    /* Unix socket on which -server waits for the requests of -connect */
+    const char *server_socket;
+    /* standard input and output go through buffers filled and drained by
+     * threads of their own */
+    bool async_io;
+    /* ELF64 executable that makes system calls directly instead of linking
+     * with the C library */
+    bool static_executable;
 };
 
+/* Sets the options to what they are when not on the command line, with the
+ * JIT compiler as the action. */
+void options_set_defaults(struct options *options);
+
 bool parse_options(struct options *options, int argc, char *argv[]);
 
+/* Parse options only, i.e. without the program file name at the end. */
+bool parse_options_without_program(struct options *options, int argc, char *argv[]);
+
 #endif
@@ -38,6 +38,7 @@
 #include "backend.h"
 #include "c.h"
 #include "elf64.h"
+#include "elf64static.h"
 #include "nasm.h"
 
 FILE *open_output_file(const struct options *options) {
@@ -84,6 +85,11 @@ void close_output_file(FILE *f) {
 }
 
 void backend_generate(const struct node *root, const struct options *options) {
+    if(options->static_executable && options->backend != BACKEND_ELF64) {
+        fprintf(stderr, "Error: -static is only supported by the elf64 backend\n");
+        exit(EXIT_FAILURE);
+    }
+    
     FILE *f = open_output_file(options);
     
     switch(options->backend) {
@@ -91,10 +97,14 @@ void backend_generate(const struct node *root, const struct options *options) {
         c_generate(f, root);
         break;
     case BACKEND_ELF64:
-        elf64_generate(f, root);
+        if(options->static_executable) {
+            elf64_static_generate(f, root, options);
+        } else {
+            elf64_generate(f, root, options);
+        }
         break;
     case BACKEND_NASM:
-        nasm_generate(f, root);
+        nasm_generate(f, root, options);
         break;
     case BACKEND_UKNOWN:
         break;
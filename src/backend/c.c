@@ -114,14 +114,18 @@ static void emit_fail_too_far_left_decl(struct state *state, const struct node *
 
 static bool has_in_node(const struct node *node) {
     while(node != NULL) {
-        if(node->type == NODE_IN) {
-            return true;
-        }
-        
-        if(node->type == NODE_LOOP && has_in_node(node->body)) {
+        switch(node->type) {
+        case NODE_IN:
             return true;
+        case NODE_LOOP:
+        case NODE_STATIC_LOOP:
+            if(has_in_node(node->body)) {
+                return true;
+            }
+            break;
+        default:
+            break;
         }
-        
         node = node->next;
     }
     return false;
@@ -47,13 +47,23 @@ const char *extern_symbol_names[NUM_EXTERN_SYMBOLS] = {
 
 const char *local_symbol_names[NUM_LOCAL_SYMBOLS] = {
     [LOCAL_CHECK_INPUT] = "check_input",
+    [LOCAL_EXIT_PROGRAM] = "exit_program",
     [LOCAL_FAIL_TOO_FAR_LEFT] = "fail_too_far_left",
     [LOCAL_FAIL_TOO_FAR_RIGHT] = "fail_too_far_right",
+    [LOCAL_FLUSH_OUTPUT] = "flush_output",
+    [LOCAL_INPUT_BUFFER] = "input_buffer",
+    [LOCAL_INPUT_LENGTH] = "input_length",
+    [LOCAL_INPUT_POSITION] = "input_position",
     [LOCAL_M] = "m",
     [LOCAL_MAIN] = "main",
     [LOCAL_MSG_EOI] = "msg_eoi",
     [LOCAL_MSG_FERR] = "msg_ferr",
     [LOCAL_MSG_LEFT] = "msg_left",
     [LOCAL_MSG_RIGHT] = "msg_right",
-    [LOCAL_START] = "_start"
+    [LOCAL_OUTPUT_BUFFER] = "output_buffer",
+    [LOCAL_OUTPUT_COUNT] = "output_count",
+    [LOCAL_READ_BYTE] = "read_byte",
+    [LOCAL_START] = "_start",
+    [LOCAL_WRITE_BYTE] = "write_byte",
+    [LOCAL_WRITE_ERROR] = "write_error"
 };
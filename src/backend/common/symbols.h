@@ -50,18 +50,28 @@ extern const char *extern_symbol_names[NUM_EXTERN_SYMBOLS];
 
 typedef enum {
     LOCAL_CHECK_INPUT,
+    LOCAL_EXIT_PROGRAM,
     LOCAL_FAIL_TOO_FAR_LEFT,
     LOCAL_FAIL_TOO_FAR_RIGHT,
+    LOCAL_FLUSH_OUTPUT,
+    LOCAL_INPUT_BUFFER,
+    LOCAL_INPUT_LENGTH,
+    LOCAL_INPUT_POSITION,
     LOCAL_M,
     LOCAL_MAIN,
     LOCAL_MSG_EOI,
     LOCAL_MSG_FERR,
     LOCAL_MSG_LEFT,
     LOCAL_MSG_RIGHT,
+    LOCAL_OUTPUT_BUFFER,
+    LOCAL_OUTPUT_COUNT,
+    LOCAL_READ_BYTE,
     LOCAL_START,
+    LOCAL_WRITE_BYTE,
+    LOCAL_WRITE_ERROR,
 } local_symbol;
 
-#define NUM_LOCAL_SYMBOLS 10
+#define NUM_LOCAL_SYMBOLS 20
 
 extern const char *local_symbol_names[NUM_LOCAL_SYMBOLS];
 
@@ -36,6 +36,7 @@
 #include <string.h>
 #include "../ir/query.h"
 #include "common/symbols.h"
+#include "x86/arena.h"
 #include "x86/builder.h"
 #include "x86/codegen.h"
 #include "x86/encoder.h"
@@ -43,7 +44,7 @@
 #include "elf64.h"
 #include "elf64defs.h"
 
-#define MSIZE 30000
+#define MSIZE (30000 + X86_TAPE_PADDING)
 #define NUM_HASH_BUCKETS 3
 #define NUM_PHDRS 6
 #define NUM_SECTIONS 17
@@ -1156,7 +1157,6 @@ static void write_process_linkage_table(
     
     free(buffer);
     x86_encoder_function_free(func);
-    x86_instr_free_tree(instrs);
 }
 
 static void initialize_encoder_context(
@@ -1396,8 +1396,11 @@ static void cleanup_code(
     }
 }
 
-void elf64_generate(FILE *f, const struct node *root) {
-    struct x86_function *code = generate_code_for_x86(root);
+void elf64_generate(FILE *f, const struct node *root, const struct options *options) {
+    struct x86_arena *arena = x86_arena_create();
+    struct x86_arena *previous_arena = x86_arena_use(arena);
+    
+    struct x86_function *code = generate_code_for_x86(root, options);
 
     struct local_function local_functions[NUM_LOCAL_SYMBOLS];
     struct extern_function extern_functions[NUM_EXTERN_SYMBOLS];
@@ -1456,4 +1459,7 @@ void elf64_generate(FILE *f, const struct node *root) {
     free_strtab(shstrtab);
     
     cleanup_code(code, local_functions);
+    
+    x86_arena_use(previous_arena);
+    x86_arena_free(arena);
 }
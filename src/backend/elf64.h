@@ -32,8 +32,9 @@
 #define BFC_BACKEND_ELF64_H
 
 #include <stdio.h>
+#include "../app/options.h"
 #include "../ir/node.h"
 
-void elf64_generate(FILE *f, const struct node *root);
+void elf64_generate(FILE *f, const struct node *root, const struct options *options);
 
 #endif
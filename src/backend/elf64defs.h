@@ -135,6 +135,7 @@ typedef struct {
 #define PT_SHLIB 5
 #define PT_PHDR 6
 
+#define PT_GNU_STACK    0x6474e551
 #define PT_GNU_RELRO    0x6474e552
 
 #define PF_X 0x1
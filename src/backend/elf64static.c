@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/symbols.h"
+#include "x86/arena.h"
+#include "x86/codegen.h"
+#include "x86/encoder.h"
+#include "x86/runtime.h"
+#include "elf64defs.h"
+#include "elf64static.h"
+
+/* A static executable has no interpreter, no dynamic section and no
+ * relocations: only the code and its messages in a read-only segment, and the
+ * pointer to the tape (.data) followed by the tape and the input and output
+ * buffers (.bss) in a read/write segment. The kernel jumps directly to _start,
+ * which makes starting the program much cheaper than loading and linking the
+ * C library. */
+
+#define MSIZE (30000 + X86_TAPE_PADDING)
+#define NUM_PHDRS 3
+#define NUM_SECTIONS 6
+#define TEXT_PHDR_BASE_ADDR 0x400000
+#define DATA_PHDR_BASE_ADDR 0x600000
+#define SHTAB_ALIGNMENT 8
+
+static const char msg_right[] = "Error: memory position out of bounds (overflow - too far right)\n";
+static const char msg_left[] = "Error: memory position out of bounds (underflow - too far left)\n";
+/* Unlike the dynamically linked executable, which calls perror(), the cause
+ * of the error is not reported. */
+static const char msg_ferr[] = "Error when reading input\n";
+static const char msg_eoi[] = "Error: reached end of input\n";
+
+struct message {
+    local_symbol symbol;
+    const char *text;
+    size_t size;
+};
+
+static const struct message messages[] = {
+    {LOCAL_MSG_EOI, msg_eoi, sizeof(msg_eoi)},
+    {LOCAL_MSG_FERR, msg_ferr, sizeof(msg_ferr)},
+    {LOCAL_MSG_LEFT, msg_left, sizeof(msg_left)},
+    {LOCAL_MSG_RIGHT, msg_right, sizeof(msg_right)}
+};
+
+#define NUM_MESSAGES (sizeof(messages) / sizeof(messages[0]))
+
+/* Contents of the .bss section, in order. The sizes are multiples of 16 so
+ * the tape and the buffers are aligned. The tape does not have a symbol of
+ * its own: the code finds it through the pointer in .data (LOCAL_M). */
+struct bss_variable {
+    local_symbol symbol;
+    size_t size;
+};
+
+#define BSS_TAPE NUM_LOCAL_SYMBOLS
+
+static const struct bss_variable bss_variables[] = {
+    {BSS_TAPE, MSIZE},
+    {LOCAL_OUTPUT_BUFFER, X86_RUNTIME_BUFFER_SIZE},
+    {LOCAL_INPUT_BUFFER, X86_RUNTIME_BUFFER_SIZE},
+    {LOCAL_OUTPUT_COUNT, 16},
+    {LOCAL_INPUT_LENGTH, 16},
+    {LOCAL_INPUT_POSITION, 16}
+};
+
+#define NUM_BSS_VARIABLES (sizeof(bss_variables) / sizeof(bss_variables[0]))
+
+enum section_index {
+    /* SHN_UNDEF = 0,*/
+    SECTION_TEXT = 1,
+    SECTION_RODATA = 2,
+    SECTION_DATA = 3,
+    SECTION_BSS = 4,
+    SECTION_SHSTRTAB = 5
+};
+
+static const char *section_names[] = {
+    [SHN_UNDEF] = "",
+    [SECTION_TEXT] = ".text",
+    [SECTION_RODATA] = ".rodata",
+    [SECTION_DATA] = ".data",
+    [SECTION_BSS] = ".bss",
+    [SECTION_SHSTRTAB] = ".shstrtab"
+};
+
+static Elf64_Shdr sections[] = {
+    [SHN_UNDEF] = {0},
+    [SECTION_TEXT] = {
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+        .sh_addralign = 16
+    },
+    [SECTION_RODATA] = {
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC,
+        .sh_addralign = 1
+    },
+    [SECTION_DATA] = {
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_WRITE | SHF_ALLOC,
+        .sh_addralign = 8,
+        .sh_size = 8
+    },
+    [SECTION_BSS] = {
+        .sh_type = SHT_NOBITS,
+        .sh_flags = SHF_WRITE | SHF_ALLOC,
+        .sh_addralign = 16
+    },
+    [SECTION_SHSTRTAB] = {
+        .sh_type = SHT_STRTAB,
+        .sh_addralign = 1
+    }
+};
+
+struct write_state {
+    FILE *f;
+    Elf64_Off offset;
+};
+
+static void initialize_write_state(struct write_state *state, FILE *f) {
+    state->f = f;
+    state->offset = 0;
+}
+
+static void write_bytes(struct write_state *state, const void *bytes, size_t nbytes) {
+    fwrite(bytes, 1, nbytes, state->f);
+    
+    if(ferror(state->f)) {
+        perror("Error: file write error");
+        exit(EXIT_FAILURE);
+    }
+    
+    state->offset += nbytes;
+}
+
+static void align_state(struct write_state *state, Elf64_Xword alignment) {
+    while((state->offset & (alignment - 1)) != 0) {
+        char zero = 0;
+        write_bytes(state, &zero, 1);
+    }
+}
+
+static void start_section(struct write_state *state, int index) {
+    align_state(state, sections[index].sh_addralign);
+    
+    if(state->offset != sections[index].sh_offset) {
+        fprintf(
+            stderr,
+            "Error: incorrect offset at start of section %s (expected: %" PRIu64 " actual: %" PRIu64 ")\n",
+            section_names[index],
+            sections[index].sh_offset,
+            state->offset
+        );
+        exit(EXIT_FAILURE);
+    }
+}
+
+static Elf64_Off align_offset(Elf64_Off offset, Elf64_Xword alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+static void *checked_malloc(size_t size, const char *description) {
+    void *object = malloc(size);
+    
+    if(object == NULL) {
+        fprintf(stderr, "Error: memory allocation (%s)\n", description);
+        exit(EXIT_FAILURE);
+    }
+    
+    return object;
+}
+
+static void mark_reference(bool *referenced, const struct x86_operand *operand) {
+    if(operand == NULL) {
+        return;
+    }
+    
+    if(operand->type == X86_OPERAND_LOCAL || operand->type == X86_OPERAND_MEM64_LOCAL) {
+        referenced[operand->n] = true;
+    }
+}
+
+static void enumerate_references(bool *referenced, const struct x86_function *code) {
+    for(const struct x86_function *func = code; func != NULL; func = func->next) {
+        for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
+            mark_reference(referenced, instr->dst);
+            mark_reference(referenced, instr->src);
+        }
+    }
+}
+
+static size_t compute_shstrtab_size(void) {
+    /* one because there is a leading empty string */
+    size_t size = 1;
+    
+    /* start index 1: skip the NULL section at the beginning */
+    for(int idx = 1; idx < NUM_SECTIONS; ++idx) {
+        size += strlen(section_names[idx]) + 1;
+    }
+    
+    return size;
+}
+
+/* Creates the encoder function of each function at its address in .text and
+ * sets the size of the section. */
+static void compute_text_section(
+    x86_encoder_function **encoder_funcs,
+    x86_encoder_context *context,
+    const struct x86_function *code
+) {
+    sections[SECTION_TEXT].sh_offset = align_offset(
+        sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr[NUM_PHDRS]),
+        sections[SECTION_TEXT].sh_addralign
+    );
+    sections[SECTION_TEXT].sh_addr = sections[SECTION_TEXT].sh_offset + TEXT_PHDR_BASE_ADDR;
+    
+    Elf64_Addr address = sections[SECTION_TEXT].sh_addr;
+    
+    for(const struct x86_function *func = code; func != NULL; func = func->next) {
+        encoder_funcs[func->symbol] = x86_encoder_function_create(func->instrs, address);
+        context->locals[func->symbol] = address;
+        address += x86_encoder_compute_function_size(encoder_funcs[func->symbol]);
+    }
+    
+    sections[SECTION_TEXT].sh_size = address - sections[SECTION_TEXT].sh_addr;
+}
+
+static void compute_remaining_sections(x86_encoder_context *context, const bool *referenced) {
+    /* .rodata: the messages that are used */
+    Elf64_Off offset = sections[SECTION_TEXT].sh_offset + sections[SECTION_TEXT].sh_size;
+    
+    sections[SECTION_RODATA].sh_offset = offset;
+    sections[SECTION_RODATA].sh_addr = offset + TEXT_PHDR_BASE_ADDR;
+    
+    for(size_t idx = 0; idx < NUM_MESSAGES; ++idx) {
+        if(referenced[messages[idx].symbol]) {
+            context->locals[messages[idx].symbol] = offset + TEXT_PHDR_BASE_ADDR;
+            offset += messages[idx].size;
+        }
+    }
+    
+    sections[SECTION_RODATA].sh_size = offset - sections[SECTION_RODATA].sh_offset;
+    
+    /* .data: starts a new segment, at an address that has the same offset
+     * from the start of a page as its offset in the file */
+    offset = align_offset(offset, sections[SECTION_DATA].sh_addralign);
+    
+    sections[SECTION_DATA].sh_offset = offset;
+    sections[SECTION_DATA].sh_addr = offset + DATA_PHDR_BASE_ADDR;
+    context->locals[LOCAL_M] = sections[SECTION_DATA].sh_addr;
+    
+    /* .bss: takes no space in the file */
+    Elf64_Addr address = align_offset(
+        sections[SECTION_DATA].sh_addr + sections[SECTION_DATA].sh_size,
+        sections[SECTION_BSS].sh_addralign
+    );
+    
+    sections[SECTION_BSS].sh_offset = offset + sections[SECTION_DATA].sh_size;
+    sections[SECTION_BSS].sh_addr = address;
+    
+    for(size_t idx = 0; idx < NUM_BSS_VARIABLES; ++idx) {
+        if(bss_variables[idx].symbol != BSS_TAPE) {
+            context->locals[bss_variables[idx].symbol] = address;
+        }
+        address += bss_variables[idx].size;
+    }
+    
+    sections[SECTION_BSS].sh_size = address - sections[SECTION_BSS].sh_addr;
+    
+    /* .shstrtab: not loaded */
+    sections[SECTION_SHSTRTAB].sh_offset = sections[SECTION_BSS].sh_offset;
+    sections[SECTION_SHSTRTAB].sh_size = compute_shstrtab_size();
+}
+
+static Elf64_Off compute_section_headers_offset(void) {
+    Elf64_Off shstrtab_end = sections[SECTION_SHSTRTAB].sh_offset + sections[SECTION_SHSTRTAB].sh_size;
+    return align_offset(shstrtab_end, SHTAB_ALIGNMENT);
+}
+
+static void write_elf_header(struct write_state *state) {
+    Elf64_Ehdr ehdr;
+    
+    memset(&ehdr, 0, sizeof(ehdr));
+    ehdr.e_ident[EI_MAG0] = 0x7f;
+    ehdr.e_ident[EI_MAG1] = 'E';
+    ehdr.e_ident[EI_MAG2] = 'L';
+    ehdr.e_ident[EI_MAG3] = 'F';
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = 1;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_ident[EI_ABIVERSION] = 0;
+    
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = 1;
+    /* _start is the first function */
+    ehdr.e_entry = sections[SECTION_TEXT].sh_addr;
+    ehdr.e_phoff = sizeof(ehdr);
+    ehdr.e_shoff = compute_section_headers_offset();
+    ehdr.e_flags = 0;
+    ehdr.e_ehsize = sizeof(ehdr);
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = NUM_PHDRS;
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = NUM_SECTIONS;
+    ehdr.e_shstrndx = SECTION_SHSTRTAB;
+    
+    write_bytes(state, &ehdr, sizeof(ehdr));
+}
+
+static void write_program_headers(struct write_state *state) {
+    Elf64_Phdr phdrs[NUM_PHDRS];
+    memset(phdrs, 0, sizeof(phdrs));
+    
+    int index = 0;
+    /* headers, text and read-only data */
+    phdrs[index].p_type = PT_LOAD;
+    phdrs[index].p_flags = PF_R | PF_X;
+    phdrs[index].p_align = 0x200000;
+    phdrs[index].p_filesz = sections[SECTION_RODATA].sh_offset + sections[SECTION_RODATA].sh_size;
+    phdrs[index].p_memsz = sections[SECTION_RODATA].sh_offset + sections[SECTION_RODATA].sh_size;
+    phdrs[index].p_offset = 0;
+    phdrs[index].p_vaddr = TEXT_PHDR_BASE_ADDR;
+    phdrs[index].p_paddr = TEXT_PHDR_BASE_ADDR;
+    ++index;
+    
+    /* read/write data */
+    phdrs[index].p_type = PT_LOAD;
+    phdrs[index].p_flags = PF_R | PF_W;
+    phdrs[index].p_align = 0x200000;
+    phdrs[index].p_filesz = sections[SECTION_DATA].sh_size;
+    phdrs[index].p_memsz = sections[SECTION_BSS].sh_addr + sections[SECTION_BSS].sh_size - sections[SECTION_DATA].sh_addr;
+    phdrs[index].p_offset = sections[SECTION_DATA].sh_offset;
+    phdrs[index].p_vaddr = sections[SECTION_DATA].sh_addr;
+    phdrs[index].p_paddr = sections[SECTION_DATA].sh_addr;
+    ++index;
+    
+    /* non-executable stack */
+    phdrs[index].p_type = PT_GNU_STACK;
+    phdrs[index].p_flags = PF_R | PF_W;
+    phdrs[index].p_align = 16;
+    ++index;
+    
+    write_bytes(state, phdrs, sizeof(phdrs));
+}
+
+static void write_text_section(
+    struct write_state *state,
+    const struct x86_function *code,
+    x86_encoder_function **encoder_funcs,
+    x86_encoder_context *context
+) {
+    start_section(state, SECTION_TEXT);
+    
+    for(const struct x86_function *func = code; func != NULL; func = func->next) {
+        size_t size = x86_encoder_compute_function_size(encoder_funcs[func->symbol]);
+        unsigned char *buffer = checked_malloc(size, "encoding buffer for local function");
+        
+        encode_for_x86(buffer, size, encoder_funcs[func->symbol], context);
+        write_bytes(state, buffer, size);
+        
+        free(buffer);
+    }
+}
+
+static void write_rodata_section(struct write_state *state, const bool *referenced) {
+    start_section(state, SECTION_RODATA);
+    
+    for(size_t idx = 0; idx < NUM_MESSAGES; ++idx) {
+        if(referenced[messages[idx].symbol]) {
+            write_bytes(state, messages[idx].text, messages[idx].size);
+        }
+    }
+}
+
+static void write_data_section(struct write_state *state) {
+    /* the tape is at the start of .bss */
+    const Elf64_Addr m = sections[SECTION_BSS].sh_addr;
+    
+    start_section(state, SECTION_DATA);
+    write_bytes(state, &m, sizeof(m));
+}
+
+static void write_section_headers_strings(struct write_state *state) {
+    start_section(state, SECTION_SHSTRTAB);
+    
+    /* leading empty string, which is the name of the NULL section */
+    Elf64_Word position = 0;
+    
+    for(int idx = 0; idx < NUM_SECTIONS; ++idx) {
+        size_t size = strlen(section_names[idx]) + 1;
+        
+        sections[idx].sh_name = position;
+        write_bytes(state, section_names[idx], size);
+        position += size;
+    }
+}
+
+static void write_section_headers(struct write_state *state) {
+    align_state(state, SHTAB_ALIGNMENT);
+    
+    Elf64_Off expected_offset = compute_section_headers_offset();
+    
+    if(state->offset != expected_offset) {
+        fprintf(
+            stderr,
+            "Error: incorrect offset at start of section headers table (expected: %" PRIu64 " actual: %" PRIu64 ")\n",
+            expected_offset,
+            state->offset
+        );
+        exit(EXIT_FAILURE);
+    }
+    
+    write_bytes(state, sections, sizeof(sections));
+}
+
+static void cleanup_code(struct x86_function *func, x86_encoder_function **encoder_funcs) {
+    while(func != NULL) {
+        x86_encoder_function_free(encoder_funcs[func->symbol]);
+        
+        struct x86_function *next = func->next;
+        x86_function_free(func);
+        
+        func = next;
+    }
+}
+
+void elf64_static_generate(FILE *f, const struct node *root, const struct options *options) {
+    struct x86_arena *arena = x86_arena_create();
+    struct x86_arena *previous_arena = x86_arena_use(arena);
+    
+    struct x86_function *code = generate_code_for_x86(root, options);
+    
+    bool referenced[NUM_LOCAL_SYMBOLS];
+    memset(referenced, 0, sizeof(referenced));
+    enumerate_references(referenced, code);
+    
+    x86_encoder_function *encoder_funcs[NUM_LOCAL_SYMBOLS];
+    x86_encoder_context context;
+    memset(&context, 0, sizeof(context));
+    
+    compute_text_section(encoder_funcs, &context, code);
+    
+    compute_remaining_sections(&context, referenced);
+    
+    struct write_state write_state;
+    initialize_write_state(&write_state, f);
+    
+    write_elf_header(&write_state);
+    
+    write_program_headers(&write_state);
+    
+    write_text_section(&write_state, code, encoder_funcs, &context);
+    
+    write_rodata_section(&write_state, referenced);
+    
+    write_data_section(&write_state);
+    
+    write_section_headers_strings(&write_state);
+    
+    write_section_headers(&write_state);
+    
+    cleanup_code(code, encoder_funcs);
+    
+    x86_arena_use(previous_arena);
+    x86_arena_free(arena);
+}
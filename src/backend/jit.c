@@ -28,9 +28,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define _BSD_SOURCE /* For MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE /* For MAP_ANONYMOUS */
 #include <sys/mman.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,48 +39,50 @@
 #include <unistd.h>
 #include "jit.h"
 #include "common/symbols.h"
-#include "x86/builder.h"
+#include "x86/arena.h"
 #include "x86/codegen.h"
 #include "x86/encoder.h"
 #include "x86/isa.h"
 
-#define MSIZE           30000
-#define PLT_ENTRY_SIZE  8
-#define GOT_ENTRY_SIZE  (sizeof(uintptr_t))
+/* distance below the C library at which to ask for the mapping, so direct
+ * calls can reach it */
+#define LIBC_DISTANCE   ((uintptr_t)1 << 30)
 
-static const char msg_right[] = "Error: memory position out of bounds (overflow - too far right)\n";
-static const char msg_left[] = "Error: memory position out of bounds (underflow - too far left)\n";
-/* no end of line (\n) for this one because we are calling perror() instead of fprintf() */
-static const char msg_ferr[] = "Error when reading input";
-static const char msg_eoi[] = "Error: reached end of input\n";
-
-struct section {
-    uintptr_t offset;
+/* The code generated for the JIT compiler has no data of its own (see
+ * generate_reentrant_code_for_x86()), so the mapping only contains code. */
+struct jit_compiled_program {
+    jit_main main;
+    /* offset of the main function in the code */
+    size_t main_offset;
+    unsigned char *data;
     size_t size;
+    /* calls to the C library, which have to be patched when the code is
+     * loaded in another process (see jit_compiled_program_save()) */
+    x86_encoder_relocations relocations;
+    /* false if the code contains absolute addresses (see
+     * make_calls_indirect()) */
+    bool relocatable;
 };
 
-enum section_index {
-    SECTION_PLT = 0,
-    SECTION_TEXT,
-    SECTION_RODATA,
-    SECTION_GOT,
-    SECTION_DATA,
-    SECTION_BSS,
-    NUM_SECTIONS
+/* What jit_compiled_program_save() writes before the code and the
+ * relocations. */
+struct image_header {
+    char magic[8];
+    uint64_t text_size;
+    uint64_t main_offset;
+    uint64_t num_relocations;
 };
 
-struct jit_compiled_program {
-    jit_main main;
-    unsigned char *data;
-    struct section sections[NUM_SECTIONS];
-};
+static const char image_magic[8] = "BFJIT\0\0\2";
 
+/* The functions that allocate memory return NULL or false on failure
+ * instead of exiting, so jit_compiled_program_create() can be called from the
+ * library. */
 static jit_compiled_program *allocate_compiled_program(void) {
     jit_compiled_program *compiled = malloc(sizeof(jit_compiled_program));
     
     if(compiled == NULL) {
-        fprintf(stderr, "Error: memory allocation (JIT context)\n");
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     memset(compiled, 0, sizeof(jit_compiled_program));
@@ -87,90 +90,132 @@ static jit_compiled_program *allocate_compiled_program(void) {
     return compiled;
 }
 
-typedef enum {
-    EXTERN_TYPE_UNUSED = 0,
-    EXTERN_TYPE_FUNCTION,
-    EXTERN_TYPE_DATA
-} extern_type;
-
-struct extern_function {
-    extern_type type;
-};
-
-typedef enum {
-    LOCAL_TYPE_UNUSED = 0,
-    LOCAL_TYPE_REFERENCED
-} local_type;
+static x86_encoder_relocation *allocate_relocations(size_t count) {
+    /* never ask malloc() for zero bytes so NULL always means failure */
+    return malloc(count > 0 ? count * sizeof(x86_encoder_relocation) : 1);
+}
 
 struct local_function {
-    local_type type;
     size_t size;
     struct x86_encoder_function *encoder_func;
 };
 
-static void enumerate_references(
-    struct local_function *local_functions,
-    struct extern_function *extern_functions,
-    const struct x86_function *code
-) {
-    for(const struct x86_function *func = code; func != NULL; func = func->next) {
-        for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
-            if(instr->dst != NULL) {
-                switch(instr->dst->type) {
-                case X86_OPERAND_EXTERN:
-                    extern_functions[instr->dst->n].type = EXTERN_TYPE_FUNCTION;
-                    break;
-                case X86_OPERAND_MEM64_EXTERN:
-                    extern_functions[instr->dst->n].type = EXTERN_TYPE_DATA;
-                    break;
-                case X86_OPERAND_LOCAL:
-                case X86_OPERAND_MEM64_LOCAL:
-                    local_functions[instr->dst->n].type = LOCAL_TYPE_REFERENCED;
-                    break;
-                default:
-                    break;
-                }
+/* Whether the code may call an external symbol. The standard streams are
+ * passed in the context instead and _start, which calls the C library entry
+ * point, is not generated. */
+static bool is_extern_function(extern_symbol symbol) {
+    switch(symbol) {
+    case EXTERN_STDERR:
+    case EXTERN_STDIN:
+    case EXTERN_STDOUT:
+    case EXTERN_LIBC_START_MAIN:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static uintptr_t get_extern_value(extern_symbol symbol) {
+    switch(symbol) {
+    case EXTERN_EXIT:
+        return (uintptr_t)exit;
+    case EXTERN_FERROR:
+        return (uintptr_t)ferror;
+    case EXTERN_FGETC:
+        return (uintptr_t)fgetc;
+    case EXTERN_FPRINTF:
+        return (uintptr_t)fprintf;
+    case EXTERN_PERROR:
+        return (uintptr_t)perror;
+    case EXTERN_PUTC:
+        return (uintptr_t)putc;
+    default:
+        break;
+    }
+    
+    fprintf(stderr, "Error: unsupported external symbol (JIT)\n");
+    exit(EXIT_FAILURE);
+}
+
+/* The code generator calls the C library the way an executable does, i.e.
+ * through the PLT. In process, the addresses are known, so the functions are
+ * called directly, which keeps the code position independent apart from the
+ * calls, so it can be saved and loaded again by another process.
+ *
+ * This replaces the direct calls to external functions by calls through a
+ * register, for when the mapping ends up too far from the C library for a
+ * 32-bit displacement. R11 is neither preserved across calls nor used to
+ * pass arguments. */
+static void make_calls_indirect(struct x86_function *code) {
+    for(struct x86_function *func = code; func != NULL; func = func->next) {
+        for(struct x86_instr **link = &func->instrs; *link != NULL; link = &(*link)->next) {
+            struct x86_instr *instr = *link;
+            
+            if(instr->op != X86_INSTR_CALL || instr->dst->type != X86_OPERAND_EXTERN) {
+                continue;
             }
             
-            if(instr->src != NULL) {
-                switch(instr->src->type) {
-                case X86_OPERAND_MEM64_EXTERN:
-                    extern_functions[instr->src->n].type = EXTERN_TYPE_DATA;
-                    break;
-                case X86_OPERAND_LOCAL:
-                case X86_OPERAND_MEM64_LOCAL:
-                    local_functions[instr->src->n].type = LOCAL_TYPE_REFERENCED;
-                    break;
-                default:
-                    break;
-                }
+            struct x86_instr *mov = x86_instr_new_mov(
+                x86_operand_new_reg64(X86_REG_R11),
+                x86_operand_new_imm64(get_extern_value(instr->dst->n))
+            );
+            struct x86_instr *call = x86_instr_new_call(
+                x86_operand_new_reg64(X86_REG_R11)
+            );
+            
+            mov->next = call;
+            call->next = instr->next;
+            *link = mov;
+            link = &mov->next;
+        }
+    }
+}
+
+static bool is_in_rel32_range(uintptr_t from, uintptr_t to) {
+    intptr_t distance = (intptr_t)(to - from);
+    return distance >= INT32_MIN && distance <= INT32_MAX;
+}
+
+static size_t count_extern_calls(const struct x86_function *code) {
+    size_t count = 0;
+    
+    for(const struct x86_function *func = code; func != NULL; func = func->next) {
+        for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
+            if(instr->op == X86_INSTR_CALL && instr->dst->type == X86_OPERAND_EXTERN) {
+                ++count;
             }
         }
     }
+    
+    return count;
 }
 
-static int count_externs_with_type(
-    const struct extern_function *extern_functions,
-    extern_type type
-) {
-    int n = 0;
+static bool are_externs_in_reach(const jit_compiled_program *compiled, const struct x86_function *code) {
+    uintptr_t text_start = (uintptr_t)compiled->data;
+    uintptr_t text_end = text_start + compiled->size;
     
-    for(int idx = 0; idx < NUM_EXTERN_SYMBOLS; ++idx) {
-        if(extern_functions[idx].type == type) {
-            ++n;
+    for(const struct x86_function *func = code; func != NULL; func = func->next) {
+        for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
+            if(instr->op != X86_INSTR_CALL || instr->dst->type != X86_OPERAND_EXTERN) {
+                continue;
+            }
+            
+            uintptr_t target = get_extern_value(instr->dst->n);
+            
+            if(!is_in_rel32_range(text_start, target) || !is_in_rel32_range(text_end, target)) {
+                return false;
+            }
         }
     }
     
-    return n;
+    return true;
 }
 
 static size_t compute_local_function_sizes(
     struct local_function *local_functions,
-    const struct x86_function *code,
-    const jit_compiled_program *compiled
+    const struct x86_function *code
 ) {
-    uintptr_t start = compiled->sections[SECTION_TEXT].offset;
-    uintptr_t offset = start;
+    uintptr_t offset = 0;
     
     for(const struct x86_function *func = code; func != NULL; func = func->next) {
         struct local_function *local_func = &local_functions[func->symbol];
@@ -181,79 +226,28 @@ static size_t compute_local_function_sizes(
         offset += local_func->size;
     }
     
-    return offset - start;
+    return offset;
 }
 
-static size_t compute_rodata_size(const struct local_function *local_functions) {
-    size_t size = 0;
-    
-    if(local_functions[LOCAL_MSG_EOI].type) {
-        size += sizeof(msg_eoi);
-    }
-    
-    if(local_functions[LOCAL_MSG_FERR].type) {
-        size += sizeof(msg_ferr);
-    }
-    
-    if(local_functions[LOCAL_MSG_LEFT].type) {
-        size += sizeof(msg_left);
-    }
+/* Asks for the mapping a bit below the C library, where there is usually
+ * room, so the code can call it directly. This is only a hint: the kernel
+ * places the mapping elsewhere if the range is already in use. */
+static void *get_mapping_hint(const jit_compiled_program *compiled) {
+    uintptr_t libc = (uintptr_t)putc;
+    size_t size = compiled->size;
     
-    if(local_functions[LOCAL_MSG_RIGHT].type) {
-        size += sizeof(msg_right);
+    if(libc < LIBC_DISTANCE + size) {
+        return NULL;
     }
     
-    return size;
-}
-
-static uintptr_t section_end(const struct section *section) {
-    return section->offset + section->size;
-}
-
-static void compute_section_sizes(
-    jit_compiled_program *compiled,
-    struct local_function *local_functions,
-    const struct extern_function *extern_functions,
-    const struct x86_function *code
-) {
-    const int num_extern_functions = count_externs_with_type(extern_functions, EXTERN_TYPE_FUNCTION);
-    const int num_extern_data = count_externs_with_type(extern_functions, EXTERN_TYPE_DATA);
-    
-    compiled->sections[SECTION_PLT].offset = 0;
-    compiled->sections[SECTION_PLT].size = num_extern_functions * PLT_ENTRY_SIZE;
-    
-    uintptr_t plt_end = section_end(&compiled->sections[SECTION_PLT]);
-    /* align on 16 bytes */
-    compiled->sections[SECTION_TEXT].offset = (plt_end + 15) & ~(uintptr_t)15;
-    compiled->sections[SECTION_TEXT].size =
-        compute_local_function_sizes(local_functions, code, compiled);
-
-    compiled->sections[SECTION_RODATA].offset = section_end(&compiled->sections[SECTION_TEXT]);
-    compiled->sections[SECTION_RODATA].size = compute_rodata_size(local_functions);
-    
-    uintptr_t rodata_end = section_end(&compiled->sections[SECTION_RODATA]);
     long int pagesize = sysconf(_SC_PAGESIZE);
-
-    if(pagesize < 0) {
-        fprintf(stderr, "Error: sysconf(_SC_PAGESIZE) failed\n");
-        exit(EXIT_FAILURE);
-    }
-
-    /* align on next page boundary */
-    compiled->sections[SECTION_GOT].offset = (rodata_end + pagesize - 1) & ~(uintptr_t)(pagesize - 1);
-    compiled->sections[SECTION_GOT].size = (num_extern_functions + num_extern_data) * GOT_ENTRY_SIZE;
-
-    compiled->sections[SECTION_DATA].offset = section_end(&compiled->sections[SECTION_GOT]);
-    compiled->sections[SECTION_DATA].size = sizeof(uintptr_t);
-
-    compiled->sections[SECTION_BSS].offset = section_end(&compiled->sections[SECTION_DATA]);
-    compiled->sections[SECTION_BSS].size = MSIZE;
+    return (void *)((libc - LIBC_DISTANCE - size) & ~(uintptr_t)(pagesize - 1));
 }
 
-static void allocate_memory(jit_compiled_program *compiled) {
+static bool allocate_memory(jit_compiled_program *compiled, void *hint) {
     compiled->data = mmap(
-        NULL,
-        section_end(&compiled->sections[NUM_SECTIONS - 1]),
+        hint,
+        compiled->size,
         PROT_READ | PROT_WRITE,
         MAP_PRIVATE | MAP_ANONYMOUS,
         -1,
@@ -261,248 +255,84 @@ static void allocate_memory(jit_compiled_program *compiled) {
     );
 
     if(compiled->data == MAP_FAILED) {
-        fprintf(stderr, "Error: memory allocation (mmap() for JIT data)\n");
-        exit(EXIT_FAILURE);
-    }
-}
-
-static struct x86_instr *generate_instructions_for_plt(
-    const jit_compiled_program *compiled,
-    const struct extern_function *extern_functions
-
-) {
-    struct x86_builder builder;
-    x86_builder_initialize_empty(&builder);
-
-    uintptr_t *got = (uintptr_t *)compiled->sections[SECTION_GOT].offset;
-    
-    int plt_index = 0;
-    int got_index = 0;
-    
-    for(int idx = 0; idx < NUM_EXTERN_SYMBOLS; ++idx) {
-        if(extern_functions[idx].type == EXTERN_TYPE_UNUSED) {
-            continue;
-        }
-
-        if(extern_functions[idx].type == EXTERN_TYPE_FUNCTION) {        
-            x86_builder_append_instr(&builder, x86_instr_new_jmp(
-                x86_operand_new_mem64_rel((uintptr_t)&got[got_index])
-            ));
-
-            x86_builder_append_instr(&builder, x86_instr_new_align(PLT_ENTRY_SIZE));
-            
-            ++plt_index;
-        }
-
-        ++got_index;
+        compiled->data = NULL;
+        return false;
     }
     
-    return x86_builder_get_first(&builder);
+    return true;
 }
 
-static void write_process_linkage_table(
-    const jit_compiled_program *compiled,
-    const struct extern_function *extern_functions
-) {
-    uintptr_t offset = compiled->sections[SECTION_PLT].offset;
-    size_t size = compiled->sections[SECTION_PLT].size;
-    
-    struct x86_instr *instrs = generate_instructions_for_plt(compiled, extern_functions);
-    
-    x86_encoder_function *func = x86_encoder_function_create(instrs, offset);
-    
-    if(x86_encoder_compute_function_size(func) != size) {
-        fprintf(stderr, "Error: PLT generation (wrong size)\n");
-        exit(EXIT_FAILURE);
+static void free_memory(jit_compiled_program *compiled) {
+    if(compiled->data != NULL) {
+        munmap(compiled->data, compiled->size);
+        compiled->data = NULL;
     }
-
-    x86_encoder_context dummy_context; 
-    unsigned char *plt = compiled->data + offset;
-    encode_for_x86(plt, size, func, &dummy_context);
-
-    x86_encoder_function_free(func);
-    x86_instr_free_tree(instrs);
 }
 
 static void initialize_encoder_context(
     x86_encoder_context *context,
     const struct jit_compiled_program *compiled,
     const struct x86_function *code,
-    const struct local_function *local_functions,
-    const struct extern_function *extern_functions
+    const struct local_function *local_functions
 ) {
-    /* external symbols */
-    
-    const char *plt = (const char *)compiled->sections[SECTION_PLT].offset;
-    const uintptr_t *got = (uintptr_t *)compiled->sections[SECTION_GOT].offset;
-    
-    int plt_offset = 0;
-    int got_index = 0;
+    /* external symbols - the addresses used for encoding are offsets in
+     * the mapping */
     
     for(int idx = 0; idx < NUM_EXTERN_SYMBOLS; ++idx) {
-        if(extern_functions[idx].type == EXTERN_TYPE_UNUSED) {
-            continue;
-        }
-
-        if(extern_functions[idx].type == EXTERN_TYPE_FUNCTION) {        
-            context->externs[idx] = (intptr_t)&plt[plt_offset];
-            plt_offset += PLT_ENTRY_SIZE;
-        }
-
-        if(extern_functions[idx].type == EXTERN_TYPE_DATA) {        
-            context->externs[idx] = (intptr_t)&got[got_index];
+        if(is_extern_function(idx)) {
+            context->externs[idx] = get_extern_value(idx) - (uintptr_t)compiled->data;
         }
-
-        ++got_index;
     }
     
-    /* local symbols - functions */
+    /* local symbols */
     for(const struct x86_function *func = code; func != NULL; func = func->next) {
         struct x86_encoder_function *encoder_func = local_functions[func->symbol].encoder_func;
         context->locals[func->symbol] = x86_encoder_function_get_address(encoder_func);
     }
-    
-    /* local symbols - data */
-    
-    const char *rodata = (const char *)compiled->sections[SECTION_RODATA].offset;
-    int rodata_index = 0;
-    
-    if(local_functions[LOCAL_MSG_EOI].type) {
-        context->locals[LOCAL_MSG_EOI] = (intptr_t)&rodata[rodata_index];
-        rodata_index += sizeof(msg_eoi);
-    }
-    
-    if(local_functions[LOCAL_MSG_FERR].type) {
-        context->locals[LOCAL_MSG_FERR] = (intptr_t)&rodata[rodata_index];
-        rodata_index += sizeof(msg_ferr);
-    }
-    
-    if(local_functions[LOCAL_MSG_LEFT].type) {
-        context->locals[LOCAL_MSG_LEFT] = (intptr_t)&rodata[rodata_index];
-        rodata_index += sizeof(msg_left);
-    }
-    
-    if(local_functions[LOCAL_MSG_RIGHT].type) {
-        context->locals[LOCAL_MSG_RIGHT] = (intptr_t)&rodata[rodata_index];
-        rodata_index += sizeof(msg_right);
-    }
-    
-    context->locals[LOCAL_M] = compiled->sections[SECTION_DATA].offset;
 }
-
+    
 static void write_text_section(
-    const struct jit_compiled_program *compiled,
+    struct jit_compiled_program *compiled,
     const struct x86_function *code,
-    const struct local_function *local_functions,
-    const struct extern_function *extern_functions
+    const struct local_function *local_functions
 ) {
     x86_encoder_context context;
-    initialize_encoder_context(&context, compiled, code, local_functions, extern_functions);
+    initialize_encoder_context(&context, compiled, code, local_functions);
 
-    unsigned char *const text = compiled->data + compiled->sections[SECTION_TEXT].offset;
+    unsigned char *const text = compiled->data;
     int offset = 0;
 
     for(const struct x86_function *func = code; func != NULL; func = func->next) {
         size_t size = local_functions[func->symbol].size;
 
-        encode_for_x86(&text[offset], size, local_functions[func->symbol].encoder_func, &context);
+        encode_for_x86_with_relocations(
+            &text[offset],
+            size,
+            local_functions[func->symbol].encoder_func,
+            &context,
+            &compiled->relocations
+        );
         
         offset += size;
     }
 }
 
-static void write_rodata_section(
-    const struct jit_compiled_program *compiled,
-    const struct local_function *local_functions
-) {
-    unsigned char *dest = compiled->data + compiled->sections[SECTION_RODATA].offset;
-    
-    if(local_functions[LOCAL_MSG_EOI].type) {
-        memcpy(dest, msg_eoi, sizeof(msg_eoi));
-        dest += sizeof(msg_eoi);
-    }
-    
-    if(local_functions[LOCAL_MSG_FERR].type) {
-        memcpy(dest, msg_ferr, sizeof(msg_ferr));
-        dest += sizeof(msg_ferr);
-    }
-    
-    if(local_functions[LOCAL_MSG_LEFT].type) {
-        memcpy(dest, msg_left, sizeof(msg_left));
-        dest += sizeof(msg_left);
-    }
-    
-    if(local_functions[LOCAL_MSG_RIGHT].type) {
-        memcpy(dest, msg_right, sizeof(msg_right));
-        dest += sizeof(msg_right);
-    }
-}
-
-static void write_got_section(
-    const struct jit_compiled_program *compiled,
-    const struct extern_function *extern_functions
-) {
-    uintptr_t *got = (uintptr_t *)(compiled->data + compiled->sections[SECTION_GOT].offset);
-
-    int got_index = 0;
-    
-    for(extern_symbol symbol = 0; symbol < NUM_EXTERN_SYMBOLS; ++symbol) {
-        if(extern_functions[symbol].type == EXTERN_TYPE_UNUSED) {
-            continue;
-        }
-
-        switch(symbol) {
-        case EXTERN_EXIT:
-            got[got_index] = (uintptr_t)exit;
-            break;
-        case EXTERN_FERROR:
-            got[got_index] = (uintptr_t)ferror;
-            break;
-        case EXTERN_FGETC:
-            got[got_index] = (uintptr_t)fgetc;
-            break;
-        case EXTERN_FPRINTF:
-            got[got_index] = (uintptr_t)fprintf;
-            break;
-        case EXTERN_LIBC_START_MAIN:
-            /* Called by _start which isn't used in JIT context. */
-            break;
-        case EXTERN_PERROR:
-            got[got_index] = (uintptr_t)perror;
-            break;
-        case EXTERN_PUTC:
-            got[got_index] = (uintptr_t)putc;
-            break;
-        case EXTERN_STDERR:
-            got[got_index] = (uintptr_t)stderr;
-            break;
-        case EXTERN_STDIN:
-            got[got_index] = (uintptr_t)stdin;
-            break;
-        case EXTERN_STDOUT:
-            got[got_index] = (uintptr_t)stdout;
-            break;
-        }
-        
-        ++got_index;
-    }
-}
-
-static void write_data_section(const struct jit_compiled_program *compiled) {
-    unsigned char **m = (unsigned char **)(compiled->data + compiled->sections[SECTION_DATA].offset);
-    *m = compiled->data + compiled->sections[SECTION_BSS].offset;
-}
-
-static void protect_and_make_executable(jit_compiled_program *compiled) {
+static bool protect_and_make_executable(jit_compiled_program *compiled) {
     int status = mprotect(
         compiled->data,
-        section_end(&compiled->sections[SECTION_RODATA]),
+        compiled->size,
         PROT_READ | PROT_EXEC
     );
 
-    if(status < 0) {
-        fprintf(stderr, "Error: mprotect() failed\n");
-        exit(EXIT_FAILURE);
+    return status == 0;
+}
+
+static void free_encoder_functions(
+    const struct x86_function *code,
+    struct local_function *local_functions
+) {
+    for(const struct x86_function *func = code; func != NULL; func = func->next) {
+        x86_encoder_function_free(local_functions[func->symbol].encoder_func);
     }
 }
 
@@ -510,10 +340,9 @@ static void cleanup_code(
     struct x86_function *func,
     struct local_function *local_functions
 ) {
+    free_encoder_functions(func, local_functions);
     
     while(func != NULL) {
-        x86_encoder_function_free(local_functions[func->symbol].encoder_func);
-        
         struct x86_function *next = func->next;
         x86_function_free(func);
 
@@ -523,65 +352,237 @@ static void cleanup_code(
 
 typedef void (*nullfuncptr)(void);
 
-static nullfuncptr get_local_function_address(
-    local_symbol symbol,
-    const jit_compiled_program *compiled,
-    const struct local_function *local_functions
-) {
-    const x86_encoder_function *func = local_functions[symbol].encoder_func;
-    void *retval = compiled->data + x86_encoder_function_get_address(func);
-
+static nullfuncptr to_function_pointer(void *address) {
     /* A just-in-time compiler has to cast an object pointer to a function pointer at some point,
      * right? */
 #ifdef __GNUC__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-pedantic"
 #endif
-    return (nullfuncptr)retval;
+    return (nullfuncptr)address;
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
 }
 
-jit_compiled_program *jit_compiled_program_create(const struct node *program) {
-    jit_compiled_program *compiled = allocate_compiled_program();
-
-    struct x86_function *code = generate_code_for_x86(program);
-
-    struct local_function local_functions[NUM_LOCAL_SYMBOLS];
-    struct extern_function extern_functions[NUM_EXTERN_SYMBOLS];
-    memset(local_functions, 0, sizeof(local_functions));
-    memset(extern_functions, 0, sizeof(extern_functions));
+static size_t get_local_function_offset(
+    local_symbol symbol,
+    const struct local_function *local_functions
+) {
+    return x86_encoder_function_get_address(local_functions[symbol].encoder_func);
+}
 
-    enumerate_references(local_functions, extern_functions, code);
+/* Lays out the code in executable memory. Returns false if memory cannot be
+ * allocated or protected. */
+static bool link_program(
+    jit_compiled_program *compiled,
+    struct x86_function *code,
+    struct local_function *local_functions
+) {
+    compiled->size = compute_local_function_sizes(local_functions, code);
 
-    compute_section_sizes(compiled, local_functions, extern_functions, code);
+    if(!allocate_memory(compiled, get_mapping_hint(compiled))) {
+        return false;
+    }
+    
+    if(!are_externs_in_reach(compiled, code)) {
+        /* The calls through a register are longer, so the layout has to be
+         * computed again. The mapping no longer needs to be anywhere near the
+         * C library. */
+        free_memory(compiled);
+        free_encoder_functions(code, local_functions);
+        make_calls_indirect(code);
+        compiled->size = compute_local_function_sizes(local_functions, code);
+        compiled->relocatable = false;
+        
+        if(!allocate_memory(compiled, NULL)) {
+            return false;
+        }
+    }
+    
+    compiled->relocations.capacity = count_extern_calls(code);
+    compiled->relocations.entries = allocate_relocations(compiled->relocations.capacity);
+    
+    if(compiled->relocations.entries == NULL) {
+        return false;
+    }
 
-    allocate_memory(compiled);
+    write_text_section(compiled, code, local_functions);
 
-    write_process_linkage_table(compiled, extern_functions);
+    if(!protect_and_make_executable(compiled)) {
+        return false;
+    }
+    
+    compiled->main_offset = get_local_function_offset(LOCAL_MAIN, local_functions);
+    compiled->main = (jit_main)to_function_pointer(compiled->data + compiled->main_offset);
+    
+    return true;
+}
 
-    write_text_section(compiled, code, local_functions, extern_functions);
+jit_compiled_program *jit_compiled_program_create(
+    const struct node *program,
+    const struct options *options
+) {
+    jit_compiled_program *compiled = allocate_compiled_program();
+    
+    if(compiled == NULL) {
+        return NULL;
+    }
+    
+    compiled->relocatable = true;
+    
+    /* The generated code runs on this machine, so unless told otherwise, use
+     * the best instructions the processor supports. */
+    struct options jit_options = *options;
+    
+    if(jit_options.march == MARCH_DEFAULT) {
+        jit_options.march = MARCH_NATIVE;
+    }
+    
+    /* The code is called from this process, which has the C library. */
+    jit_options.static_executable = false;
 
-    write_rodata_section(compiled, local_functions);
+    struct x86_arena *arena = x86_arena_create();
+    struct x86_arena *previous_arena = x86_arena_use(arena);
 
-    write_got_section(compiled, extern_functions);
+    struct x86_function *code = generate_reentrant_code_for_x86(program, &jit_options);
 
-    write_data_section(compiled);
+    struct local_function local_functions[NUM_LOCAL_SYMBOLS];
+    memset(local_functions, 0, sizeof(local_functions));
 
-    protect_and_make_executable(compiled);
-    
-    compiled->main = (jit_main)get_local_function_address(LOCAL_MAIN, compiled, local_functions);
+    bool linked = link_program(compiled, code, local_functions);
 
     cleanup_code(code, local_functions);
+    
+    x86_arena_use(previous_arena);
+    x86_arena_free(arena);
+    
+    if(!linked) {
+        jit_compiled_program_free(compiled);
+        return NULL;
+    }
 
     return compiled;
 }
 
 void jit_compiled_program_free(jit_compiled_program *compiled) {
+    free_memory(compiled);
+    free(compiled->relocations.entries);
     free(compiled);
 }
 
 jit_main jit_compiled_program_get_main(const jit_compiled_program *compiled) {
     return compiled->main;
 }
+
+bool jit_compiled_program_save(const jit_compiled_program *compiled, FILE *file) {
+    if(!compiled->relocatable) {
+        return false;
+    }
+    
+    struct image_header header;
+    memcpy(header.magic, image_magic, sizeof(header.magic));
+    header.text_size = compiled->size;
+    header.main_offset = compiled->main_offset;
+    header.num_relocations = compiled->relocations.count;
+    
+    if(fwrite(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    
+    /* The calls to the C library are saved with their displacements for
+     * this process. They are overwritten when the code is loaded. */
+    if(fwrite(compiled->data, 1, compiled->size, file) != compiled->size) {
+        return false;
+    }
+    
+    size_t count = compiled->relocations.count;
+    return fwrite(compiled->relocations.entries, sizeof(x86_encoder_relocation), count, file) == count;
+}
+
+/* Points the calls to the C library at its address in this process, as long
+ * as it is in reach of a 32-bit displacement. */
+static bool apply_relocations(jit_compiled_program *compiled) {
+    size_t text_size = compiled->size;
+    
+    for(size_t idx = 0; idx < compiled->relocations.count; ++idx) {
+        const x86_encoder_relocation *relocation = &compiled->relocations.entries[idx];
+        
+        if(relocation->symbol < 0 || relocation->symbol >= NUM_EXTERN_SYMBOLS) {
+            return false;
+        }
+        
+        if(!is_extern_function(relocation->symbol)) {
+            return false;
+        }
+        
+        if(text_size < sizeof(int32_t) || relocation->address > text_size - sizeof(int32_t)) {
+            return false;
+        }
+        
+        unsigned char *field = compiled->data + relocation->address;
+        uintptr_t next = (uintptr_t)field + sizeof(int32_t);
+        uintptr_t target = get_extern_value(relocation->symbol);
+        
+        if(!is_in_rel32_range(next, target)) {
+            return false;
+        }
+        
+        int32_t displacement = (int32_t)(intptr_t)(target - next);
+        memcpy(field, &displacement, sizeof(displacement));
+    }
+    
+    return true;
+}
+
+jit_compiled_program *jit_compiled_program_load(FILE *file) {
+    struct image_header header;
+    
+    if(fread(&header, sizeof(header), 1, file) != 1) {
+        return NULL;
+    }
+    
+    if(memcmp(header.magic, image_magic, sizeof(header.magic)) != 0) {
+        return NULL;
+    }
+    
+    if(header.main_offset >= header.text_size) {
+        return NULL;
+    }
+    
+    if(header.num_relocations > header.text_size / sizeof(int32_t)) {
+        return NULL;
+    }
+    
+    jit_compiled_program *compiled = allocate_compiled_program();
+    
+    if(compiled == NULL) {
+        return NULL;
+    }
+    
+    compiled->relocatable = true;
+    compiled->size = header.text_size;
+    
+    compiled->relocations.capacity = header.num_relocations;
+    compiled->relocations.count = header.num_relocations;
+    compiled->relocations.entries = allocate_relocations(header.num_relocations);
+    
+    size_t count = compiled->relocations.count;
+    
+    if(
+        compiled->relocations.entries == NULL ||
+        !allocate_memory(compiled, get_mapping_hint(compiled)) ||
+        fread(compiled->data, 1, compiled->size, file) != compiled->size ||
+        fread(compiled->relocations.entries, sizeof(x86_encoder_relocation), count, file) != count ||
+        !apply_relocations(compiled) ||
+        !protect_and_make_executable(compiled)
+    ) {
+        jit_compiled_program_free(compiled);
+        return NULL;
+    }
+    
+    compiled->main_offset = header.main_offset;
+    compiled->main = (jit_main)to_function_pointer(compiled->data + compiled->main_offset);
+    
+    return compiled;
+}
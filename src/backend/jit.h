@@ -31,16 +31,49 @@
 #ifndef BFC_BACKEND_JIT_H
 #define BFC_BACKEND_JIT_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "../app/options.h"
 #include "../ir/node.h"
+#include "x86/codegen.h"
 
-typedef void (*jit_main)(void);
+/* Number of bytes that must be allocated past the end of the tape passed to
+ * the main function of a compiled program. */
+#define JIT_TAPE_PADDING X86_TAPE_PADDING
+
+typedef x86_status jit_status;
+
+typedef struct x86_io_context jit_io_context;
+
+/* Runs the program on a zero-filled tape of tape_size cells followed by
+ * JIT_TAPE_PADDING bytes, with the streams of the context for input and
+ * output. Errors are returned rather than reported. The compiled code has no
+ * state of its own, so several threads can call it at once as long as each
+ * has its own tape and context. */
+typedef jit_status (*jit_main)(unsigned char *tape, size_t tape_size, jit_io_context *context);
 
 typedef struct jit_compiled_program jit_compiled_program;
 
-jit_compiled_program *jit_compiled_program_create(const struct node *program);
+/* Returns NULL if the memory for the code cannot be allocated or made
+ * executable. */
+jit_compiled_program *jit_compiled_program_create(
+    const struct node *program,
+    const struct options *options
+);
 
 void jit_compiled_program_free(jit_compiled_program *context);
 
 jit_main jit_compiled_program_get_main(const jit_compiled_program *context);
 
+/* Writes the code of a compiled program to a file, with the position of its
+ * calls to the C library so it can be loaded by another process. Returns
+ * false if the code cannot be moved or on write error. */
+bool jit_compiled_program_save(const jit_compiled_program *context, FILE *file);
+
+/* Loads code written by jit_compiled_program_save(). Returns NULL if the
+ * file is truncated or invalid, if the C library is out of reach of the
+ * calls from where the code ends up, or if memory cannot be allocated. */
+jit_compiled_program *jit_compiled_program_load(FILE *file);
+
 #endif
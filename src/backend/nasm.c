@@ -34,11 +34,12 @@
 #include "../ir/query.h"
 #include "nasm.h"
 #include "common/symbols.h"
+#include "x86/arena.h"
 #include "x86/codegen.h"
 #include "x86/isa.h"
 
 #define INDENT "    "
-#define OPERAND_BUFFER_SIZE 32
+#define OPERAND_BUFFER_SIZE 48
 
 struct state {
     FILE *f;
@@ -62,6 +63,10 @@ static size_t format_operand_imm32(char *buf, size_t bufsize, const struct x86_o
     return snprintf(buf, bufsize, "%d", (int)operand->n);
 }
 
+static size_t format_operand_imm64(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return snprintf(buf, bufsize, "0x%016" PRIx64, operand->address);
+}
+
 static size_t format_operand_label(char *buf, size_t bufsize, const struct x86_operand *operand) {
     return snprintf(buf, bufsize, ".l%08d", (int)operand->n);
 }
@@ -70,8 +75,31 @@ static size_t format_operand_local(char *buf, size_t bufsize, const struct x86_o
     return snprintf(buf, bufsize, "%s", local_symbol_names[operand->n]);
 }
 
+static size_t format_address(char *buf, size_t bufsize, const char *size, const struct x86_operand *operand) {
+    if(operand->r2 == X86_NO_INDEX) {
+        return snprintf(buf, bufsize, "%s[%s + %d]", size, x86_reg64_names[operand->r1], (int)operand->n);
+    }
+    return snprintf(buf, bufsize, "%s[%s + %s + %d]", size, x86_reg64_names[operand->r1], x86_reg64_names[operand->r2], (int)operand->n);
+}
+
 static size_t format_operand_mem8_reg(char *buf, size_t bufsize, const struct x86_operand *operand) {
-    return snprintf(buf, bufsize, "byte [%s + %s + %d]", x86_reg64_names[operand->r1], x86_reg64_names[operand->r2], (int)operand->n);
+    return format_address(buf, bufsize, "byte ", operand);
+}
+
+static size_t format_operand_mem128_label(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return snprintf(buf, bufsize, "oword [.l%08d]", (int)operand->n);
+}
+
+static size_t format_operand_mem128_reg(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return format_address(buf, bufsize, "oword ", operand);
+}
+
+static size_t format_operand_mem256_label(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return snprintf(buf, bufsize, "yword [.l%08d]", (int)operand->n);
+}
+
+static size_t format_operand_mem256_reg(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return format_address(buf, bufsize, "yword ", operand);
 }
 
 static size_t format_operand_mem64_extern(char *buf, size_t bufsize, const struct x86_operand *operand) {
@@ -82,6 +110,10 @@ static size_t format_operand_mem64_local(char *buf, size_t bufsize, const struct
     return snprintf(buf, bufsize, "qword [%s]", local_symbol_names[operand->n]);
 }
 
+static size_t format_operand_mem64_reg(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return format_address(buf, bufsize, "qword ", operand);
+}
+
 static size_t format_operand_mem64_rel(char *buf, size_t bufsize, const struct x86_operand *operand) {
     return snprintf(buf, bufsize, "qword [REL %" PRIu64 "]", operand->address);
 }
@@ -98,6 +130,14 @@ static size_t format_operand_reg64(char *buf, size_t bufsize, const struct x86_o
     return snprintf(buf, bufsize, "%s", x86_reg64_names[operand->r1]);
 }
 
+static size_t format_operand_xmm(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return snprintf(buf, bufsize, "%s", x86_xmm_names[operand->r1]);
+}
+
+static size_t format_operand_ymm(char *buf, size_t bufsize, const struct x86_operand *operand) {
+    return snprintf(buf, bufsize, "%s", x86_ymm_names[operand->r1]);
+}
+
 static void format_operand(char *buf, size_t bufsize, const struct x86_operand *operand) {
     size_t retsize = 0;
     
@@ -111,6 +151,9 @@ static void format_operand(char *buf, size_t bufsize, const struct x86_operand *
     case X86_OPERAND_IMM32:
         retsize = format_operand_imm32(buf, bufsize, operand);
         break;
+    case X86_OPERAND_IMM64:
+        retsize = format_operand_imm64(buf, bufsize, operand);
+        break;
     case X86_OPERAND_LABEL:
         retsize = format_operand_label(buf, bufsize, operand);
         break;
@@ -120,12 +163,27 @@ static void format_operand(char *buf, size_t bufsize, const struct x86_operand *
     case X86_OPERAND_MEM8_REG:
         retsize = format_operand_mem8_reg(buf, bufsize, operand);
         break;
+    case X86_OPERAND_MEM128_LABEL:
+        retsize = format_operand_mem128_label(buf, bufsize, operand);
+        break;
+    case X86_OPERAND_MEM128_REG:
+        retsize = format_operand_mem128_reg(buf, bufsize, operand);
+        break;
+    case X86_OPERAND_MEM256_LABEL:
+        retsize = format_operand_mem256_label(buf, bufsize, operand);
+        break;
+    case X86_OPERAND_MEM256_REG:
+        retsize = format_operand_mem256_reg(buf, bufsize, operand);
+        break;
     case X86_OPERAND_MEM64_EXTERN:
         retsize = format_operand_mem64_extern(buf, bufsize, operand);
         break;
     case X86_OPERAND_MEM64_LOCAL:
         retsize = format_operand_mem64_local(buf, bufsize, operand);
         break;
+    case X86_OPERAND_MEM64_REG:
+        retsize = format_operand_mem64_reg(buf, bufsize, operand);
+        break;
     case X86_OPERAND_MEM64_REL:
         retsize = format_operand_mem64_rel(buf, bufsize, operand);
         break;
@@ -138,6 +196,12 @@ static void format_operand(char *buf, size_t bufsize, const struct x86_operand *
     case X86_OPERAND_REG64:
         retsize = format_operand_reg64(buf, bufsize, operand);
         break;
+    case X86_OPERAND_XMM:
+        retsize = format_operand_xmm(buf, bufsize, operand);
+        break;
+    case X86_OPERAND_YMM:
+        retsize = format_operand_ymm(buf, bufsize, operand);
+        break;
     }
     
     if(retsize >= bufsize) {
@@ -147,7 +211,7 @@ static void format_operand(char *buf, size_t bufsize, const struct x86_operand *
 }
 
 static void emit_instr_align(struct state *state, const struct x86_instr *instr) {
-    fprintf(state->f, INDENT "align %d, nop\n", instr->n);
+    fprintf(state->f, INDENT "align %d\n", instr->n);
 }
 
 static void emit_instr_add(struct state *state, const struct x86_instr *instr) {
@@ -185,11 +249,29 @@ static void emit_instr_cmp(struct state *state, const struct x86_instr *instr) {
     fprintf(state->f, INDENT "cmp %s, %s\n", dst, src);
 }
 
-static void emit_instr_jl(struct state *state, const struct x86_instr *instr) {
+static void emit_instr_dq(struct state *state, const struct x86_instr *instr) {
     char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
     format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
     
-    fprintf(state->f, INDENT "jl %s\n", dst);
+    fprintf(state->f, INDENT "dq %s, %s\n", dst, src);
+}
+
+static void emit_instr_imul(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "imul %s, %s\n", dst, src);
+}
+
+static void emit_instr_jge(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    
+    fprintf(state->f, INDENT "jge %s\n", dst);
     fprintf(state->f, "\n");
 }
 
@@ -201,19 +283,19 @@ static void emit_instr_jmp(struct state *state, const struct x86_instr *instr) {
     fprintf(state->f, "\n");
 }
 
-static void emit_instr_jns(struct state *state, const struct x86_instr *instr) {
+static void emit_instr_jnz(struct state *state, const struct x86_instr *instr) {
     char dst[OPERAND_BUFFER_SIZE];
     format_operand(dst, sizeof(dst), instr->dst);
     
-    fprintf(state->f, INDENT "jns %s\n", dst);
+    fprintf(state->f, INDENT "jnz %s\n", dst);
     fprintf(state->f, "\n");
 }
 
-static void emit_instr_jnz(struct state *state, const struct x86_instr *instr) {
+static void emit_instr_js(struct state *state, const struct x86_instr *instr) {
     char dst[OPERAND_BUFFER_SIZE];
     format_operand(dst, sizeof(dst), instr->dst);
     
-    fprintf(state->f, INDENT "jnz %s\n", dst);
+    fprintf(state->f, INDENT "js %s\n", dst);
     fprintf(state->f, "\n");
 }
 
@@ -232,6 +314,15 @@ static void emit_instr_label(struct state *state, const struct x86_instr *instr)
     fprintf(state->f, "%s:\n", dst);
 }
 
+static void emit_instr_lea(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_address(src, sizeof(src), "", instr->src);
+    
+    fprintf(state->f, INDENT "lea %s, %s\n", dst, src);
+}
+
 static void emit_instr_mov(struct state *state, const struct x86_instr *instr) {
     char dst[OPERAND_BUFFER_SIZE];
     char src[OPERAND_BUFFER_SIZE];
@@ -241,6 +332,24 @@ static void emit_instr_mov(struct state *state, const struct x86_instr *instr) {
     fprintf(state->f, INDENT "mov %s, %s\n", dst, src);
 }
 
+static void emit_instr_movdqu(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "movdqu %s, %s\n", dst, src);
+}
+
+static void emit_instr_movq(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "movq %s, %s\n", dst, src);
+}
+
 static void emit_instr_movzx(struct state *state, const struct x86_instr *instr) {
     char dst[OPERAND_BUFFER_SIZE];
     char src[OPERAND_BUFFER_SIZE];
@@ -259,6 +368,24 @@ static void emit_instr_or(struct state *state, const struct x86_instr *instr) {
     fprintf(state->f, INDENT "or %s, %s\n", dst, src);
 }
 
+static void emit_instr_paddb(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "paddb %s, %s\n", dst, src);
+}
+
+static void emit_instr_pand(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "pand %s, %s\n", dst, src);
+}
+
 static void emit_instr_pop(struct state *state, const struct x86_instr *instr) {
     char dst[OPERAND_BUFFER_SIZE];
     format_operand(dst, sizeof(dst), instr->dst);
@@ -266,6 +393,15 @@ static void emit_instr_pop(struct state *state, const struct x86_instr *instr) {
     fprintf(state->f, INDENT "pop %s\n", dst);
 }
 
+static void emit_instr_punpcklqdq(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "punpcklqdq %s, %s\n", dst, src);
+}
+
 static void emit_instr_push(struct state *state, const struct x86_instr *instr) {
     char src[OPERAND_BUFFER_SIZE];
     format_operand(src, sizeof(src), instr->src);
@@ -284,6 +420,68 @@ static void emit_instr_segfault(struct state *state, const struct x86_instr *ins
     fprintf(state->f, "\n");
 }
 
+static void emit_instr_sub(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "sub %s, %s\n", dst, src);
+}
+
+static void emit_instr_syscall(struct state *state, const struct x86_instr *instr) {
+    fprintf(state->f, INDENT "syscall\n");
+}
+
+static void emit_instr_vmovdqu(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "vmovdqu %s, %s\n", dst, src);
+}
+
+static void emit_instr_vmovq(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "vmovq %s, %s\n", dst, src);
+}
+
+static void emit_instr_vpaddb(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "vpaddb %s, %s, %s\n", dst, dst, src);
+}
+
+static void emit_instr_vpand(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "vpand %s, %s, %s\n", dst, dst, src);
+}
+
+static void emit_instr_vpbroadcastb(struct state *state, const struct x86_instr *instr) {
+    char dst[OPERAND_BUFFER_SIZE];
+    char src[OPERAND_BUFFER_SIZE];
+    format_operand(dst, sizeof(dst), instr->dst);
+    format_operand(src, sizeof(src), instr->src);
+    
+    fprintf(state->f, INDENT "vpbroadcastb %s, %s\n", dst, src);
+}
+
+static void emit_instr_vzeroupper(struct state *state, const struct x86_instr *instr) {
+    fprintf(state->f, INDENT "vzeroupper\n");
+}
+
 static void emit_code(struct state *state, const struct x86_instr *instr) {
     while(instr != NULL) {
         switch(instr->op) {
@@ -302,36 +500,60 @@ static void emit_code(struct state *state, const struct x86_instr *instr) {
         case X86_INSTR_CMP:
             emit_instr_cmp(state, instr);
             break;
-        case X86_INSTR_JL:
-            emit_instr_jl(state, instr);
+        case X86_INSTR_DQ:
+            emit_instr_dq(state, instr);
+            break;
+        case X86_INSTR_IMUL:
+            emit_instr_imul(state, instr);
+            break;
+        case X86_INSTR_JGE:
+            emit_instr_jge(state, instr);
             break;
         case X86_INSTR_JMP:
             emit_instr_jmp(state, instr);
             break;
-        case X86_INSTR_JNS:
-            emit_instr_jns(state, instr);
-            break;
         case X86_INSTR_JNZ:
             emit_instr_jnz(state, instr);
             break;
+        case X86_INSTR_JS:
+            emit_instr_js(state, instr);
+            break;
         case X86_INSTR_JZ:
             emit_instr_jz(state, instr);
             break;
         case X86_INSTR_LABEL:
             emit_instr_label(state, instr);
             break;
+        case X86_INSTR_LEA:
+            emit_instr_lea(state, instr);
+            break;
         case X86_INSTR_MOV:
             emit_instr_mov(state, instr);
             break;
+        case X86_INSTR_MOVDQU:
+            emit_instr_movdqu(state, instr);
+            break;
+        case X86_INSTR_MOVQ:
+            emit_instr_movq(state, instr);
+            break;
         case X86_INSTR_MOVZX:
             emit_instr_movzx(state, instr);
             break;
         case X86_INSTR_OR:
             emit_instr_or(state, instr);
             break;
+        case X86_INSTR_PADDB:
+            emit_instr_paddb(state, instr);
+            break;
+        case X86_INSTR_PAND:
+            emit_instr_pand(state, instr);
+            break;
         case X86_INSTR_POP:
             emit_instr_pop(state, instr);
             break;
+        case X86_INSTR_PUNPCKLQDQ:
+            emit_instr_punpcklqdq(state, instr);
+            break;
         case X86_INSTR_PUSH:
             emit_instr_push(state, instr);
             break;
@@ -340,6 +562,30 @@ static void emit_code(struct state *state, const struct x86_instr *instr) {
             break;
         case X86_INSTR_SEGFAULT:
             emit_instr_segfault(state, instr);
+            break;
+        case X86_INSTR_SUB:
+            emit_instr_sub(state, instr);
+            break;
+        case X86_INSTR_SYSCALL:
+            emit_instr_syscall(state, instr);
+            break;
+        case X86_INSTR_VMOVDQU:
+            emit_instr_vmovdqu(state, instr);
+            break;
+        case X86_INSTR_VMOVQ:
+            emit_instr_vmovq(state, instr);
+            break;
+        case X86_INSTR_VPADDB:
+            emit_instr_vpaddb(state, instr);
+            break;
+        case X86_INSTR_VPAND:
+            emit_instr_vpand(state, instr);
+            break;
+        case X86_INSTR_VPBROADCASTB:
+            emit_instr_vpbroadcastb(state, instr);
+            break;
+        case X86_INSTR_VZEROUPPER:
+            emit_instr_vzeroupper(state, instr);
         }
         
         instr = instr->next;
@@ -350,6 +596,11 @@ static void emit_header(struct state *state, const struct node *root) {
     fprintf(state->f, "; generated by bfc (https://github.com/phaubertin)\n");
     fprintf(state->f, "\n");
     
+    /* pad with long NOPs rather than with single byte ones */
+    fprintf(state->f, "%%use smartalign\n");
+    fprintf(state->f, INDENT "alignmode p6\n");
+    fprintf(state->f, "\n");
+    
     for(int idx = 0; idx < NUM_EXTERN_SYMBOLS; ++idx) {
         fprintf(state->f, INDENT "extern %s\n", extern_symbol_names[idx]);
     }
@@ -372,11 +623,14 @@ static void emit_local_decl(struct state *state, local_symbol symbol) {
     fprintf(state->f, "%s:\n", local_symbol_names[symbol]);
 }
 
-static void emit_text(struct state *state, const struct node *root) {
+static void emit_text(struct state *state, const struct node *root, const struct options *options) {
     fprintf(state->f, INDENT "section .text\n");
     fprintf(state->f, "\n");
 
-    struct x86_function *func = generate_code_for_x86(root);
+    struct x86_arena *arena = x86_arena_create();
+    struct x86_arena *previous_arena = x86_arena_use(arena);
+    
+    struct x86_function *func = generate_code_for_x86(root, options);
 
     while(func != NULL) {
         bool is_global = func->symbol == LOCAL_START || func->symbol == LOCAL_MAIN;
@@ -398,6 +652,9 @@ static void emit_text(struct state *state, const struct node *root) {
 
         func = next;
     }
+    
+    x86_arena_use(previous_arena);
+    x86_arena_free(arena);
 }
 
 static void emit_rodata(struct state *state, const struct node *root) {
@@ -433,15 +690,15 @@ static void emit_bss(struct state *state) {
     fprintf(state->f, INDENT "section .bss\n");
     fprintf(state->f, "\n");
     fprintf(state->f, "marray:\n");
-    fprintf(state->f, INDENT "resb 30000\n");
+    fprintf(state->f, INDENT "resb %d\n", 30000 + X86_TAPE_PADDING);
 }
 
-void nasm_generate(FILE *f, const struct node *root) {
+void nasm_generate(FILE *f, const struct node *root, const struct options *options) {
     struct state state;
     initialize_state(&state, f);
     
     emit_header(&state, root);
-    emit_text(&state, root);
+    emit_text(&state, root, options);
     emit_rodata(&state, root);
     emit_data(&state);
     emit_bss(&state);
@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Stencil generator, run at build time. Assembles the machine code of each
+ * stencil with the x86 instruction encoder and writes it out as C source
+ * (stencils.c) for the baseline JIT.
+ *
+ * The holes are found by assembling each stencil once with a base value for
+ * every hole and then once more per kind of hole with a different value for
+ * that kind: the bytes that change are the hole. The values are large enough
+ * that the encoder always picks the forms with 32-bit displacements and
+ * immediates, which can then hold any value the JIT patches in. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../x86/arena.h"
+#include "../x86/builder.h"
+#include "../x86/encoder.h"
+#include "../x86/isa.h"
+#include "stencil.h"
+
+/* Same registers as the x86 code generator with an absolute data pointer. */
+#define REGM        X86_REG_RBX
+#define REGP        X86_REG_R13
+#define REGEND      X86_REG_RBP
+#define REG8TEMP    X86_REG_AL
+#define REG64TEMP   X86_REG_RAX
+#define REG32ARG1   X86_REG_EDI
+
+/* Jump targets are given to the encoder as the address of this symbol, which
+ * is the only way to get a 32-bit displacement whatever the distance. */
+#define TARGET_SYMBOL LOCAL_MAIN
+
+#define MAX_STENCIL_SIZE 64
+
+static const int hole_sizes[NUM_HOLE_KINDS] = {
+    [HOLE_OFFSET]           = 4,
+    [HOLE_SOURCE_OFFSET]    = 4,
+    [HOLE_VALUE8]           = 1,
+    [HOLE_VALUE32]          = 4,
+    [HOLE_TARGET]           = 4,
+    [HOLE_ADDRESS]          = 8
+};
+
+static const uint64_t base_values[NUM_HOLE_KINDS] = {
+    [HOLE_OFFSET]           = 0x11111111,
+    [HOLE_SOURCE_OFFSET]    = 0x11111111,
+    [HOLE_VALUE8]           = 0x11,
+    [HOLE_VALUE32]          = 0x11111111,
+    [HOLE_TARGET]           = 0x11111111,
+    [HOLE_ADDRESS]          = 0x1111111111111111
+};
+
+static const uint64_t changed_values[NUM_HOLE_KINDS] = {
+    [HOLE_OFFSET]           = 0x22222222,
+    [HOLE_SOURCE_OFFSET]    = 0x22222222,
+    [HOLE_VALUE8]           = 0x22,
+    [HOLE_VALUE32]          = 0x22222222,
+    [HOLE_TARGET]           = 0x22222222,
+    [HOLE_ADDRESS]          = 0x2222222222222222
+};
+
+static struct x86_operand *cell_memory(const uint64_t *values, hole_kind kind) {
+    return x86_operand_new_mem8_base(REGP, (int)values[kind]);
+}
+
+static struct x86_instr *generate_prologue(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    /* Three pushes after the return address: the stack is aligned on 16
+     * bytes for the calls made by the other stencils. */
+    x86_builder_append_instr(&builder, x86_instr_new_push(
+        x86_operand_new_reg64(REGEND)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_push(
+        x86_operand_new_reg64(REGP)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_push(
+        x86_operand_new_reg64(REGM)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(REGM),
+        x86_operand_new_imm64(values[HOLE_ADDRESS])
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(REGP),
+        x86_operand_new_reg64(REGM)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_lea(
+        x86_operand_new_reg64(REGEND),
+        x86_operand_new_mem8_base(REGM, STENCIL_MEMORY_SIZE)
+    ));
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_epilogue(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_pop(
+        x86_operand_new_reg64(REGM)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_pop(
+        x86_operand_new_reg64(REGP)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_pop(
+        x86_operand_new_reg64(REGEND)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_add(const uint64_t *values) {
+    return x86_instr_new_add(
+        cell_memory(values, HOLE_OFFSET),
+        x86_operand_new_imm8((int)values[HOLE_VALUE8])
+    );
+}
+
+static struct x86_instr *generate_add2(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg8(REG8TEMP),
+        cell_memory(values, HOLE_SOURCE_OFFSET)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_add(
+        cell_memory(values, HOLE_OFFSET),
+        x86_operand_new_reg8(REG8TEMP)
+    ));
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_set(const uint64_t *values) {
+    return x86_instr_new_mov(
+        cell_memory(values, HOLE_OFFSET),
+        x86_operand_new_imm8((int)values[HOLE_VALUE8])
+    );
+}
+
+static struct x86_instr *generate_right(const uint64_t *values) {
+    return x86_instr_new_add(
+        x86_operand_new_reg64(REGP),
+        x86_operand_new_imm32((int)values[HOLE_VALUE32])
+    );
+}
+
+/* The functions called by the stencils are at arbitrary addresses, so they
+ * are called through a register. */
+static void append_call(struct x86_builder *builder, const uint64_t *values) {
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg64(REG64TEMP),
+        x86_operand_new_imm64(values[HOLE_ADDRESS])
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_call(
+        x86_operand_new_reg64(REG64TEMP)
+    ));
+}
+
+static struct x86_instr *generate_in(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    append_call(&builder, values);
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        cell_memory(values, HOLE_OFFSET),
+        x86_operand_new_reg8(REG8TEMP)
+    ));
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_out(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_movzx(
+        x86_operand_new_reg32(REG32ARG1),
+        cell_memory(values, HOLE_OFFSET)
+    ));
+    append_call(&builder, values);
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_loop_test(
+    const uint64_t *values,
+    struct x86_instr *(*new_jump)(struct x86_operand *target)
+) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        cell_memory(values, HOLE_OFFSET),
+        x86_operand_new_imm8(0)
+    ));
+    x86_builder_append_instr(&builder, new_jump(
+        x86_operand_new_local(TARGET_SYMBOL)
+    ));
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_loop_start(const uint64_t *values) {
+    return generate_loop_test(values, x86_instr_new_jz);
+}
+
+static struct x86_instr *generate_loop_end(const uint64_t *values) {
+    return generate_loop_test(values, x86_instr_new_jnz);
+}
+
+static struct x86_instr *generate_check_right(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_lea(
+        x86_operand_new_reg64(REG64TEMP),
+        cell_memory(values, HOLE_OFFSET)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        x86_operand_new_reg64(REG64TEMP),
+        x86_operand_new_reg64(REGEND)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jge(
+        x86_operand_new_local(TARGET_SYMBOL)
+    ));
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_check_left(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_lea(
+        x86_operand_new_reg64(REG64TEMP),
+        cell_memory(values, HOLE_OFFSET)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        x86_operand_new_reg64(REG64TEMP),
+        x86_operand_new_reg64(REGM)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_js(
+        x86_operand_new_local(TARGET_SYMBOL)
+    ));
+    
+    return x86_builder_get_first(&builder);
+}
+
+static struct x86_instr *generate_fail(const uint64_t *values) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    append_call(&builder, values);
+    
+    return x86_builder_get_first(&builder);
+}
+
+static const struct {
+    const char *name;
+    struct x86_instr *(*generate)(const uint64_t *values);
+} definitions[NUM_STENCILS] = {
+    [STENCIL_PROLOGUE]      = {"prologue", generate_prologue},
+    [STENCIL_EPILOGUE]      = {"epilogue", generate_epilogue},
+    [STENCIL_ADD]           = {"add", generate_add},
+    [STENCIL_ADD2]          = {"add2", generate_add2},
+    [STENCIL_SET]           = {"set", generate_set},
+    [STENCIL_RIGHT]         = {"right", generate_right},
+    [STENCIL_IN]            = {"in", generate_in},
+    [STENCIL_OUT]           = {"out", generate_out},
+    [STENCIL_LOOP_START]    = {"loop_start", generate_loop_start},
+    [STENCIL_LOOP_END]      = {"loop_end", generate_loop_end},
+    [STENCIL_CHECK_RIGHT]   = {"check_right", generate_check_right},
+    [STENCIL_CHECK_LEFT]    = {"check_left", generate_check_left},
+    [STENCIL_FAIL]          = {"fail", generate_fail}
+};
+
+static size_t assemble(unsigned char *buf, stencil_id id, const uint64_t *values) {
+    struct x86_arena *arena = x86_arena_create();
+    struct x86_arena *previous = x86_arena_use(arena);
+    
+    struct x86_instr *instrs = definitions[id].generate(values);
+    x86_encoder_function *func = x86_encoder_function_create(instrs, 0);
+    size_t size = x86_encoder_compute_function_size(func);
+    
+    if(size > MAX_STENCIL_SIZE) {
+        fprintf(stderr, "Error: stencil %s is too large\n", definitions[id].name);
+        exit(EXIT_FAILURE);
+    }
+    
+    x86_encoder_context context;
+    memset(&context, 0, sizeof(context));
+    x86_encoder_context_set_local(&context, TARGET_SYMBOL, values[HOLE_TARGET]);
+    
+    encode_for_x86(buf, size, func, &context);
+    
+    x86_encoder_function_free(func);
+    x86_arena_use(previous);
+    x86_arena_free(arena);
+    
+    return size;
+}
+
+static uint64_t read_value(const unsigned char *buf, int size) {
+    uint64_t value = 0;
+    
+    for(int idx = size - 1; idx >= 0; --idx) {
+        value = (value << 8) | buf[idx];
+    }
+    
+    return value;
+}
+
+/* Returns the offset of the bytes that differ between the two encodings, -1
+ * if none, after checking that they hold the base value of that kind of
+ * hole. */
+static int find_hole(
+    const unsigned char *base,
+    const unsigned char *changed,
+    size_t size,
+    stencil_id id,
+    hole_kind kind
+) {
+    int first = -1;
+    int last = -1;
+    
+    for(size_t idx = 0; idx < size; ++idx) {
+        if(base[idx] != changed[idx]) {
+            if(first < 0) {
+                first = idx;
+            }
+            last = idx;
+        }
+    }
+    
+    if(first < 0) {
+        return -1;
+    }
+    
+    int hole_size = hole_sizes[kind];
+    uint64_t expected = base_values[kind];
+    
+    if(kind == HOLE_TARGET) {
+        /* the stencil is assembled at address zero */
+        expected -= first + hole_size;
+    }
+    
+    uint64_t mask = hole_size < 8 ? ((uint64_t)1 << (8 * hole_size)) - 1 : ~(uint64_t)0;
+    
+    if(last - first + 1 != hole_size || read_value(&base[first], hole_size) != (expected & mask)) {
+        fprintf(stderr, "Error: unexpected encoding of hole %d in stencil %s\n", kind, definitions[id].name);
+        exit(EXIT_FAILURE);
+    }
+    
+    return first;
+}
+
+static void print_stencil_code(stencil_id id, const unsigned char *code, size_t size) {
+    printf("static const unsigned char code_%s[] = {", definitions[id].name);
+    
+    for(size_t idx = 0; idx < size; ++idx) {
+        printf("%s0x%02x", idx % 12 == 0 ? "\n    " : " ", code[idx]);
+        
+        if(idx + 1 < size) {
+            printf(",");
+        }
+    }
+    
+    printf("\n};\n\n");
+}
+
+int main(void) {
+    unsigned char base[NUM_STENCILS][MAX_STENCIL_SIZE];
+    size_t sizes[NUM_STENCILS];
+    int holes[NUM_STENCILS][NUM_HOLE_KINDS];
+    
+    for(int id = 0; id < NUM_STENCILS; ++id) {
+        sizes[id] = assemble(base[id], id, base_values);
+        
+        for(int kind = 0; kind < NUM_HOLE_KINDS; ++kind) {
+            uint64_t values[NUM_HOLE_KINDS];
+            memcpy(values, base_values, sizeof(values));
+            values[kind] = changed_values[kind];
+            
+            unsigned char changed[MAX_STENCIL_SIZE];
+            
+            if(assemble(changed, id, values) != sizes[id]) {
+                fprintf(stderr, "Error: size of stencil %s depends on hole %d\n", definitions[id].name, kind);
+                exit(EXIT_FAILURE);
+            }
+            
+            holes[id][kind] = find_hole(base[id], changed, sizes[id], id, kind);
+        }
+    }
+    
+    printf("/* Generated by the stencil generator (backend/stencil/generator.c), do not edit. */\n\n");
+    printf("#include \"stencil.h\"\n\n");
+    
+    for(int id = 0; id < NUM_STENCILS; ++id) {
+        print_stencil_code(id, base[id], sizes[id]);
+    }
+    
+    printf("const struct stencil stencils[NUM_STENCILS] = {\n");
+    
+    for(int id = 0; id < NUM_STENCILS; ++id) {
+        printf("    {code_%s, %zu, {", definitions[id].name, sizes[id]);
+        
+        for(int kind = 0; kind < NUM_HOLE_KINDS; ++kind) {
+            printf("%s%d", kind == 0 ? "" : ", ", holes[id][kind]);
+        }
+        
+        printf("}}%s\n", id + 1 < NUM_STENCILS ? "," : "");
+    }
+    
+    printf("};\n\n");
+    printf("const int stencil_hole_sizes[NUM_HOLE_KINDS] = {");
+    
+    for(int kind = 0; kind < NUM_HOLE_KINDS; ++kind) {
+        printf("%s%d", kind == 0 ? "" : ", ", hole_sizes[kind]);
+    }
+    
+    printf("};\n");
+    
+    return EXIT_SUCCESS;
+}
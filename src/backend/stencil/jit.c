@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE /* For MAP_ANONYMOUS */
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "stencil.h"
+
+struct stencil_compiled_program {
+    stencil_main main;
+    unsigned char *code;
+    size_t size;
+    unsigned char *memory;
+};
+
+/* functions called from the generated code */
+
+static void fail_too_far_right(void) {
+    fprintf(stderr, "Error: memory position out of bounds (overflow - too far right)\n");
+    exit(EXIT_FAILURE);
+}
+
+static void fail_too_far_left(void) {
+    fprintf(stderr, "Error: memory position out of bounds (underflow - too far left)\n");
+    exit(EXIT_FAILURE);
+}
+
+static int read_input(void) {
+    int inp = fgetc(stdin);
+    
+    if(inp == EOF) {
+        if(ferror(stdin)) {
+            fprintf(stderr, "Error when reading input: %s\n", strerror(errno));
+        } else {
+            fprintf(stderr, "Error: reached end of input\n");
+        }
+        exit(EXIT_FAILURE);
+    }
+    
+    return inp;
+}
+
+static void write_output(int c) {
+    putc(c, stdout);
+}
+
+struct state {
+    unsigned char *code;
+    size_t length;
+    /* out-of-line calls to the failure functions, shared by all checks */
+    const unsigned char *fail_right;
+    const unsigned char *fail_left;
+};
+
+static stencil_id get_node_stencil(const struct node *node) {
+    switch(node->type) {
+    case NODE_ADD:
+        return STENCIL_ADD;
+    case NODE_ADD2:
+        return STENCIL_ADD2;
+    case NODE_SET:
+        return STENCIL_SET;
+    case NODE_RIGHT:
+        return STENCIL_RIGHT;
+    case NODE_IN:
+        return STENCIL_IN;
+    case NODE_OUT:
+        return STENCIL_OUT;
+    case NODE_LOOP:
+    case NODE_STATIC_LOOP:
+        return STENCIL_LOOP_START;
+    case NODE_CHECK_RIGHT:
+        return STENCIL_CHECK_RIGHT;
+    case NODE_CHECK_LEFT:
+        return STENCIL_CHECK_LEFT;
+    }
+    
+    fprintf(stderr, "Error: unknown node type (baseline JIT)\n");
+    exit(EXIT_FAILURE);
+}
+
+static size_t compute_code_size(const struct node *node) {
+    size_t size = 0;
+    
+    for(; node != NULL; node = node->next) {
+        size += stencils[get_node_stencil(node)].size;
+        
+        if(node->body != NULL) {
+            size += compute_code_size(node->body);
+            size += stencils[STENCIL_LOOP_END].size;
+        }
+    }
+    
+    return size;
+}
+
+/* Copies the stencil at the end of the code and returns the address of the
+ * copy, for patching its holes. */
+static unsigned char *copy_stencil(struct state *state, stencil_id id) {
+    unsigned char *code = &state->code[state->length];
+    
+    memcpy(code, stencils[id].code, stencils[id].size);
+    state->length += stencils[id].size;
+    
+    return code;
+}
+
+static void patch_hole(unsigned char *code, stencil_id id, hole_kind kind, uint64_t value) {
+    unsigned char *hole = &code[stencils[id].holes[kind]];
+    
+    /* little endian, truncated to the size of the hole */
+    for(int idx = 0; idx < stencil_hole_sizes[kind]; ++idx) {
+        hole[idx] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+static void patch_target(unsigned char *code, stencil_id id, const unsigned char *target) {
+    const unsigned char *hole_end = &code[stencils[id].holes[HOLE_TARGET] + stencil_hole_sizes[HOLE_TARGET]];
+    
+    patch_hole(code, id, HOLE_TARGET, target - hole_end);
+}
+
+static void emit_body(struct state *state, const struct node *node) {
+    for(; node != NULL; node = node->next) {
+        stencil_id id = get_node_stencil(node);
+        unsigned char *code = copy_stencil(state, id);
+        unsigned char *end;
+        
+        switch(node->type) {
+        case NODE_ADD:
+        case NODE_SET:
+            patch_hole(code, id, HOLE_OFFSET, node->offset);
+            patch_hole(code, id, HOLE_VALUE8, node->n);
+            break;
+        case NODE_ADD2:
+            patch_hole(code, id, HOLE_OFFSET, node->offset);
+            patch_hole(code, id, HOLE_SOURCE_OFFSET, node->n);
+            break;
+        case NODE_RIGHT:
+            patch_hole(code, id, HOLE_VALUE32, node->n);
+            break;
+        case NODE_IN:
+            patch_hole(code, id, HOLE_OFFSET, node->offset);
+            patch_hole(code, id, HOLE_ADDRESS, (uintptr_t)read_input);
+            break;
+        case NODE_OUT:
+            patch_hole(code, id, HOLE_OFFSET, node->offset);
+            patch_hole(code, id, HOLE_ADDRESS, (uintptr_t)write_output);
+            break;
+        case NODE_LOOP:
+        case NODE_STATIC_LOOP:
+            /* The jump at the start of the loop is patched once the end is
+             * known, which is the only value that is not known when the
+             * stencil is copied. */
+            patch_hole(code, id, HOLE_OFFSET, node->offset);
+            emit_body(state, node->body);
+            end = copy_stencil(state, STENCIL_LOOP_END);
+            patch_hole(end, STENCIL_LOOP_END, HOLE_OFFSET, node->offset);
+            patch_target(end, STENCIL_LOOP_END, code + stencils[id].size);
+            patch_target(code, id, &state->code[state->length]);
+            break;
+        case NODE_CHECK_RIGHT:
+            patch_hole(code, id, HOLE_OFFSET, node->offset);
+            patch_target(code, id, state->fail_right);
+            break;
+        case NODE_CHECK_LEFT:
+            patch_hole(code, id, HOLE_OFFSET, node->offset);
+            patch_target(code, id, state->fail_left);
+            break;
+        }
+    }
+}
+
+static void emit_program(stencil_compiled_program *compiled, const struct node *program) {
+    size_t body_size = compute_code_size(program);
+    
+    /* The code of the program is followed by the epilogue and then by the
+     * failure calls, so their address is known before the checks that jump
+     * to them are copied. */
+    struct state state;
+    state.code = compiled->code;
+    state.length = 0;
+    state.fail_right = &compiled->code[stencils[STENCIL_PROLOGUE].size + body_size + stencils[STENCIL_EPILOGUE].size];
+    state.fail_left = state.fail_right + stencils[STENCIL_FAIL].size;
+    
+    unsigned char *code = copy_stencil(&state, STENCIL_PROLOGUE);
+    patch_hole(code, STENCIL_PROLOGUE, HOLE_ADDRESS, (uintptr_t)compiled->memory);
+    
+    emit_body(&state, program);
+    copy_stencil(&state, STENCIL_EPILOGUE);
+    
+    code = copy_stencil(&state, STENCIL_FAIL);
+    patch_hole(code, STENCIL_FAIL, HOLE_ADDRESS, (uintptr_t)fail_too_far_right);
+    
+    code = copy_stencil(&state, STENCIL_FAIL);
+    patch_hole(code, STENCIL_FAIL, HOLE_ADDRESS, (uintptr_t)fail_too_far_left);
+    
+    if(state.length != compiled->size) {
+        fprintf(stderr, "Error: baseline JIT code generation (wrong size)\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+stencil_compiled_program *stencil_compiled_program_create(const struct node *program) {
+    stencil_compiled_program *compiled = malloc(sizeof(stencil_compiled_program));
+    
+    if(compiled == NULL) {
+        fprintf(stderr, "Error: memory allocation (baseline JIT context)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    compiled->memory = calloc(STENCIL_MEMORY_SIZE, 1);
+    
+    if(compiled->memory == NULL) {
+        fprintf(stderr, "Error: memory allocation (baseline JIT memory)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    compiled->size =
+        stencils[STENCIL_PROLOGUE].size +
+        compute_code_size(program) +
+        stencils[STENCIL_EPILOGUE].size +
+        2 * stencils[STENCIL_FAIL].size;
+    
+    compiled->code = mmap(
+        NULL,
+        compiled->size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+    
+    if(compiled->code == MAP_FAILED) {
+        fprintf(stderr, "Error: memory allocation (mmap() for baseline JIT code)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    emit_program(compiled, program);
+    
+    if(mprotect(compiled->code, compiled->size, PROT_READ | PROT_EXEC) < 0) {
+        fprintf(stderr, "Error: mprotect() failed\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    compiled->main = (stencil_main)(uintptr_t)compiled->code;
+    
+    return compiled;
+}
+
+void stencil_compiled_program_free(stencil_compiled_program *compiled) {
+    munmap(compiled->code, compiled->size);
+    free(compiled->memory);
+    free(compiled);
+}
+
+stencil_main stencil_compiled_program_get_main(const stencil_compiled_program *compiled) {
+    return compiled->main;
+}
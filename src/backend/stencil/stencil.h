@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BFC_STENCIL_STENCIL_H
+#define BFC_STENCIL_STENCIL_H
+
+#include <stddef.h>
+
+/* Size of the tape of the baseline JIT. The prologue stencil computes the
+ * end of the tape from it, so it is known when the stencils are generated. */
+#define STENCIL_MEMORY_SIZE 30000
+
+/* Machine code for each kind of IR node, assembled at build time by the
+ * stencil generator (generator.c) into stencils.c. The baseline JIT copies
+ * these into its code buffer and patches the holes with the values of each
+ * node. */
+typedef enum {
+    STENCIL_PROLOGUE,
+    STENCIL_EPILOGUE,
+    STENCIL_ADD,
+    STENCIL_ADD2,
+    STENCIL_SET,
+    STENCIL_RIGHT,
+    STENCIL_IN,
+    STENCIL_OUT,
+    STENCIL_LOOP_START,
+    STENCIL_LOOP_END,
+    STENCIL_CHECK_RIGHT,
+    STENCIL_CHECK_LEFT,
+    STENCIL_FAIL,
+    NUM_STENCILS
+} stencil_id;
+
+typedef enum {
+    /* offset of the cell relative to the data pointer (32 bits) */
+    HOLE_OFFSET,
+    /* offset of the source cell of a NODE_ADD2 node (32 bits) */
+    HOLE_SOURCE_OFFSET,
+    /* value of a NODE_ADD or NODE_SET node (8 bits) */
+    HOLE_VALUE8,
+    /* distance of a NODE_RIGHT node (32 bits) */
+    HOLE_VALUE32,
+    /* jump target, relative to the end of the hole (32 bits) */
+    HOLE_TARGET,
+    /* absolute address of the tape or of a function (64 bits) */
+    HOLE_ADDRESS,
+    NUM_HOLE_KINDS
+} hole_kind;
+
+struct stencil {
+    const unsigned char *code;
+    size_t size;
+    /* offset of each kind of hole in the code, -1 if the stencil has none */
+    int holes[NUM_HOLE_KINDS];
+};
+
+extern const struct stencil stencils[NUM_STENCILS];
+
+/* size in bytes of each kind of hole */
+extern const int stencil_hole_sizes[NUM_HOLE_KINDS];
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Size of the blocks from which allocations are made. A block holds a few
+ * thousand instructions with their operands. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/* Allocations are rounded up to a multiple of this, which is enough for the
+ * pointers and 64-bit integers in instructions and operands. */
+#define ARENA_ALIGNMENT sizeof(uint64_t)
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    /* the header is a multiple of ARENA_ALIGNMENT so the data is aligned */
+    unsigned char data[];
+};
+
+struct x86_arena {
+    /* the block allocations are currently made from, followed by the
+     * previous (full) ones */
+    struct arena_block *blocks;
+};
+
+/* Each thread has its own, so programs can be compiled by several threads at
+ * once, e.g. by the users of libbf. */
+static __thread struct x86_arena *current_arena = NULL;
+
+struct x86_arena *x86_arena_create(void) {
+    struct x86_arena *arena = malloc(sizeof(struct x86_arena));
+    
+    if(arena == NULL) {
+        fprintf(stderr, "Error: memory allocation (x86 arena)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    arena->blocks = NULL;
+    return arena;
+}
+
+void x86_arena_free(struct x86_arena *arena) {
+    if(arena == NULL) {
+        return;
+    }
+    
+    if(arena == current_arena) {
+        current_arena = NULL;
+    }
+    
+    struct arena_block *block = arena->blocks;
+    
+    while(block != NULL) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    
+    free(arena);
+}
+
+struct x86_arena *x86_arena_use(struct x86_arena *arena) {
+    struct x86_arena *previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+static struct arena_block *add_block(struct x86_arena *arena, size_t size) {
+    if(size < ARENA_BLOCK_SIZE) {
+        size = ARENA_BLOCK_SIZE;
+    }
+    
+    struct arena_block *block = malloc(sizeof(struct arena_block) + size);
+    
+    if(block == NULL) {
+        fprintf(stderr, "Error: memory allocation (x86 arena block)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    block->size = size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    
+    return block;
+}
+
+void *x86_arena_allocate(size_t size) {
+    if(current_arena == NULL) {
+        fprintf(stderr, "Error: x86 instruction allocated outside of an arena\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    
+    struct arena_block *block = current_arena->blocks;
+    
+    if(block == NULL || block->size - block->used < size) {
+        block = add_block(current_arena, size);
+    }
+    
+    void *ptr = &block->data[block->used];
+    block->used += size;
+    
+    memset(ptr, 0, size);
+    
+    return ptr;
+}
@@ -28,20 +28,31 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../../ir/query.h"
 #include "../common/symbols.h"
 #include "builder.h"
 #include "codegen.h"
+#include "cpu.h"
+#include "outline.h"
+#include "runtime.h"
 
 #define REGM        X86_REG_RBX
 #define REGP        X86_REG_R13
 #define REGP32      X86_REG_R13D
+#define REGEND      X86_REG_RBP
 #define REG8TEMP    X86_REG_AL
 #define REG64TEMP   X86_REG_RAX
+#define REG32TEMP   X86_REG_EAX
+#define REG64TEMP2  X86_REG_RDX
+#define XMMTEMP1    X86_REG_XMM0
+#define XMMTEMP2    X86_REG_XMM1
 #define REG32ARG1   X86_REG_EDI
 #define REG64ARG1   X86_REG_RDI
 #define REG32ARG2   X86_REG_ESI
@@ -54,24 +65,200 @@
 #define REG32RETVAL X86_REG_EAX
 #define REG64RETVAL X86_REG_RAX
 
+/* Registers in which the cells accessed by innermost static loops can be kept
+ * for the duration of the loop. The last three are callee-saved, so main saves
+ * them when register promotion is enabled. */
+static const x86_reg8 promotion_regs[] = {
+    X86_REG_R8B,
+    X86_REG_R9B,
+    X86_REG_R10B,
+    X86_REG_R11B,
+    X86_REG_R12B,
+    X86_REG_R14B,
+    X86_REG_R15B
+};
+
+#define NUM_PROMOTION_REGS (sizeof(promotion_regs) / sizeof(promotion_regs[0]))
+
+struct promoted_cell {
+    int offset;
+    /* number of accesses in the loop body, used to pick which cells are
+     * promoted if there are more cells than registers */
+    int count;
+    bool written;
+};
+
+/* Size in bytes of the window of cells updated by a vector instruction: 16
+ * with SSE2 (xmm registers), 16 or 32 with AVX2 (xmm or ymm registers). */
+#define SSE_VECTOR_SIZE 16
+#define AVX_VECTOR_SIZE 32
+#define MAX_VECTOR_SIZE AVX_VECTOR_SIZE
+
+/* Minimum number of nodes applied to a window for a single vector update to be
+ * cheaper than one scalar update per node. */
+#define MIN_VECTOR_CELLS 4
+
+/* Maximum number of nodes considered together for vectorization, longer runs
+ * are split. */
+#define MAX_RUN_LENGTH 128
+
+/* Each kind of failure has a single out-of-line path, which calls a function
+ * that reports the error and exits or, in reentrant code, returns a status. */
+typedef enum {
+    FAIL_TOO_FAR_RIGHT,
+    FAIL_TOO_FAR_LEFT,
+    FAIL_INPUT,
+    NUM_FAIL_KINDS
+} fail_kind;
+
 struct state {
     int label;
+    /* number of loops enclosing the code being generated */
+    int loop_depth;
+    bool align_loops;
+    bool promote_registers;
+    bool vectorize;
+    /* whether REGP holds the address of the current cell rather than its
+     * index in the tape (see generate_main()) */
+    bool absolute_pointer;
+    /* whether AVX2 instructions can be used, which also determines the size
+     * of the vectors */
+    bool avx2;
+    int vector_size;
+    /* whether input and output go through the runtime of static executables
+     * (see runtime.h) instead of the C library */
+    bool static_runtime;
+    /* whether the tape and the streams are passed as arguments, and errors
+     * returned as a status (see generate_reentrant_code_for_x86()) */
+    bool reentrant;
+    /* cells of the static loop being generated that are currently kept in
+     * registers (promotion_regs[idx] holds promoted[idx]) */
+    struct promoted_cell promoted[NUM_PROMOTION_REGS];
+    int num_promoted;
+    /* labels of the out-of-line failure paths, placed after the code of the
+     * main function (-1 if unused) */
+    int fail_labels[NUM_FAIL_KINDS];
+    /* in reentrant code, labels of the failure paths of the functions of
+     * outlined loops, which drop the frame of the function first */
+    int outlined_fail_labels[NUM_FAIL_KINDS];
+    /* label of the epilogue of reentrant code, where failures jump with
+     * their status */
+    int return_label;
+    /* whether loops that appear several times are generated once, as a
+     * function called from each of them (see generate_outlined_loops()) */
+    bool outline_loops;
+    struct x86_outline outline;
+    /* whether the code being generated is the body of such a function */
+    bool in_outlined_loop;
+    /* constants used by vector instructions, placed after the code of the
+     * main function */
+    struct x86_builder constants;
 };
 
-static void initialize_state(struct state *state) {
+static void initialize_state(struct state *state, const struct options *options, bool reentrant) {
     state->label = 0;
+    state->loop_depth = 0;
+    /* Aligning loop starts costs code size and compile time, so, unless
+     * forced either way, it is only done at the most expensive level. */
+    if(options->align_loops == TOGGLE_DEFAULT) {
+        state->align_loops = options->optimization_level >= 3;
+    } else {
+        state->align_loops = options->align_loops == TOGGLE_ON;
+    }
+    
+    if(options->promote_registers == TOGGLE_DEFAULT) {
+        state->promote_registers = options->optimization_level >= 2;
+    } else {
+        state->promote_registers = options->promote_registers == TOGGLE_ON;
+    }
+    
+    if(options->vectorize == TOGGLE_DEFAULT) {
+        state->vectorize = options->optimization_level >= 3;
+    } else {
+        state->vectorize = options->vectorize == TOGGLE_ON;
+    }
+    
+    if(options->outline_loops == TOGGLE_DEFAULT) {
+        state->outline_loops = options->optimization_level >= 1;
+    } else {
+        state->outline_loops = options->outline_loops == TOGGLE_ON;
+    }
+    
+    if(options->absolute_pointer == TOGGLE_DEFAULT) {
+        state->absolute_pointer = options->optimization_level >= 2;
+    } else {
+        state->absolute_pointer = options->absolute_pointer == TOGGLE_ON;
+    }
+    
+    switch(options->march) {
+    case MARCH_AVX2:
+        state->avx2 = true;
+        break;
+    case MARCH_NATIVE:
+        state->avx2 = x86_cpu_has_avx2();
+        break;
+    default:
+        state->avx2 = false;
+        break;
+    }
+    
+    state->vector_size = state->avx2 ? AVX_VECTOR_SIZE : SSE_VECTOR_SIZE;
+    state->static_runtime = options->static_executable;
+    state->reentrant = reentrant;
+    state->num_promoted = 0;
+    
+    for(int kind = 0; kind < NUM_FAIL_KINDS; ++kind) {
+        state->fail_labels[kind] = -1;
+        state->outlined_fail_labels[kind] = -1;
+    }
+    
+    state->return_label = -1;
+    state->in_outlined_loop = false;
+    x86_builder_initialize_empty(&state->constants);
+}
+
+/* Returns the memory location of the cell at the specified offset from the
+ * current one: [REGP + offset] if REGP is an absolute pointer, [REGM + REGP +
+ * offset] if it is an index. */
+static struct x86_operand *cell_memory(const struct state *state, int offset) {
+    if(state->absolute_pointer) {
+        return x86_operand_new_mem8_base(REGP, offset);
+    }
+    return x86_operand_new_mem8_reg(REGM, REGP, offset);
+}
+
+/* Returns the operand through which the cell at the specified offset is
+ * accessed: its register if it is promoted, its memory location otherwise. */
+static struct x86_operand *cell_operand(const struct state *state, int offset) {
+    for(int idx = 0; idx < state->num_promoted; ++idx) {
+        if(state->promoted[idx].offset == offset) {
+            return x86_operand_new_reg8(promotion_regs[idx]);
+        }
+    }
+    
+    return cell_memory(state, offset);
+}
+
+static bool is_promoted(const struct state *state, int offset) {
+    for(int idx = 0; idx < state->num_promoted; ++idx) {
+        if(state->promoted[idx].offset == offset) {
+            return true;
+        }
+    }
+    
+    return false;
 }
 
 static void generate_node_add(struct x86_builder *builder, struct state *state, const struct node *node) {
     x86_builder_append_instr(builder, x86_instr_new_add(
-        x86_operand_new_mem8_reg(REGM, REGP, node->offset),
+        cell_operand(state, node->offset),
         x86_operand_new_imm8(node->n)
     ));
 }
 
 static void generate_node_set(struct x86_builder *builder, struct state *state, const struct node *node) {
     x86_builder_append_instr(builder, x86_instr_new_mov(
-        x86_operand_new_mem8_reg(REGM, REGP, node->offset),
+        cell_operand(state, node->offset),
         x86_operand_new_imm8(node->n)
     ));
 }
@@ -81,20 +268,583 @@ static void generate_node_add2(
     const struct node *node,
     const struct node *prev
 ) {
+    /* a promoted source can be added directly from its register */
+    if(is_promoted(state, node->n)) {
+        x86_builder_append_instr(builder, x86_instr_new_add(
+            cell_operand(state, node->offset),
+            cell_operand(state, node->n)
+        ));
+        return;
+    }
+    
     /* peephole optimization: if the previous node was also an add2 node with the same source, we
      * don't need to load the register again since it already contains the right value. */
     if(prev == NULL || prev->type != NODE_ADD2 || prev->n != node->n) {
         x86_builder_append_instr(builder, x86_instr_new_mov(
             x86_operand_new_reg8(REG8TEMP),
-            x86_operand_new_mem8_reg(REGM, REGP, node->n)
+            cell_memory(state, node->n)
         ));
     }
     x86_builder_append_instr(builder, x86_instr_new_add(
-        x86_operand_new_mem8_reg(REGM, REGP, node->offset),
+        cell_operand(state, node->offset),
         x86_operand_new_reg8(REG8TEMP)
     ));
 }
 
+/* A run of consecutive nodes considered together for vectorization: either
+ * add2 nodes with the same source, as generated for a loop that copies or adds
+ * a cell to several others, or add and set nodes, as found in straight-line
+ * code (e.g. the initialization of a table of constants). */
+struct node_run {
+    const struct node *nodes[MAX_RUN_LENGTH];
+    bool vectorized[MAX_RUN_LENGTH];
+    int count;
+};
+
+static bool continues_run(const struct node *node, const struct node *next) {
+    if(next == NULL) {
+        return false;
+    }
+    
+    if(node->type == NODE_ADD2) {
+        return next->type == NODE_ADD2 && next->n == node->n;
+    }
+    
+    return next->type == NODE_ADD || next->type == NODE_SET;
+}
+
+static void collect_run(struct node_run *run, const struct node *node) {
+    run->count = 0;
+    
+    while(run->count < MAX_RUN_LENGTH) {
+        run->vectorized[run->count] = false;
+        run->nodes[run->count++] = node;
+        
+        if(!continues_run(node, node->next)) {
+            break;
+        }
+        
+        node = node->next;
+    }
+}
+
+static bool is_in_window(int offset, int base, int width) {
+    return offset >= base && offset < base + width;
+}
+
+/* Returns whether the node of the run at the specified index can be part of a
+ * vector update. Promoted cells are updated directly in their register. */
+static bool is_vector_candidate(const struct state *state, const struct node_run *run, int idx) {
+    return !run->vectorized[idx] && !is_promoted(state, run->nodes[idx]->offset);
+}
+
+/* Windows are chosen greedily from the lowest offset: the next window starts
+ * at the lowest offset of a remaining candidate that is above the specified
+ * one. */
+static bool find_next_window_base(const struct state *state, const struct node_run *run, int after, int *base) {
+    bool found = false;
+    
+    for(int idx = 0; idx < run->count; ++idx) {
+        int offset = run->nodes[idx]->offset;
+        
+        if(!is_vector_candidate(state, run, idx) || offset <= after) {
+            continue;
+        }
+        
+        if(!found || offset < *base) {
+            *base = offset;
+            found = true;
+        }
+    }
+    
+    return found;
+}
+
+/* With AVX2, a window is only widened to 32 bytes if it has candidates past
+ * the first 16. A loop-carried dependency through a 32-byte store and load has
+ * a longer latency than through a 16-byte one and the window is also more
+ * likely to cross a cache line, so the narrower window is preferred. */
+static int get_window_width(const struct state *state, const struct node_run *run, int base) {
+    for(int idx = 0; idx < run->count; ++idx) {
+        int offset = run->nodes[idx]->offset;
+        
+        if(!is_vector_candidate(state, run, idx)) {
+            continue;
+        }
+        
+        if(is_in_window(offset, base + SSE_VECTOR_SIZE, state->vector_size - SSE_VECTOR_SIZE)) {
+            return state->vector_size;
+        }
+    }
+    
+    return SSE_VECTOR_SIZE;
+}
+
+/* A vector update loads the whole window from memory. If other nodes in the
+ * same loop body write single cells of the window, that load cannot be served
+ * by store forwarding and stalls until the narrower stores complete, which
+ * costs more than the scalar updates it replaces. Outside loops, the run is
+ * executed only once and such a stall does not matter. Input nodes are not a
+ * concern since the store of the input byte is followed by a call. */
+static bool is_window_written_elsewhere(
+    const struct state *state,
+    const struct node *list,
+    const struct node_run *run,
+    int base,
+    int width
+) {
+    if(state->loop_depth == 0) {
+        return false;
+    }
+    
+    const struct node *last = run->nodes[run->count - 1];
+    
+    for(const struct node *node = list; node != NULL; node = node->next) {
+        if(node == run->nodes[0]) {
+            node = last;
+            continue;
+        }
+        
+        switch(node->type) {
+        case NODE_ADD:
+        case NODE_ADD2:
+        case NODE_SET:
+            if(is_in_window(node->offset, base, width)) {
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    
+    return false;
+}
+
+static void mark_window_vectorized(const struct state *state, struct node_run *run, int base, int width) {
+    for(int idx = 0; idx < run->count; ++idx) {
+        if(is_vector_candidate(state, run, idx) && is_in_window(run->nodes[idx]->offset, base, width)) {
+            run->vectorized[idx] = true;
+        }
+    }
+}
+
+static void pack_vector(const unsigned char *bytes, int width, uint64_t *value) {
+    memset(value, 0, width);
+    
+    for(int idx = 0; idx < width; ++idx) {
+        value[idx / 8] |= (uint64_t)bytes[idx] << (8 * (idx % 8));
+    }
+}
+
+/* Returns the label of a vector constant in the constant pool of the main
+ * function, adding it if it is not already there. Each constant is a label
+ * followed by data instructions of 16 bytes each. All constants have the size
+ * of the widest vector, narrower ones are padded with zeroes, so they all stay
+ * aligned. */
+static int get_vector_constant(struct state *state, const uint64_t *value) {
+    int num_dq = state->vector_size / 16;
+    const struct x86_instr *instr = x86_builder_get_first(&state->constants);
+    
+    while(instr != NULL) {
+        int label = instr->dst->n;
+        bool equal = true;
+        instr = instr->next;
+        
+        for(int idx = 0; idx < num_dq; ++idx) {
+            if(instr->dst->address != value[2 * idx] || instr->src->address != value[2 * idx + 1]) {
+                equal = false;
+            }
+            instr = instr->next;
+        }
+        
+        if(equal) {
+            return label;
+        }
+    }
+    
+    int label = state->label++;
+    x86_builder_append_instr(&state->constants, x86_instr_new_label(label));
+    
+    for(int idx = 0; idx < num_dq; ++idx) {
+        x86_builder_append_instr(&state->constants, x86_instr_new_dq(
+            x86_operand_new_imm64(value[2 * idx]),
+            x86_operand_new_imm64(value[2 * idx + 1])
+        ));
+    }
+    
+    return label;
+}
+
+/* Operands and instructions for a window of the specified width. With AVX2,
+ * the VEX-encoded instructions are used for both widths so legacy SSE and AVX
+ * instructions are never mixed. */
+
+static struct x86_operand *vector_register(x86_xmm r, int width) {
+    if(width == AVX_VECTOR_SIZE) {
+        return x86_operand_new_ymm(r);
+    }
+    return x86_operand_new_xmm(r);
+}
+
+static struct x86_operand *vector_cells(const struct state *state, int base, int width) {
+    if(state->absolute_pointer && width == AVX_VECTOR_SIZE) {
+        return x86_operand_new_mem256_base(REGP, base);
+    }
+    if(state->absolute_pointer) {
+        return x86_operand_new_mem128_base(REGP, base);
+    }
+    if(width == AVX_VECTOR_SIZE) {
+        return x86_operand_new_mem256_reg(REGM, REGP, base);
+    }
+    return x86_operand_new_mem128_reg(REGM, REGP, base);
+}
+
+static struct x86_operand *vector_constant(struct state *state, const unsigned char *bytes, int width) {
+    uint64_t value[MAX_VECTOR_SIZE / 8] = {0};
+    pack_vector(bytes, width, value);
+    int label = get_vector_constant(state, value);
+    
+    if(width == AVX_VECTOR_SIZE) {
+        return x86_operand_new_mem256_label(label);
+    }
+    return x86_operand_new_mem128_label(label);
+}
+
+static struct x86_instr *vector_move(const struct state *state, struct x86_operand *dst, struct x86_operand *src) {
+    if(state->avx2) {
+        return x86_instr_new_vmovdqu(dst, src);
+    }
+    return x86_instr_new_movdqu(dst, src);
+}
+
+static struct x86_instr *vector_add(const struct state *state, struct x86_operand *dst, struct x86_operand *src) {
+    if(state->avx2) {
+        return x86_instr_new_vpaddb(dst, src);
+    }
+    return x86_instr_new_paddb(dst, src);
+}
+
+static struct x86_instr *vector_and(const struct state *state, struct x86_operand *dst, struct x86_operand *src) {
+    if(state->avx2) {
+        return x86_instr_new_vpand(dst, src);
+    }
+    return x86_instr_new_pand(dst, src);
+}
+
+static void generate_vector_mask(struct x86_builder *builder, x86_xmm xmm, uint64_t mask) {
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg64(REG64TEMP2),
+        x86_operand_new_imm64(mask)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_imul(
+        x86_operand_new_reg64(REG64TEMP2),
+        x86_operand_new_reg64(REG64TEMP)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_movq(
+        x86_operand_new_xmm(xmm),
+        x86_operand_new_reg64(REG64TEMP2)
+    ));
+}
+
+/* Loads the source of a run of add2 nodes before the first window. It is
+ * zero-extended in REG64TEMP (and thus also in REG8TEMP) and, with AVX2, also
+ * broadcast to every byte of XMMTEMP1. */
+static void generate_add2_source(struct x86_builder *builder, struct state *state, int source) {
+    x86_builder_append_instr(builder, x86_instr_new_movzx(
+        x86_operand_new_reg32(REG32TEMP),
+        cell_operand(state, source)
+    ));
+    
+    if(state->avx2) {
+        x86_builder_append_instr(builder, x86_instr_new_vmovq(
+            x86_operand_new_xmm(XMMTEMP1),
+            x86_operand_new_reg64(REG64TEMP)
+        ));
+        x86_builder_append_instr(builder, x86_instr_new_vpbroadcastb(
+            x86_operand_new_ymm(XMMTEMP1),
+            x86_operand_new_xmm(XMMTEMP1)
+        ));
+    }
+}
+
+/* With SSE2, the source value is multiplied by a mask with a byte set to 1 for
+ * each target, which gives the value to add to each cell without any carry
+ * between bytes. */
+static void generate_sse_add2_window(
+    struct x86_builder *builder,
+    const struct state *state,
+    int base,
+    const unsigned char *bytes
+) {
+    uint64_t masks[SSE_VECTOR_SIZE / 8];
+    pack_vector(bytes, SSE_VECTOR_SIZE, masks);
+    
+    generate_vector_mask(builder, XMMTEMP1, masks[0]);
+    
+    /* movq clears the upper half of the destination register */
+    if(masks[1] != 0) {
+        generate_vector_mask(builder, XMMTEMP2, masks[1]);
+        x86_builder_append_instr(builder, x86_instr_new_punpcklqdq(
+            x86_operand_new_xmm(XMMTEMP1),
+            x86_operand_new_xmm(XMMTEMP2)
+        ));
+    }
+    
+    x86_builder_append_instr(builder, x86_instr_new_movdqu(
+        x86_operand_new_xmm(XMMTEMP2),
+        vector_cells(state, base, SSE_VECTOR_SIZE)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_paddb(
+        x86_operand_new_xmm(XMMTEMP2),
+        x86_operand_new_xmm(XMMTEMP1)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_movdqu(
+        vector_cells(state, base, SSE_VECTOR_SIZE),
+        x86_operand_new_xmm(XMMTEMP2)
+    ));
+}
+
+/* With AVX2, the broadcast source value is masked with 0xff for each target. */
+static void generate_avx_add2_window(
+    struct x86_builder *builder,
+    struct state *state,
+    int base,
+    int width,
+    unsigned char *bytes
+) {
+    for(int idx = 0; idx < width; ++idx) {
+        bytes[idx] = bytes[idx] ? 0xff : 0;
+    }
+    
+    x86_builder_append_instr(builder, x86_instr_new_vmovdqu(
+        vector_register(XMMTEMP2, width),
+        vector_constant(state, bytes, width)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_vpand(
+        vector_register(XMMTEMP2, width),
+        vector_register(XMMTEMP1, width)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_vpaddb(
+        vector_register(XMMTEMP2, width),
+        vector_cells(state, base, width)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_vmovdqu(
+        vector_cells(state, base, width),
+        vector_register(XMMTEMP2, width)
+    ));
+}
+
+/* Adds the source of a run of add2 nodes to every target in the window. */
+static bool generate_add2_window(
+    struct x86_builder *builder,
+    struct state *state,
+    const struct node *list,
+    struct node_run *run,
+    int base,
+    int width,
+    bool *source_loaded
+) {
+    unsigned char bytes[MAX_VECTOR_SIZE] = {0};
+    int count = 0;
+    
+    for(int idx = 0; idx < run->count; ++idx) {
+        int offset = run->nodes[idx]->offset;
+        
+        if(!is_vector_candidate(state, run, idx) || !is_in_window(offset, base, width)) {
+            continue;
+        }
+        
+        /* an increment of 2 would carry into the next byte with SSE2 and
+         * cannot be expressed as a mask with AVX2 */
+        if(bytes[offset - base] != 0) {
+            return false;
+        }
+        
+        bytes[offset - base] = 1;
+        ++count;
+    }
+    
+    if(count < MIN_VECTOR_CELLS || is_window_written_elsewhere(state, list, run, base, width)) {
+        return false;
+    }
+    
+    mark_window_vectorized(state, run, base, width);
+    
+    if(!*source_loaded) {
+        generate_add2_source(builder, state, run->nodes[0]->n);
+        *source_loaded = true;
+    }
+    
+    if(state->avx2) {
+        generate_avx_add2_window(builder, state, base, width, bytes);
+    } else {
+        generate_sse_add2_window(builder, state, base, bytes);
+    }
+    
+    return true;
+}
+
+/* Applies the add and set nodes of a run that fall in the window. The effect
+ * of these nodes on each cell is (cell & keep) + addend, where keep is 0 for
+ * cells that are set and 0xff for the others, so it can be applied to the
+ * whole window with one pand and one paddb. If every cell of the window is
+ * set, the window is simply overwritten. */
+static bool generate_block_window(
+    struct x86_builder *builder,
+    struct state *state,
+    const struct node *list,
+    struct node_run *run,
+    int base,
+    int width
+) {
+    unsigned char keep[MAX_VECTOR_SIZE];
+    unsigned char addend[MAX_VECTOR_SIZE] = {0};
+    int count = 0;
+    int num_set = 0;
+    
+    memset(keep, 0xff, sizeof(keep));
+    
+    for(int idx = 0; idx < run->count; ++idx) {
+        const struct node *node = run->nodes[idx];
+        
+        if(!is_vector_candidate(state, run, idx) || !is_in_window(node->offset, base, width)) {
+            continue;
+        }
+        
+        int position = node->offset - base;
+        
+        if(node->type == NODE_SET) {
+            if(keep[position] != 0) {
+                ++num_set;
+            }
+            keep[position] = 0;
+            addend[position] = node->n;
+        } else {
+            addend[position] += node->n;
+        }
+        
+        ++count;
+    }
+    
+    if(count < MIN_VECTOR_CELLS || is_window_written_elsewhere(state, list, run, base, width)) {
+        return false;
+    }
+    
+    mark_window_vectorized(state, run, base, width);
+    
+    if(num_set == width) {
+        x86_builder_append_instr(builder, vector_move(
+            state,
+            vector_register(XMMTEMP1, width),
+            vector_constant(state, addend, width)
+        ));
+    } else {
+        x86_builder_append_instr(builder, vector_move(
+            state,
+            vector_register(XMMTEMP1, width),
+            vector_cells(state, base, width)
+        ));
+        
+        if(num_set > 0) {
+            x86_builder_append_instr(builder, vector_and(
+                state,
+                vector_register(XMMTEMP1, width),
+                vector_constant(state, keep, width)
+            ));
+        }
+        
+        x86_builder_append_instr(builder, vector_add(
+            state,
+            vector_register(XMMTEMP1, width),
+            vector_constant(state, addend, width)
+        ));
+    }
+    
+    x86_builder_append_instr(builder, vector_move(
+        state,
+        vector_cells(state, base, width),
+        vector_register(XMMTEMP1, width)
+    ));
+    
+    return true;
+}
+
+/* Generates the code for a run of nodes. Nodes that fall in a window of
+ * vector_size cells are applied together by vector instructions if there are
+ * enough of them, the others are generated one by one. Returns the last node
+ * of the run. */
+static const struct node *generate_run(
+    struct x86_builder *builder,
+    struct state *state,
+    const struct node *list,
+    const struct node *node,
+    const struct node *prev
+) {
+    struct node_run run;
+    collect_run(&run, node);
+    
+    bool source_loaded = false;
+    bool upper_used = false;
+    int after = INT_MIN;
+    int base = 0;
+    
+    while(find_next_window_base(state, &run, after, &base)) {
+        int width = get_window_width(state, &run, base);
+        bool vectorized;
+        
+        if(node->type == NODE_ADD2) {
+            vectorized = generate_add2_window(builder, state, list, &run, base, width, &source_loaded);
+        } else {
+            vectorized = generate_block_window(builder, state, list, &run, base, width);
+        }
+        
+        if(vectorized) {
+            after = base + width - 1;
+        } else {
+            after = base;
+        }
+        
+        upper_used = upper_used || (vectorized && width == AVX_VECTOR_SIZE);
+    }
+    
+    /* Leave the upper halves of the ymm registers clean (vpbroadcastb also
+     * writes them), otherwise SSE code in the library functions called for
+     * input and output pays a penalty. */
+    if(state->avx2 && (upper_used || source_loaded)) {
+        x86_builder_append_instr(builder, x86_instr_new_vzeroupper());
+    }
+    
+    /* the source of the add2 nodes is now in REG8TEMP if it was loaded for the
+     * vector updates, which generate_node_add2() detects through the previous
+     * node */
+    if(source_loaded) {
+        prev = node;
+    }
+    
+    for(int idx = 0; idx < run.count; ++idx) {
+        if(run.vectorized[idx]) {
+            continue;
+        }
+        
+        switch(run.nodes[idx]->type) {
+        case NODE_ADD:
+            generate_node_add(builder, state, run.nodes[idx]);
+            break;
+        case NODE_ADD2:
+            generate_node_add2(builder, state, run.nodes[idx], prev);
+            break;
+        default:
+            generate_node_set(builder, state, run.nodes[idx]);
+            break;
+        }
+        
+        prev = run.nodes[idx];
+    }
+    
+    return run.nodes[run.count - 1];
+}
+
 static void generate_node_right(struct x86_builder *builder, struct state *state, const struct node *node) {
     x86_builder_append_instr(builder, x86_instr_new_add(
         x86_operand_new_reg64(REGP),
@@ -102,17 +852,184 @@ static void generate_node_right(struct x86_builder *builder, struct state *state
     ));
 }
 
+static void load_promoted_cells(struct x86_builder *builder, const struct state *state) {
+    for(int idx = 0; idx < state->num_promoted; ++idx) {
+        x86_builder_append_instr(builder, x86_instr_new_mov(
+            x86_operand_new_reg8(promotion_regs[idx]),
+            cell_memory(state, state->promoted[idx].offset)
+        ));
+    }
+}
+
+static void store_promoted_cells(struct x86_builder *builder, const struct state *state) {
+    for(int idx = 0; idx < state->num_promoted; ++idx) {
+        if(state->promoted[idx].written) {
+            x86_builder_append_instr(builder, x86_instr_new_mov(
+                cell_memory(state, state->promoted[idx].offset),
+                x86_operand_new_reg8(promotion_regs[idx])
+            ));
+        }
+    }
+}
+
+/* Input and output instructions access their cell in memory and call library
+ * functions that do not preserve the caller-saved promotion registers, so the
+ * promoted cells are written back before the call and reloaded after it. */
+static int begin_call(struct x86_builder *builder, struct state *state) {
+    int num_promoted = state->num_promoted;
+    store_promoted_cells(builder, state);
+    state->num_promoted = 0;
+    return num_promoted;
+}
+
+static void end_call(struct x86_builder *builder, struct state *state, int num_promoted) {
+    state->num_promoted = num_promoted;
+    load_promoted_cells(builder, state);
+}
+
+static int get_label(struct state *state, int *label) {
+    if(*label < 0) {
+        *label = state->label++;
+    }
+    return *label;
+}
+
+/* Returns the label of the out-of-line failure path, allocating it on first
+ * use. It is placed after the code of the main function (see
+ * generate_fail_calls()) so the check is a single forward branch that is not
+ * taken and the failure path does not take space in the hot code. All checks
+ * of the same kind share the same path. */
+static int get_fail_label(struct state *state, fail_kind kind) {
+    if(state->reentrant && state->in_outlined_loop) {
+        return get_label(state, &state->outlined_fail_labels[kind]);
+    }
+    return get_label(state, &state->fail_labels[kind]);
+}
+
+/* All callee-saved registers are taken, so reentrant code keeps the pointer
+ * to its context in the stack slot main reserves for alignment, which is one
+ * call deeper in the functions of outlined loops. */
+static void generate_context_load(
+    struct x86_builder *builder,
+    const struct state *state,
+    x86_reg64 dst,
+    size_t member
+) {
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg64(REG64TEMP),
+        x86_operand_new_mem64_base(X86_REG_RSP, state->in_outlined_loop ? 16 : 0)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg64(dst),
+        x86_operand_new_mem64_base(REG64TEMP, (int)member)
+    ));
+}
+
+/* In reentrant code, end of input and read errors are returned to the caller
+ * rather than reported by a function that exits, so the check is inline. */
+static void generate_reentrant_node_in(struct x86_builder *builder, struct state *state, const struct node *node) {
+    generate_context_load(builder, state, REG64ARG1, offsetof(struct x86_io_context, input));
+    x86_builder_append_instr(builder, x86_instr_new_call(
+        x86_operand_new_extern(EXTERN_FGETC)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_cmp(
+        x86_operand_new_reg32(REG32RETVAL),
+        x86_operand_new_imm32(EOF)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_jz(
+        x86_operand_new_label(get_fail_label(state, FAIL_INPUT))
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        cell_memory(state, node->offset),
+        x86_operand_new_reg8(REG8RETVAL)
+    ));
+}
+
+/* While there is input in memory, reading a byte is a load from it and an
+ * update of the position in the context. The promoted cells stay in their
+ * registers since there is no call. generate_context_load() leaves the
+ * pointer to the context in REG64TEMP. */
+static void generate_reentrant_node_in_memory(
+    struct x86_builder *builder,
+    struct state *state,
+    const struct node *node,
+    int label_stream
+) {
+    generate_context_load(builder, state, REG64ARG1, offsetof(struct x86_io_context, input_position));
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg64(REG64ARG2),
+        x86_operand_new_mem64_base(REG64TEMP, offsetof(struct x86_io_context, input_end))
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_cmp(
+        x86_operand_new_reg64(REG64ARG1),
+        x86_operand_new_reg64(REG64ARG2)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_jz(
+        x86_operand_new_label(label_stream)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_add(
+        x86_operand_new_reg64(REG64ARG1),
+        x86_operand_new_imm32(1)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_mem64_base(REG64TEMP, offsetof(struct x86_io_context, input_position)),
+        x86_operand_new_reg64(REG64ARG1)
+    ));
+    
+    if(is_promoted(state, node->offset)) {
+        x86_builder_append_instr(builder, x86_instr_new_mov(
+            cell_operand(state, node->offset),
+            x86_operand_new_mem8_base(REG64ARG1, -1)
+        ));
+    } else {
+        x86_builder_append_instr(builder, x86_instr_new_mov(
+            x86_operand_new_reg8(REG8TEMP),
+            x86_operand_new_mem8_base(REG64ARG1, -1)
+        ));
+        x86_builder_append_instr(builder, x86_instr_new_mov(
+            cell_memory(state, node->offset),
+            x86_operand_new_reg8(REG8TEMP)
+        ));
+    }
+}
+
 static void generate_node_in(struct x86_builder *builder, struct state *state, const struct node *node) {
-    x86_builder_append_instr(builder, x86_instr_new_mov(
-        x86_operand_new_reg64(REG64ARG1),
-        x86_operand_new_mem64_extern(EXTERN_STDIN)
-    ));
-    x86_builder_append_instr(builder, x86_instr_new_call(
-        x86_operand_new_extern(EXTERN_FGETC)
-    ));
+    if(state->reentrant) {
+        int label_stream = state->label++;
+        int label_done = state->label++;
+        
+        generate_reentrant_node_in_memory(builder, state, node, label_stream);
+        x86_builder_append_instr(builder, x86_instr_new_jmp(
+            x86_operand_new_label(label_done)
+        ));
+        
+        x86_builder_append_instr(builder, x86_instr_new_label(label_stream));
+        int num_promoted = begin_call(builder, state);
+        generate_reentrant_node_in(builder, state, node);
+        end_call(builder, state, num_promoted);
+        
+        x86_builder_append_instr(builder, x86_instr_new_label(label_done));
+        return;
+    }
+    
+    int num_promoted = begin_call(builder, state);
+    
+    if(state->static_runtime) {
+        x86_builder_append_instr(builder, x86_instr_new_call(
+            x86_operand_new_local(LOCAL_READ_BYTE)
+        ));
+    } else {
+        x86_builder_append_instr(builder, x86_instr_new_mov(
+            x86_operand_new_reg64(REG64ARG1),
+            x86_operand_new_mem64_extern(EXTERN_STDIN)
+        ));
+        x86_builder_append_instr(builder, x86_instr_new_call(
+            x86_operand_new_extern(EXTERN_FGETC)
+        ));
+    }
     
     x86_builder_append_instr(builder, x86_instr_new_mov(
-        x86_operand_new_mem8_reg(REGM, REGP, node->offset),
+        cell_memory(state, node->offset),
         x86_operand_new_reg8(REG8RETVAL)
     ));
     x86_builder_append_instr(builder, x86_instr_new_mov(
@@ -122,23 +1039,42 @@ static void generate_node_in(struct x86_builder *builder, struct state *state, c
     x86_builder_append_instr(builder, x86_instr_new_call(
         x86_operand_new_local(LOCAL_CHECK_INPUT)
     ));
+    
+    end_call(builder, state, num_promoted);
 }
 
+
 static void generate_node_out(struct x86_builder *builder, struct state *state, const struct node *node) {
+    int num_promoted = begin_call(builder, state);
+    
     x86_builder_append_instr(builder, x86_instr_new_movzx(
         x86_operand_new_reg32(REG32ARG1),
-        x86_operand_new_mem8_reg(REGM, REGP, node->offset)
-    ));
-    x86_builder_append_instr(builder, x86_instr_new_mov(
-        x86_operand_new_reg64(REG64ARG2),
-        x86_operand_new_mem64_extern(EXTERN_STDOUT)
-    ));
-    x86_builder_append_instr(builder, x86_instr_new_call(
-        x86_operand_new_extern(EXTERN_PUTC)
+        cell_memory(state, node->offset)
     ));
+    
+    if(state->static_runtime) {
+        x86_builder_append_instr(builder, x86_instr_new_call(
+            x86_operand_new_local(LOCAL_WRITE_BYTE)
+        ));
+    } else {
+        if(state->reentrant) {
+            generate_context_load(builder, state, REG64ARG2, offsetof(struct x86_io_context, output));
+        } else {
+            x86_builder_append_instr(builder, x86_instr_new_mov(
+                x86_operand_new_reg64(REG64ARG2),
+                x86_operand_new_mem64_extern(EXTERN_STDOUT)
+            ));
+        }
+        
+        x86_builder_append_instr(builder, x86_instr_new_call(
+            x86_operand_new_extern(EXTERN_PUTC)
+        ));
+    }
+    
+    end_call(builder, state, num_promoted);
 }
 
-static bool needs_loop_test(const struct x86_builder *builder, int loop_offset) {
+static bool needs_loop_test(const struct x86_builder *builder, const struct x86_operand *cell) {
     /* peephole optimization: if the start or end of a loop is immediately
      * preceeded by an add instruction that affects the loop location, there is
      * no need to add instructions to set the zero flag (ZF) according to the
@@ -164,18 +1100,31 @@ static bool needs_loop_test(const struct x86_builder *builder, int loop_offset)
     
     const struct x86_operand *dst = instr->dst;
     
-    if(dst->type != X86_OPERAND_MEM8_REG) {
+    /* the loop location is either in memory or, if it is promoted, in a
+     * register */
+    if(dst->type != cell->type) {
         return true;
     }
     
-    return (dst->r1 != REGM) || (dst->r2 != REGP) || (dst->n != loop_offset);
+    return (dst->r1 != cell->r1) || (dst->r2 != cell->r2) || (dst->n != cell->n);
 }
 
-static void add_loop_test(struct x86_builder *builder, const struct node *node) {
-    if(needs_loop_test(builder, node->offset)) {
+static void add_loop_test(struct x86_builder *builder, const struct state *state, const struct node *node) {
+    struct x86_operand *cell = cell_operand(state, node->offset);
+    
+    if(!needs_loop_test(builder, cell)) {
+        return;
+    }
+    
+    if(cell->type == X86_OPERAND_REG8) {
+        x86_builder_append_instr(builder, x86_instr_new_or(
+            cell,
+            x86_operand_new_reg8(cell->r1)
+        ));
+    } else {
         x86_builder_append_instr(builder, x86_instr_new_mov(
             x86_operand_new_reg8(REG8TEMP),
-            x86_operand_new_mem8_reg(REGM, REGP, node->offset)
+            cell
         ));
         x86_builder_append_instr(builder, x86_instr_new_or(
             x86_operand_new_reg8(REG8TEMP),
@@ -184,34 +1133,191 @@ static void add_loop_test(struct x86_builder *builder, const struct node *node)
     }
 }
 
+static void count_cell_access(
+    struct promoted_cell *cells,
+    int *num_cells,
+    int max_cells,
+    int offset,
+    bool written
+) {
+    for(int idx = 0; idx < *num_cells; ++idx) {
+        if(cells[idx].offset == offset) {
+            ++cells[idx].count;
+            cells[idx].written = cells[idx].written || written;
+            return;
+        }
+    }
+    
+    /* cells beyond the maximum are simply never promoted */
+    if(*num_cells < max_cells) {
+        cells[*num_cells].offset = offset;
+        cells[*num_cells].count = 1;
+        cells[*num_cells].written = written;
+        ++*num_cells;
+    }
+}
+
+/* Only innermost static loops are considered: the data pointer does not move
+ * inside them, so each cell they access stays at the same address for the
+ * whole loop. */
+static bool is_promotable_loop(const struct state *state, const struct node *node) {
+    if(!state->promote_registers || node->type != NODE_STATIC_LOOP || state->num_promoted > 0) {
+        return false;
+    }
+    
+    for(const struct node *child = node->body; child != NULL; child = child->next) {
+        if(node_is_loop(child)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+#define MAX_PROMOTION_CANDIDATES 64
+
+static void promote_loop_cells(struct state *state, const struct node *loop) {
+    struct promoted_cell cells[MAX_PROMOTION_CANDIDATES];
+    int num_cells = 0;
+    
+    /* the loop location is accessed twice per iteration by the loop tests */
+    count_cell_access(cells, &num_cells, MAX_PROMOTION_CANDIDATES, loop->offset, false);
+    ++cells[0].count;
+    
+    for(const struct node *node = loop->body; node != NULL; node = node->next) {
+        switch(node->type) {
+        case NODE_ADD:
+        case NODE_SET:
+            count_cell_access(cells, &num_cells, MAX_PROMOTION_CANDIDATES, node->offset, true);
+            break;
+        case NODE_ADD2:
+            count_cell_access(cells, &num_cells, MAX_PROMOTION_CANDIDATES, node->offset, true);
+            count_cell_access(cells, &num_cells, MAX_PROMOTION_CANDIDATES, node->n, false);
+            break;
+        case NODE_IN:
+            count_cell_access(cells, &num_cells, MAX_PROMOTION_CANDIDATES, node->offset, true);
+            break;
+        case NODE_OUT:
+            count_cell_access(cells, &num_cells, MAX_PROMOTION_CANDIDATES, node->offset, false);
+            break;
+        default:
+            break;
+        }
+    }
+    
+    /* keep the most frequently accessed cells */
+    state->num_promoted = 0;
+    
+    while(state->num_promoted < NUM_PROMOTION_REGS && num_cells > 0) {
+        int best = 0;
+        
+        for(int idx = 1; idx < num_cells; ++idx) {
+            if(cells[idx].count > cells[best].count) {
+                best = idx;
+            }
+        }
+        
+        state->promoted[state->num_promoted++] = cells[best];
+        cells[best] = cells[--num_cells];
+    }
+}
+
 /* forward declaration because mutually recursive with generate_node_loop() */
 static void generate_code_recursive(struct x86_builder *builder, struct state *state, const struct node *node);
 
+/* Only the start of innermost loops is aligned: they are where most of the
+ * time is spent and aligning outer loops too mostly adds padding. */
+static bool is_innermost_loop(const struct node *loop) {
+    for(const struct node *node = loop->body; node != NULL; node = node->next) {
+        if(node->type == NODE_LOOP || node->type == NODE_STATIC_LOOP) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Calls the function generated for a class of identical loops instead of
+ * generating the loop again. The function is not used inside another one, so
+ * the loops nested in an outlined loop are part of its function, and not in a
+ * loop whose cells are promoted to registers, which are not saved. */
+static bool generate_outlined_call(struct x86_builder *builder, struct state *state, const struct node *node) {
+    if(!state->outline_loops || state->in_outlined_loop || state->num_promoted > 0) {
+        return false;
+    }
+    
+    struct x86_outlined_loop *outlined = x86_outline_find(&state->outline, node);
+    
+    if(outlined == NULL) {
+        return false;
+    }
+    
+    if(outlined->label < 0) {
+        outlined->label = state->label++;
+    }
+    
+    x86_builder_append_instr(builder, x86_instr_new_call(
+        x86_operand_new_label(outlined->label)
+    ));
+    return true;
+}
+
 static void generate_node_loop(struct x86_builder *builder, struct state *state, const struct node *node) {
+    if(generate_outlined_call(builder, state, node)) {
+        return;
+    }
+    
     int start = state->label++;
     int end = state->label++;
     
-    add_loop_test(builder, node);
+    add_loop_test(builder, state, node);
     x86_builder_append_instr(builder, x86_instr_new_jz(
         x86_operand_new_label(end)
     ));
     
-    x86_builder_append_instr(builder, x86_instr_new_align(16));
+    bool promoted = is_promotable_loop(state, node);
+    
+    if(promoted) {
+        promote_loop_cells(state, node);
+        load_promoted_cells(builder, state);
+    }
+    
+    if(state->align_loops && is_innermost_loop(node)) {
+        x86_builder_append_instr(builder, x86_instr_new_align(16));
+    }
     
     x86_builder_append_instr(builder, x86_instr_new_label(start));
     
+    ++state->loop_depth;
     generate_code_recursive(builder, state, node->body);
+    --state->loop_depth;
     
-    add_loop_test(builder, node);
+    add_loop_test(builder, state, node);
     x86_builder_append_instr(builder, x86_instr_new_jnz(
         x86_operand_new_label(start)
     ));
     
+    if(promoted) {
+        store_promoted_cells(builder, state);
+        state->num_promoted = 0;
+    }
+    
     x86_builder_append_instr(builder, x86_instr_new_label(end));
 }
 
-static void generate_node_check_right(struct x86_builder *builder, struct state *state, const struct node *node) {
-    int skip = state->label++;
+/* Loads the address (absolute pointer) or index of the cell at the specified
+ * offset in REG64TEMP, or returns REGP directly if the offset is zero. */
+static x86_reg64 generate_checked_position(struct x86_builder *builder, const struct state *state, int offset) {
+    if(state->absolute_pointer && offset == 0) {
+        return REGP;
+    }
+    
+    if(state->absolute_pointer) {
+        x86_builder_append_instr(builder, x86_instr_new_lea(
+            x86_operand_new_reg64(REG64TEMP),
+            x86_operand_new_mem8_base(REGP, offset)
+        ));
+        return REG64TEMP;
+    }
     
     x86_builder_append_instr(builder, x86_instr_new_mov(
         x86_operand_new_reg64(REG64TEMP),
@@ -219,59 +1325,63 @@ static void generate_node_check_right(struct x86_builder *builder, struct state
     ));
     x86_builder_append_instr(builder, x86_instr_new_add(
         x86_operand_new_reg64(REG64TEMP),
-        x86_operand_new_imm32(node->offset)
+        x86_operand_new_imm32(offset)
     ));
+    return REG64TEMP;
+}
+
+static void generate_node_check_right(struct x86_builder *builder, struct state *state, const struct node *node) {
+    x86_reg64 position = generate_checked_position(builder, state, node->offset);
+    
+    /* REGEND is the end of the tape, as an address or as an index like the
+     * position (see generate_main()) */
     x86_builder_append_instr(builder, x86_instr_new_cmp(
-        x86_operand_new_reg64(REG64TEMP),
-        x86_operand_new_imm32(30000)
-    ));
-    x86_builder_append_instr(builder, x86_instr_new_jl(
-        x86_operand_new_label(skip)
+        x86_operand_new_reg64(position),
+        x86_operand_new_reg64(REGEND)
     ));
     
-    x86_builder_append_instr(builder, x86_instr_new_call(
-        x86_operand_new_local(LOCAL_FAIL_TOO_FAR_RIGHT)
+    x86_builder_append_instr(builder, x86_instr_new_jge(
+        x86_operand_new_label(get_fail_label(state, FAIL_TOO_FAR_RIGHT))
     ));
-    
-    x86_builder_append_instr(builder, x86_instr_new_label(skip));
 }
 
 static void generate_node_check_left(struct x86_builder *builder, struct state *state, const struct node *node) {
-    int skip = state->label++;
+    x86_reg64 position = generate_checked_position(builder, state, node->offset);
     
-    x86_builder_append_instr(builder, x86_instr_new_mov(
-        x86_operand_new_reg64(REG64TEMP),
-        x86_operand_new_reg64(REGP)
-    ));
-    x86_builder_append_instr(builder, x86_instr_new_add(
-        x86_operand_new_reg64(REG64TEMP),
-        x86_operand_new_imm32(node->offset)
-    ));
-    x86_builder_append_instr(builder, x86_instr_new_jns(
-        x86_operand_new_label(skip)
-    ));
+    /* With an index, the add that computes it already sets the sign flag.
+     * Addresses are far below 2^63, so the sign of the difference with the
+     * start of the tape is also exact. */
+    if(state->absolute_pointer) {
+        x86_builder_append_instr(builder, x86_instr_new_cmp(
+            x86_operand_new_reg64(position),
+            x86_operand_new_reg64(REGM)
+        ));
+    }
     
-    x86_builder_append_instr(builder, x86_instr_new_call(
-        x86_operand_new_local(LOCAL_FAIL_TOO_FAR_LEFT)
+    x86_builder_append_instr(builder, x86_instr_new_js(
+        x86_operand_new_label(get_fail_label(state, FAIL_TOO_FAR_LEFT))
     ));
-    
-    x86_builder_append_instr(builder, x86_instr_new_label(skip));
 }
 
 
 static void generate_code_recursive(struct x86_builder *builder, struct state *state, const struct node *node) {
+    const struct node *list = node;
     const struct node *prev = NULL;
 
     while(node != NULL) {
         switch(node->type) {
         case NODE_ADD:
-            generate_node_add(builder, state, node);
-            break;
         case NODE_ADD2:
-            generate_node_add2(builder, state, node, prev);
-            break;
         case NODE_SET:
-            generate_node_set(builder, state, node);
+            if(state->vectorize) {
+                node = generate_run(builder, state, list, node, prev);
+            } else if(node->type == NODE_ADD) {
+                generate_node_add(builder, state, node);
+            } else if(node->type == NODE_ADD2) {
+                generate_node_add2(builder, state, node, prev);
+            } else {
+                generate_node_set(builder, state, node);
+            }
             break;   
         case NODE_RIGHT:
             generate_node_right(builder, state, node);
@@ -298,10 +1408,146 @@ static void generate_code_recursive(struct x86_builder *builder, struct state *s
     }
 }
 
-static struct x86_instr *generate_main(const struct node *node) {
+static void generate_fail_call(struct x86_builder *builder, int label, local_symbol fail) {
+    if(label < 0) {
+        return;
+    }
+    
+    x86_builder_append_instr(builder, x86_instr_new_label(label));
+    /* These calls are reached with the stack of the check that failed, so it
+     * is aligned as for any other call. The functions do not return. */
+    x86_builder_append_instr(builder, x86_instr_new_call(
+        x86_operand_new_local(fail)
+    ));
+}
+
+static void generate_fail_return(struct x86_builder *builder, const struct state *state, int label, x86_status status) {
+    if(label < 0) {
+        return;
+    }
+    
+    x86_builder_append_instr(builder, x86_instr_new_label(label));
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg32(REG32RETVAL),
+        x86_operand_new_imm32(status)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_jmp(
+        x86_operand_new_label(state->return_label)
+    ));
+}
+
+/* End of input and read errors both make fgetc() return EOF, ferror() tells
+ * them apart. */
+static void generate_fail_input_return(struct x86_builder *builder, const struct state *state) {
+    if(state->fail_labels[FAIL_INPUT] < 0) {
+        return;
+    }
+    
+    x86_builder_append_instr(builder, x86_instr_new_label(state->fail_labels[FAIL_INPUT]));
+    generate_context_load(builder, state, REG64ARG1, offsetof(struct x86_io_context, input));
+    x86_builder_append_instr(builder, x86_instr_new_call(
+        x86_operand_new_extern(EXTERN_FERROR)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_or(
+        x86_operand_new_reg32(REG32RETVAL),
+        x86_operand_new_reg32(REG32RETVAL)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg32(REG32RETVAL),
+        x86_operand_new_imm32(X86_STATUS_END_OF_INPUT)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_jz(
+        x86_operand_new_label(state->return_label)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg32(REG32RETVAL),
+        x86_operand_new_imm32(X86_STATUS_INPUT_ERROR)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_jmp(
+        x86_operand_new_label(state->return_label)
+    ));
+}
+
+/* In reentrant code, failures return from main with a status. Those in the
+ * functions of outlined loops first drop the return address and alignment
+ * slot of the function, and then take the path of main. */
+static void generate_fail_returns(struct x86_builder *builder, struct state *state) {
+    for(int kind = 0; kind < NUM_FAIL_KINDS; ++kind) {
+        if(state->outlined_fail_labels[kind] < 0) {
+            continue;
+        }
+        
+        x86_builder_append_instr(builder, x86_instr_new_label(state->outlined_fail_labels[kind]));
+        x86_builder_append_instr(builder, x86_instr_new_add(
+            x86_operand_new_reg64(X86_REG_RSP),
+            x86_operand_new_imm32(16)
+        ));
+        x86_builder_append_instr(builder, x86_instr_new_jmp(
+            x86_operand_new_label(get_label(state, &state->fail_labels[kind]))
+        ));
+    }
+    
+    generate_fail_return(builder, state, state->fail_labels[FAIL_TOO_FAR_RIGHT], X86_STATUS_TOO_FAR_RIGHT);
+    generate_fail_return(builder, state, state->fail_labels[FAIL_TOO_FAR_LEFT], X86_STATUS_TOO_FAR_LEFT);
+    generate_fail_input_return(builder, state);
+}
+
+static void generate_fail_calls(struct x86_builder *builder, struct state *state) {
+    if(state->reentrant) {
+        generate_fail_returns(builder, state);
+        return;
+    }
+    
+    generate_fail_call(builder, state->fail_labels[FAIL_TOO_FAR_RIGHT], LOCAL_FAIL_TOO_FAR_RIGHT);
+    generate_fail_call(builder, state->fail_labels[FAIL_TOO_FAR_LEFT], LOCAL_FAIL_TOO_FAR_LEFT);
+}
+
+/* Generates the functions of the loops that were outlined, placed after the
+ * code of the main function. The stack is moved by 8 bytes so it stays aligned
+ * on 16 bytes for library calls and failed bound checks, and the loop test at
+ * the start of the function cannot be skipped since the last instruction is
+ * not an add to a cell (see needs_loop_test()). */
+static void generate_outlined_loops(struct x86_builder *builder, struct state *state) {
+    for(size_t idx = 0; idx < state->outline.num_loops; ++idx) {
+        const struct x86_outlined_loop *outlined = &state->outline.loops[idx];
+        
+        if(outlined->label < 0) {
+            continue;
+        }
+        
+        x86_builder_append_instr(builder, x86_instr_new_label(outlined->label));
+        x86_builder_append_instr(builder, x86_instr_new_add(
+            x86_operand_new_reg64(X86_REG_RSP),
+            x86_operand_new_imm32(-8)
+        ));
+        
+        state->in_outlined_loop = true;
+        generate_node_loop(builder, state, outlined->loop);
+        state->in_outlined_loop = false;
+        
+        x86_builder_append_instr(builder, x86_instr_new_add(
+            x86_operand_new_reg64(X86_REG_RSP),
+            x86_operand_new_imm32(8)
+        ));
+        x86_builder_append_instr(builder, x86_instr_new_ret());
+    }
+}
+
+static struct x86_instr *generate_main(const struct node *node, const struct options *options, bool reentrant) {
     struct x86_builder builder;
     x86_builder_initialize_empty(&builder);
     
+    struct state state;
+    initialize_state(&state, options, reentrant);
+    
+    if(state.outline_loops) {
+        x86_outline_initialize(&state.outline, node);
+    }
+    
+    /* Reentrant code always uses the alignment slot that comes with saving
+     * the promotion registers (see generate_context_load()). */
+    bool save_promotion_regs = state.promote_registers || state.reentrant;
+    
     x86_builder_append_instr(&builder, x86_instr_new_push(
         x86_operand_new_reg64(X86_REG_RBP)
     ));
@@ -312,19 +1558,100 @@ static struct x86_instr *generate_main(const struct node *node) {
         x86_operand_new_reg64(REGM)
     ));
     
-    x86_builder_append_instr(&builder, x86_instr_new_mov(
-        x86_operand_new_reg64(REGM),
-        x86_operand_new_mem64_local(LOCAL_M)
-    ));
-    x86_builder_append_instr(&builder, x86_instr_new_mov(
-        x86_operand_new_reg32(REGP32),
-        x86_operand_new_imm32(0)
-    ));
+    if(save_promotion_regs) {
+        x86_builder_append_instr(&builder, x86_instr_new_push(
+            x86_operand_new_reg64(X86_REG_R12)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_push(
+            x86_operand_new_reg64(X86_REG_R14)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_push(
+            x86_operand_new_reg64(X86_REG_R15)
+        ));
+        /* keep the stack aligned on 16 bytes for library calls */
+        x86_builder_append_instr(&builder, x86_instr_new_add(
+            x86_operand_new_reg64(X86_REG_RSP),
+            x86_operand_new_imm32(-8)
+        ));
+    }
+    
+    /* REGM always holds the start of the tape. REGP is either the index of
+     * the current cell or, with an absolute pointer, its address. REGEND holds
+     * the end of the tape for the bound checks, in the same form as REGP. */
+    if(state.reentrant) {
+        state.return_label = state.label++;
+        
+        x86_builder_append_instr(&builder, x86_instr_new_mov(
+            x86_operand_new_mem64_base(X86_REG_RSP, 0),
+            x86_operand_new_reg64(REG64ARG3)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_mov(
+            x86_operand_new_reg64(REGM),
+            x86_operand_new_reg64(REG64ARG1)
+        ));
+    } else {
+        x86_builder_append_instr(&builder, x86_instr_new_mov(
+            x86_operand_new_reg64(REGM),
+            x86_operand_new_mem64_local(LOCAL_M)
+        ));
+    }
+    
+    if(state.absolute_pointer) {
+        x86_builder_append_instr(&builder, x86_instr_new_mov(
+            x86_operand_new_reg64(REGP),
+            x86_operand_new_reg64(REGM)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_lea(
+            x86_operand_new_reg64(REGEND),
+            state.reentrant
+                ? x86_operand_new_mem8_reg(REGM, REG64ARG2, 0)
+                : x86_operand_new_mem8_base(REGM, 30000)
+        ));
+    } else {
+        x86_builder_append_instr(&builder, x86_instr_new_mov(
+            x86_operand_new_reg32(REGP32),
+            x86_operand_new_imm32(0)
+        ));
+        
+        if(state.reentrant) {
+            x86_builder_append_instr(&builder, x86_instr_new_mov(
+                x86_operand_new_reg64(REGEND),
+                x86_operand_new_reg64(REG64ARG2)
+            ));
+        } else {
+            x86_builder_append_instr(&builder, x86_instr_new_mov(
+                x86_operand_new_reg32(X86_REG_EBP),
+                x86_operand_new_imm32(30000)
+            ));
+        }
+    }
 
-    struct state state;
-    initialize_state(&state);   
     generate_code_recursive(&builder, &state, node);
     
+    if(state.reentrant) {
+        x86_builder_append_instr(&builder, x86_instr_new_mov(
+            x86_operand_new_reg32(REG32RETVAL),
+            x86_operand_new_imm32(X86_STATUS_SUCCESS)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_label(state.return_label));
+    }
+    
+    if(save_promotion_regs) {
+        x86_builder_append_instr(&builder, x86_instr_new_add(
+            x86_operand_new_reg64(X86_REG_RSP),
+            x86_operand_new_imm32(8)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_pop(
+            x86_operand_new_reg64(X86_REG_R15)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_pop(
+            x86_operand_new_reg64(X86_REG_R14)
+        ));
+        x86_builder_append_instr(&builder, x86_instr_new_pop(
+            x86_operand_new_reg64(X86_REG_R12)
+        ));
+    }
+    
     x86_builder_append_instr(&builder, x86_instr_new_pop(
         x86_operand_new_reg64(REGM)
     ));
@@ -335,12 +1662,26 @@ static struct x86_instr *generate_main(const struct node *node) {
         x86_operand_new_reg64(X86_REG_RBP)
     ));
     
-    x86_builder_append_instr(&builder, x86_instr_new_mov(
-        x86_operand_new_reg32(REG32RETVAL),
-        x86_operand_new_imm32(EXIT_SUCCESS)
-    ));
+    if(!state.reentrant) {
+        x86_builder_append_instr(&builder, x86_instr_new_mov(
+            x86_operand_new_reg32(REG32RETVAL),
+            x86_operand_new_imm32(EXIT_SUCCESS)
+        ));
+    }
     x86_builder_append_instr(&builder, x86_instr_new_ret());
     
+    if(state.outline_loops) {
+        generate_outlined_loops(&builder, &state);
+        x86_outline_free(&state.outline);
+    }
+    
+    generate_fail_calls(&builder, &state);
+    
+    if(x86_builder_get_first(&state.constants) != NULL) {
+        x86_builder_append_instr(&builder, x86_instr_new_align(state.vector_size));
+        x86_builder_append_tree(&builder, x86_builder_get_first(&state.constants));
+    }
+    
     return x86_builder_get_first(&builder);
 }
 
@@ -510,7 +1851,63 @@ static struct x86_instr *generate_check_input(void) {
     return x86_builder_get_first(&builder);
 }
 
-struct x86_function *generate_code_for_x86(const struct node *node) {
+static struct x86_function *append_function(
+    struct x86_function *current,
+    local_symbol symbol,
+    struct x86_instr *instrs
+) {
+    struct x86_function *next = x86_function_create(symbol, instrs);
+    current->next = next;
+    return next;
+}
+
+/* Static executables get their own entry point and failure functions, which
+ * make system calls, and the functions of the runtime they call. */
+static struct x86_function *generate_static_code(const struct node *node, const struct options *options) {
+    struct x86_function *head = x86_function_create(
+        LOCAL_START,
+        x86_runtime_generate_start()
+    );
+    
+    struct x86_function *current = append_function(head, LOCAL_MAIN, generate_main(node, options, false));
+    
+    if(tree_has_node_type(node, NODE_CHECK_RIGHT)) {
+        current = append_function(
+            current,
+            LOCAL_FAIL_TOO_FAR_RIGHT,
+            x86_runtime_generate_fail_too_far(LOCAL_MSG_RIGHT)
+        );
+    }
+    
+    if(tree_has_node_type(node, NODE_CHECK_LEFT)) {
+        current = append_function(
+            current,
+            LOCAL_FAIL_TOO_FAR_LEFT,
+            x86_runtime_generate_fail_too_far(LOCAL_MSG_LEFT)
+        );
+    }
+    
+    if(tree_has_node_type(node, NODE_IN)) {
+        current = append_function(current, LOCAL_CHECK_INPUT, x86_runtime_generate_check_input());
+        current = append_function(current, LOCAL_READ_BYTE, x86_runtime_generate_read_byte());
+    }
+    
+    if(tree_has_node_type(node, NODE_OUT)) {
+        current = append_function(current, LOCAL_WRITE_BYTE, x86_runtime_generate_write_byte());
+    }
+    
+    current = append_function(current, LOCAL_FLUSH_OUTPUT, x86_runtime_generate_flush_output());
+    current = append_function(current, LOCAL_EXIT_PROGRAM, x86_runtime_generate_exit_program());
+    append_function(current, LOCAL_WRITE_ERROR, x86_runtime_generate_write_error());
+    
+    return head;
+}
+
+struct x86_function *generate_code_for_x86(const struct node *node, const struct options *options) {
+    if(options->static_executable) {
+        return generate_static_code(node, options);
+    }
+    
     struct x86_function *head = x86_function_create(
         LOCAL_START,
         generate_start()
@@ -518,7 +1915,7 @@ struct x86_function *generate_code_for_x86(const struct node *node) {
 
     struct x86_function *current = x86_function_create(
         LOCAL_MAIN,
-        generate_main(node)
+        generate_main(node, options, false)
     );
     head->next = current;
 
@@ -551,3 +1948,7 @@ struct x86_function *generate_code_for_x86(const struct node *node) {
 
     return head;
 }
+
+struct x86_function *generate_reentrant_code_for_x86(const struct node *node, const struct options *options) {
+    return x86_function_create(LOCAL_MAIN, generate_main(node, options, true));
+}
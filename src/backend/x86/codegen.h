@@ -31,9 +31,46 @@
 #ifndef BFC_X86_CODEGEN_H
 #define BFC_X86_CODEGEN_H
 
+#include <stdio.h>
+#include "../../app/options.h"
 #include "../../ir/node.h"
 #include "function.h"
 
-struct x86_function *generate_code_for_x86(const struct node *node);
+/* Number of bytes that must be allocated past the end of the tape because
+ * vector instructions may access a whole window of cells starting at the last
+ * one. */
+#define X86_TAPE_PADDING 32
+
+/* Status returned by the main function of reentrant code. */
+typedef enum {
+    X86_STATUS_SUCCESS = 0,
+    X86_STATUS_TOO_FAR_RIGHT,
+    X86_STATUS_TOO_FAR_LEFT,
+    X86_STATUS_END_OF_INPUT,
+    X86_STATUS_INPUT_ERROR
+} x86_status;
+
+/* Input and output streams of a run of reentrant code. */
+struct x86_io_context {
+    FILE *input;
+    FILE *output;
+    /* Input already in memory, e.g. a mapping of the input file, which is
+     * read without a call before reading from the input stream. Both are
+     * NULL when there is none. */
+    const unsigned char *input_position;
+    const unsigned char *input_end;
+};
+
+struct x86_function *generate_code_for_x86(const struct node *node, const struct options *options);
+
+/* Generates only a main function, with no global state, for code that runs in
+ * process:
+ *
+ *      x86_status main(unsigned char *tape, size_t tape_size, struct x86_io_context *context);
+ *
+ * The tape must be zero-filled and followed by X86_TAPE_PADDING more bytes.
+ * Errors are returned instead of being reported, so several threads can run
+ * the same code at once, each with its own tape and context. */
+struct x86_function *generate_reentrant_code_for_x86(const struct node *node, const struct options *options);
 
 #endif
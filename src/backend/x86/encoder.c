@@ -36,8 +36,11 @@
 
 struct x86_encoder_function {
     uint64_t address;
+    size_t size;
     int num_labels;
     uint64_t *labels;
+    /* for each instruction, whether it is a jump that uses the long form */
+    bool *long_branches;
     const struct x86_instr *instrs;
 };
 
@@ -47,7 +50,11 @@ struct state {
     size_t length;
     const x86_encoder_function *func;
     const x86_encoder_context *ctx;
+    /* NULL if the relocations are not recorded */
+    x86_encoder_relocations *relocations;
     uint64_t address;
+    /* index of the instruction being encoded in the function */
+    size_t index;
 };
 
 static void update_state_address(struct state *state) {
@@ -66,6 +73,8 @@ static void initialize_state(
     state->length = 0;
     state->func = func;
     state->ctx = ctx;
+    state->relocations = NULL;
+    state->index = 0;
     update_state_address(state);
 }
 
@@ -82,6 +91,23 @@ static void write_byte(struct state *state, unsigned char byte) {
     ++state->length;
 }
 
+static void add_relocation(struct state *state, int symbol) {
+    x86_encoder_relocations *relocations = state->relocations;
+    
+    if(relocations == NULL || state->buf == NULL) {
+        return;
+    }
+    
+    if(relocations->count >= relocations->capacity) {
+        fprintf(stderr, "Error: relocation buffer overflow\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    relocations->entries[relocations->count].address = state->func->address + state->length;
+    relocations->entries[relocations->count].symbol = symbol;
+    ++relocations->count;
+}
+
 static void write_word(struct state *state, int value) {
     write_byte(state, (value >>  0) & 0xff);
     write_byte(state, (value >>  8) & 0xff);
@@ -100,12 +126,34 @@ static void write_word64(struct state *state, uint64_t value) {
     write_byte(state, (value >> 56) & 0xff);
 }
 
+/* Recommended multi-byte NOP encodings (nop, xchg ax, ax and the 0f 1f
+ * forms of nop with a memory operand), indexed by length minus one. Padding
+ * made of a few long NOPs takes fewer decode slots than one byte NOPs. */
+#define MAX_NOP_LENGTH 9
+
+static const unsigned char nops[MAX_NOP_LENGTH][MAX_NOP_LENGTH] = {
+    {0x90},
+    {0x66, 0x90},
+    {0x0f, 0x1f, 0x00},
+    {0x0f, 0x1f, 0x40, 0x00},
+    {0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}
+};
+
 static void encode_instr_align(struct state *state, const struct x86_instr *instr) {
-    uint64_t address = state->address;
+    int padding = (instr->n - (state->address & (instr->n - 1))) & (instr->n - 1);
     
-    while((address & (instr->n - 1)) != 0) {
-        write_byte(state, 0x90);    /* nop */
-        ++address;
+    while(padding > 0) {
+        int length = padding < MAX_NOP_LENGTH ? padding : MAX_NOP_LENGTH;
+        
+        for(int idx = 0; idx < length; ++idx) {
+            write_byte(state, nops[length - 1][idx]);
+        }
+        
+        padding -= length;
     }
 }
 
@@ -150,6 +198,8 @@ static int rel32(const struct state *state, const struct x86_operand *operand, u
     case X86_OPERAND_MEM64_LOCAL:
         return state->ctx->locals[operand->n] - address;
     case X86_OPERAND_LABEL:
+    case X86_OPERAND_MEM128_LABEL:
+    case X86_OPERAND_MEM256_LABEL:
         return state->func->labels[operand->n] - address;
     case X86_OPERAND_MEM64_REL:
         return operand->address - address;
@@ -159,6 +209,34 @@ static int rel32(const struct state *state, const struct x86_operand *operand, u
     }
 }
 
+static bool is_in_imm8_range(int value) {
+    return value >= -128 && value <= 127;
+}
+
+/* Memory operand with a base register and a displacement but no index
+ * register, e.g. [r13 + 42]. The displacement is always present, even if it is
+ * zero, because a base of rbp or r13 without displacement would instead mean
+ * RIP-relative or no base. */
+static void encode_base_disp(struct state *state, const struct x86_operand *mod_rm, int rreg) {
+    int r1 = mod_rm->r1 & 7;
+    int mod = is_in_imm8_range(mod_rm->n) ? 0x40 : 0x80;
+    
+    /* ModR/M byte */
+    write_byte(state, mod | (rreg << 3) | r1);
+    
+    if(r1 == 4) {
+        /* SIB byte: rsp and r12 can only be a base through a SIB byte */
+        write_byte(state, 0x24);
+    }
+    
+    /* displacement */
+    if(mod == 0x40) {
+        write_byte(state, mod_rm->n);
+    } else {
+        write_word(state, mod_rm->n);
+    }
+}
+
 static void encode_mod_rm_sib_disp(
     struct state *state,
     const struct x86_operand *mod_rm,
@@ -170,6 +248,13 @@ static void encode_mod_rm_sib_disp(
     
     switch(mod_rm->type) {
     case X86_OPERAND_MEM8_REG:
+    case X86_OPERAND_MEM128_REG:
+    case X86_OPERAND_MEM256_REG:
+    case X86_OPERAND_MEM64_REG:
+        if(mod_rm->r2 == X86_NO_INDEX) {
+            encode_base_disp(state, mod_rm, rreg);
+            break;
+        }
         /* ModR/M byte */
         write_byte(state, 0x84 | (rreg << 3));
         /* SIB byte */
@@ -190,6 +275,15 @@ static void encode_mod_rm_sib_disp(
         /* displacement - assumes opcode is a single byte */
         write_word(state, rel32(state, mod_rm, state->address + 6));
         break;
+    case X86_OPERAND_MEM128_LABEL:
+    case X86_OPERAND_MEM256_LABEL:
+        /* ModR/M byte */
+        write_byte(state, 0x05 | (rreg << 3));
+        /* displacement - assumes the instruction ends with it, which is the
+         * case for the SSE and AVX instructions that use these operand
+         * types */
+        write_word(state, rel32(state, mod_rm, state->func->address + state->length + 4));
+        break;
     default:
         /* ModR/M byte */
         write_byte(state, 0xc0 | (rreg << 3) | r1);
@@ -197,10 +291,6 @@ static void encode_mod_rm_sib_disp(
     }
 }
 
-static bool is_in_imm8_range(int value) {
-    return value >= -128 && value <= 127;
-}
-
 static void encode_alu_instr(
     struct state *state,
     int instr_num,
@@ -259,23 +349,67 @@ static void encode_instr_and(struct state *state, const struct x86_instr *instr)
 }
 
 static void encode_instr_call(struct state *state, const struct x86_instr *instr) {
-    write_byte(state, 0xe8);
-    write_word(state, rel32(state, instr->dst, state->address + 5));
+    if(instr->dst->type == X86_OPERAND_REG64) {
+        if(instr->dst->r1 > 7) {
+            /* REX.B */
+            write_byte(state, 0x41);
+        }
+        
+        write_byte(state, 0xff);
+        write_byte(state, 0xd0 | (instr->dst->r1 & 7));
+    } else {
+        write_byte(state, 0xe8);
+        
+        if(instr->dst->type == X86_OPERAND_EXTERN) {
+            add_relocation(state, instr->dst->n);
+        }
+        
+        write_word(state, rel32(state, instr->dst, state->address + 5));
+    }
 }
 
 static void encode_instr_cmp(struct state *state, const struct x86_instr *instr) {
     encode_alu_instr(state, 7, instr->dst, instr->src);
 }
 
-static void encode_instr_jl(struct state *state, const struct x86_instr *instr) {
+static void encode_instr_dq(struct state *state, const struct x86_instr *instr) {
+    write_word64(state, instr->dst->address);
+    write_word64(state, instr->src->address);
+}
+
+static void encode_instr_imul(struct state *state, const struct x86_instr *instr) {
+    encode_rex_prefix_for_mod_rm(state, instr->src, instr->dst->r1);
+    write_byte(state, 0x0f);
+    write_byte(state, 0xaf);
+    encode_mod_rm_sib_disp(state, instr->src, instr->dst->r1);
+}
+
+/* The form of each jump is decided once by resolve_labels() since the label
+ * addresses depend on it. */
+/* Only jumps to labels are relaxed. A jump to a symbol always has the long
+ * form, whatever the distance, so its displacement can be patched later. */
+static bool is_short_branch(const struct state *state, const struct x86_instr *instr, int rel8) {
+    if(instr->dst->type != X86_OPERAND_LABEL || state->func->long_branches[state->index]) {
+        return false;
+    }
+    
+    if(!is_in_imm8_range(rel8)) {
+        fprintf(stderr, "Error: jump target out of range for the short form\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return true;
+}
+
+static void encode_instr_jge(struct state *state, const struct x86_instr *instr) {
     int rel8 = rel32(state, instr->dst, state->address + 2);
     
-    if(is_in_imm8_range(rel8)) {
-        write_byte(state, 0x7c);
+    if(is_short_branch(state, instr, rel8)) {
+        write_byte(state, 0x7d);
         write_byte(state, rel8);
     } else {
         write_byte(state, 0x0f);
-        write_byte(state, 0x8c);
+        write_byte(state, 0x8d);
         write_word(state, rel32(state, instr->dst, state->address + 6));
     }
 }
@@ -287,38 +421,38 @@ static void encode_instr_jmp(struct state *state, const struct x86_instr *instr)
     } else {
         int rel8 = rel32(state, instr->dst, state->address + 2);
         
-        if(is_in_imm8_range(rel8)) {
+        if(is_short_branch(state, instr, rel8)) {
             write_byte(state, 0xeb);
             write_byte(state, rel8);
-        } else {        
+        } else {
             write_byte(state, 0xe9);
             write_word(state, rel32(state, instr->dst, state->address + 5));
         }
     }
 }
 
-static void encode_instr_jns(struct state *state, const struct x86_instr *instr) {
+static void encode_instr_jnz(struct state *state, const struct x86_instr *instr) {
     int rel8 = rel32(state, instr->dst, state->address + 2);
-
-    if(is_in_imm8_range(rel8)) {
-        write_byte(state, 0x79);
+    
+    if(is_short_branch(state, instr, rel8)) {
+        write_byte(state, 0x75);
         write_byte(state, rel8);
-    } else {    
+    } else {
         write_byte(state, 0x0f);
-        write_byte(state, 0x89);
+        write_byte(state, 0x85);
         write_word(state, rel32(state, instr->dst, state->address + 6));
     }
 }
 
-static void encode_instr_jnz(struct state *state, const struct x86_instr *instr) {
+static void encode_instr_js(struct state *state, const struct x86_instr *instr) {
     int rel8 = rel32(state, instr->dst, state->address + 2);
     
-    if(is_in_imm8_range(rel8)) {
-        write_byte(state, 0x75);
+    if(is_short_branch(state, instr, rel8)) {
+        write_byte(state, 0x78);
         write_byte(state, rel8);
     } else {
         write_byte(state, 0x0f);
-        write_byte(state, 0x85);
+        write_byte(state, 0x88);
         write_word(state, rel32(state, instr->dst, state->address + 6));
     }
 }
@@ -326,7 +460,7 @@ static void encode_instr_jnz(struct state *state, const struct x86_instr *instr)
 static void encode_instr_jz(struct state *state, const struct x86_instr *instr) {
     int rel8 = rel32(state, instr->dst, state->address + 2);
     
-    if(is_in_imm8_range(rel8)) {
+    if(is_short_branch(state, instr, rel8)) {
         write_byte(state, 0x74);
         write_byte(state, rel8);
     } else {
@@ -336,6 +470,31 @@ static void encode_instr_jz(struct state *state, const struct x86_instr *instr)
     }
 }
 
+static void encode_instr_lea(struct state *state, const struct x86_instr *instr) {
+    /* REX.W is set since the destination is a 64-bit register, which
+     * encode_rex_prefix_for_mod_rm() cannot know from the memory operand */
+    int prefix = 0x48;
+    
+    if(instr->dst->r1 > 7) {
+        /* REX.R */
+        prefix |= 4;
+    }
+    
+    if(instr->src->r2 > 7) {
+        /* REX.X */
+        prefix |= 2;
+    }
+    
+    if(instr->src->r1 > 7) {
+        /* REX.B */
+        prefix |= 1;
+    }
+    
+    write_byte(state, prefix);
+    write_byte(state, 0x8d);
+    encode_mod_rm_sib_disp(state, instr->src, instr->dst->r1);
+}
+
 static void encode_instr_mov(struct state *state, const struct x86_instr *instr) {
     switch(instr->dst->type) {
     case X86_OPERAND_MEM8_REG:
@@ -357,10 +516,22 @@ static void encode_instr_mov(struct state *state, const struct x86_instr *instr)
             break;
         }
         break;
+    case X86_OPERAND_MEM64_LOCAL:
+    case X86_OPERAND_MEM64_REG:
+        encode_rex_prefix_for_mod_rm(state, instr->dst, instr->src->r1);
+        write_byte(state, 0x89);
+        encode_mod_rm_sib_disp(state, instr->dst, instr->src->r1);
+        break;
     case X86_OPERAND_REG8:
-        encode_rex_prefix_for_mod_rm(state, instr->src, instr->dst->r1);
-        write_byte(state, 0x8a);
-        encode_mod_rm_sib_disp(state, instr->src, instr->dst->r1);
+        if(instr->src->type == X86_OPERAND_IMM8) {
+            encode_rex_prefix_for_mod_rm(state, instr->dst, 0);
+            write_byte(state, 0xb0 | (instr->dst->r1 & 7));
+            write_byte(state, instr->src->n);
+        } else {
+            encode_rex_prefix_for_mod_rm(state, instr->src, instr->dst->r1);
+            write_byte(state, 0x8a);
+            encode_mod_rm_sib_disp(state, instr->src, instr->dst->r1);
+        }
         break;
     case X86_OPERAND_REG32:
     case X86_OPERAND_REG64:
@@ -376,6 +547,11 @@ static void encode_instr_mov(struct state *state, const struct x86_instr *instr)
                 write_word(state, instr->src->n);
             }
             break;
+        case X86_OPERAND_IMM64:
+            encode_rex_prefix_for_mod_rm(state, instr->dst, 0);
+            write_byte(state, 0xb8 | (instr->dst->r1 & 7));
+            write_word64(state, instr->src->address);
+            break;
         case X86_OPERAND_LABEL:
             encode_rex_prefix_for_mod_rm(state, instr->dst, 0);
             write_byte(state, 0xb8 | (instr->dst->r1 & 7));
@@ -393,6 +569,7 @@ static void encode_instr_mov(struct state *state, const struct x86_instr *instr)
             break;
         case X86_OPERAND_MEM64_EXTERN:
         case X86_OPERAND_MEM64_LOCAL:
+        case X86_OPERAND_MEM64_REG:
             encode_rex_prefix_for_mod_rm(state, instr->src, instr->dst->r1);
             write_byte(state, 0x8b);
             encode_mod_rm_sib_disp(state, instr->src, instr->dst->r1);
@@ -416,6 +593,35 @@ static void encode_instr_mov(struct state *state, const struct x86_instr *instr)
     }
 }
 
+/* SSE instructions: the mandatory prefix comes before the REX prefix, then
+ * the two-byte opcode. */
+static void encode_sse_instr(
+    struct state *state,
+    int prefix,
+    int opcode,
+    const struct x86_operand *mod_rm,
+    int reg
+) {
+    write_byte(state, prefix);
+    encode_rex_prefix_for_mod_rm(state, mod_rm, reg);
+    write_byte(state, 0x0f);
+    write_byte(state, opcode);
+    encode_mod_rm_sib_disp(state, mod_rm, reg);
+}
+
+static void encode_instr_movdqu(struct state *state, const struct x86_instr *instr) {
+    if(instr->dst->type == X86_OPERAND_XMM) {
+        encode_sse_instr(state, 0xf3, 0x6f, instr->src, instr->dst->r1);
+    } else {
+        encode_sse_instr(state, 0xf3, 0x7f, instr->dst, instr->src->r1);
+    }
+}
+
+static void encode_instr_movq(struct state *state, const struct x86_instr *instr) {
+    /* REX.W is set since the source is a 64-bit register */
+    encode_sse_instr(state, 0x66, 0x6e, instr->src, instr->dst->r1);
+}
+
 static void encode_instr_movzx(struct state *state, const struct x86_instr *instr) {
     encode_rex_prefix_for_mod_rm(state, instr->src, instr->dst->r1);
     write_byte(state, 0x0f);
@@ -427,6 +633,14 @@ static void encode_instr_or(struct state *state, const struct x86_instr *instr)
     encode_alu_instr(state, 1, instr->dst, instr->src);
 }
 
+static void encode_instr_paddb(struct state *state, const struct x86_instr *instr) {
+    encode_sse_instr(state, 0x66, 0xfc, instr->src, instr->dst->r1);
+}
+
+static void encode_instr_pand(struct state *state, const struct x86_instr *instr) {
+    encode_sse_instr(state, 0x66, 0xdb, instr->src, instr->dst->r1);
+}
+
 static void encode_instr_pop(struct state *state, const struct x86_instr *instr) {
     if(instr->dst->r1 > 7) {
         /* REX.B */
@@ -437,6 +651,10 @@ static void encode_instr_pop(struct state *state, const struct x86_instr *instr)
     write_byte(state, 0x58 | r);
 }
 
+static void encode_instr_punpcklqdq(struct state *state, const struct x86_instr *instr) {
+    encode_sse_instr(state, 0x66, 0x6c, instr->src, instr->dst->r1);
+}
+
 static void encode_instr_push(struct state *state, const struct x86_instr *instr) {
     if(instr->src->type == X86_OPERAND_MEM64_REL) {
         write_byte(state, 0xff);
@@ -464,6 +682,106 @@ static void encode_instr_segfault(struct state *state, const struct x86_instr *i
     write_byte(state, 0xf4);
 }
 
+static void encode_instr_sub(struct state *state, const struct x86_instr *instr) {
+    encode_alu_instr(state, 5, instr->dst, instr->src);
+}
+
+static void encode_instr_syscall(struct state *state, const struct x86_instr *instr) {
+    write_byte(state, 0x0f);
+    write_byte(state, 0x05);
+}
+
+/* VEX prefixes, used by AVX instructions, replace the mandatory prefix, the
+ * REX prefix and the opcode escape bytes. The three-byte form is always used
+ * since it can encode any combination of registers and of W. */
+#define VEX_PP_66       1
+#define VEX_PP_F3       2
+#define VEX_MAP_0F      1
+#define VEX_MAP_0F38    2
+
+/* Vector length (VEX.L): 256 bits if any of the operands is a ymm register or
+ * a 256-bit memory location, 128 bits otherwise. */
+static int vex_length(const struct x86_instr *instr) {
+    const struct x86_operand *operands[] = {instr->dst, instr->src};
+    
+    for(int idx = 0; idx < 2; ++idx) {
+        switch(operands[idx]->type) {
+        case X86_OPERAND_YMM:
+        case X86_OPERAND_MEM256_LABEL:
+        case X86_OPERAND_MEM256_REG:
+            return 1;
+        default:
+            break;
+        }
+    }
+    
+    return 0;
+}
+
+static void encode_vex_instr(
+    struct state *state,
+    const struct x86_instr *instr,
+    int pp,
+    int map,
+    int w,
+    int opcode,
+    const struct x86_operand *mod_rm,
+    int reg,
+    int vvvv
+) {
+    /* R, X and B are stored inverted */
+    int byte1 = map;
+    
+    if(reg <= 7) {
+        byte1 |= 0x80;
+    }
+    
+    if(mod_rm->r2 <= 7) {
+        byte1 |= 0x40;
+    }
+    
+    if(mod_rm->r1 <= 7) {
+        byte1 |= 0x20;
+    }
+    
+    write_byte(state, 0xc4);
+    write_byte(state, byte1);
+    /* W, vvvv (inverted, all ones if unused), L, pp */
+    write_byte(state, (w << 7) | ((~vvvv & 0xf) << 3) | (vex_length(instr) << 2) | pp);
+    write_byte(state, opcode);
+    encode_mod_rm_sib_disp(state, mod_rm, reg);
+}
+
+static void encode_instr_vmovdqu(struct state *state, const struct x86_instr *instr) {
+    if(x86_operand_is_register(instr->dst)) {
+        encode_vex_instr(state, instr, VEX_PP_F3, VEX_MAP_0F, 0, 0x6f, instr->src, instr->dst->r1, 0);
+    } else {
+        encode_vex_instr(state, instr, VEX_PP_F3, VEX_MAP_0F, 0, 0x7f, instr->dst, instr->src->r1, 0);
+    }
+}
+
+static void encode_instr_vmovq(struct state *state, const struct x86_instr *instr) {
+    encode_vex_instr(state, instr, VEX_PP_66, VEX_MAP_0F, 1, 0x6e, instr->src, instr->dst->r1, 0);
+}
+
+static void encode_instr_vpaddb(struct state *state, const struct x86_instr *instr) {
+    encode_vex_instr(state, instr, VEX_PP_66, VEX_MAP_0F, 0, 0xfc, instr->src, instr->dst->r1, instr->dst->r1);
+}
+
+static void encode_instr_vpand(struct state *state, const struct x86_instr *instr) {
+    encode_vex_instr(state, instr, VEX_PP_66, VEX_MAP_0F, 0, 0xdb, instr->src, instr->dst->r1, instr->dst->r1);
+}
+
+static void encode_instr_vpbroadcastb(struct state *state, const struct x86_instr *instr) {
+    encode_vex_instr(state, instr, VEX_PP_66, VEX_MAP_0F38, 0, 0x78, instr->src, instr->dst->r1, 0);
+}
+
+static void encode_instr_vzeroupper(struct state *state, const struct x86_instr *instr) {
+    write_byte(state, 0xc5);
+    write_byte(state, 0xf8);
+    write_byte(state, 0x77);
+}
+
 static void x86_encode_instruction(
     struct state *state,
     const struct x86_instr *instr
@@ -484,36 +802,60 @@ static void x86_encode_instruction(
     case X86_INSTR_CMP:
         encode_instr_cmp(state, instr);
         break;
-    case X86_INSTR_JL:
-        encode_instr_jl(state, instr);
+    case X86_INSTR_DQ:
+        encode_instr_dq(state, instr);
+        break;
+    case X86_INSTR_IMUL:
+        encode_instr_imul(state, instr);
+        break;
+    case X86_INSTR_JGE:
+        encode_instr_jge(state, instr);
         break;
     case X86_INSTR_JMP:
         encode_instr_jmp(state, instr);
         break;
-    case X86_INSTR_JNS:
-        encode_instr_jns(state, instr);
-        break;
     case X86_INSTR_JNZ:
         encode_instr_jnz(state, instr);
         break;
+    case X86_INSTR_JS:
+        encode_instr_js(state, instr);
+        break;
     case X86_INSTR_JZ:
         encode_instr_jz(state, instr);
         break;
     case X86_INSTR_LABEL:
         /* nothing to encode */
         break;
+    case X86_INSTR_LEA:
+        encode_instr_lea(state, instr);
+        break;
     case X86_INSTR_MOV:
         encode_instr_mov(state, instr);
         break;
+    case X86_INSTR_MOVDQU:
+        encode_instr_movdqu(state, instr);
+        break;
+    case X86_INSTR_MOVQ:
+        encode_instr_movq(state, instr);
+        break;
     case X86_INSTR_MOVZX:
         encode_instr_movzx(state, instr);
         break;
     case X86_INSTR_OR:
         encode_instr_or(state, instr);
         break;
+    case X86_INSTR_PADDB:
+        encode_instr_paddb(state, instr);
+        break;
+    case X86_INSTR_PAND:
+        encode_instr_pand(state, instr);
+        break;
     case X86_INSTR_POP:
         encode_instr_pop(state, instr);
         break;
+    case X86_INSTR_PUNPCKLQDQ:
+        encode_instr_punpcklqdq(state, instr);
+        break;
     case X86_INSTR_PUSH:
         encode_instr_push(state, instr);
         break;
@@ -523,9 +865,34 @@ static void x86_encode_instruction(
     case X86_INSTR_SEGFAULT:
         encode_instr_segfault(state, instr);
         break;
+    case X86_INSTR_SUB:
+        encode_instr_sub(state, instr);
+        break;
+    case X86_INSTR_SYSCALL:
+        encode_instr_syscall(state, instr);
+        break;
+    case X86_INSTR_VMOVDQU:
+        encode_instr_vmovdqu(state, instr);
+        break;
+    case X86_INSTR_VMOVQ:
+        encode_instr_vmovq(state, instr);
+        break;
+    case X86_INSTR_VPADDB:
+        encode_instr_vpaddb(state, instr);
+        break;
+    case X86_INSTR_VPAND:
+        encode_instr_vpand(state, instr);
+        break;
+    case X86_INSTR_VPBROADCASTB:
+        encode_instr_vpbroadcastb(state, instr);
+        break;
+    case X86_INSTR_VZEROUPPER:
+        encode_instr_vzeroupper(state, instr);
+        break;
     }
     
     update_state_address(state);
+    ++state->index;
 }
 
 static size_t count_labels(const struct x86_instr *instrs) {
@@ -540,52 +907,263 @@ static size_t count_labels(const struct x86_instr *instrs) {
     return num_labels;
 }
 
-static void resolve_labels(x86_encoder_function *func) {
-    memset(func->labels, 0, func->num_labels * sizeof(uint64_t));
+static size_t count_instructions(const struct x86_instr *instrs) {
+    size_t num_instrs = 0;
+    
+    for(const struct x86_instr *instr = instrs; instr != NULL; instr = instr->next) {
+        ++num_instrs;
+    }
+    
+    return num_instrs;
+}
+
+static void *allocate_array(size_t count, size_t size) {
+    /* never ask malloc() for zero bytes so NULL always means failure */
+    void *array = malloc(count > 0 ? count * size : 1);
+    
+    if(array == NULL) {
+        fprintf(stderr, "Error: memory allocation (x86 encoder)\n");
+        exit(EXIT_FAILURE);
+    }
     
+    return array;
+}
+
+static bool is_relaxable_branch(const struct x86_instr *instr) {
+    switch(instr->op) {
+    case X86_INSTR_JGE:
+    case X86_INSTR_JMP:
+    case X86_INSTR_JNZ:
+    case X86_INSTR_JS:
+    case X86_INSTR_JZ:
+        return instr->dst->type == X86_OPERAND_LABEL;
+    default:
+        return false;
+    }
+}
+
+static int long_branch_size(const struct x86_instr *instr) {
+    return instr->op == X86_INSTR_JMP ? 5 : 6;
+}
+
+static bool is_label_operand(const struct x86_operand *operand) {
+    if(operand == NULL) {
+        return false;
+    }
+    
+    switch(operand->type) {
+    case X86_OPERAND_LABEL:
+    case X86_OPERAND_MEM128_LABEL:
+    case X86_OPERAND_MEM256_LABEL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void check_label_operand(const struct x86_operand *operand, const int *label_index, int num_labels) {
+    if(is_label_operand(operand) && (operand->n >= num_labels || label_index[operand->n] < 0)) {
+        fprintf(stderr, "Error: instruction operand references undefined label (index %d)\n", operand->n);
+        exit(EXIT_FAILURE);
+    }
+}
+
+struct relaxation {
+    const struct x86_instr **instrs;
+    size_t num_instrs;
+    /* size of each instruction, with the short form for jumps that have not
+     * been found to need the long form yet and the largest possible padding
+     * for alignment directives */
+    unsigned char *sizes;
+    /* index of the label instruction of each label */
+    int *label_index;
+    bool *long_branches;
+    /* jumps whose displacement may have changed since they were last checked */
+    size_t *worklist;
+    size_t worklist_length;
+    bool *queued;
+};
+
+/* Largest displacement, in either direction, that is worth tracking: any
+ * jump that spans more than that needs the long form. */
+#define SHORT_BRANCH_REACH 128
+
+static void queue_branch(struct relaxation *relax, size_t index) {
+    if(relax->queued[index] || relax->long_branches[index]) {
+        return;
+    }
+    relax->queued[index] = true;
+    relax->worklist[relax->worklist_length++] = index;
+}
+
+/* Checks whether the displacement of the jump at the specified index, in its
+ * short form, fits in a signed byte. Only the instructions between the jump
+ * and its target are visited, and no more than SHORT_BRANCH_REACH bytes of
+ * them. */
+static bool short_branch_fits(const struct relaxation *relax, size_t index) {
+    const struct x86_instr *instr = relax->instrs[index];
+    size_t target = relax->label_index[instr->dst->n];
+    int distance = 0;
+    
+    if(target > index) {
+        /* forward: from the end of the jump to the label */
+        for(size_t idx = index + 1; idx < target; ++idx) {
+            distance += relax->sizes[idx];
+            
+            if(distance > SHORT_BRANCH_REACH - 1) {
+                return false;
+            }
+        }
+    } else {
+        /* backward: from the label to the end of the jump, included */
+        for(size_t idx = target; idx <= index; ++idx) {
+            distance += relax->sizes[idx];
+            
+            if(distance > SHORT_BRANCH_REACH) {
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+/* After the jump at the specified index grows, queues the short jumps whose
+ * span includes it. These are all within SHORT_BRANCH_REACH bytes of it since
+ * the others already need the long form. */
+static void queue_spanning_branches(struct relaxation *relax, size_t index) {
+    int distance = 0;
+    
+    for(size_t idx = index; idx > 0 && distance <= SHORT_BRANCH_REACH; --idx) {
+        const struct x86_instr *instr = relax->instrs[idx - 1];
+        
+        if(is_relaxable_branch(instr) && (size_t)relax->label_index[instr->dst->n] > index) {
+            queue_branch(relax, idx - 1);
+        }
+        distance += relax->sizes[idx - 1];
+    }
+    
+    distance = 0;
+    
+    for(size_t idx = index + 1; idx < relax->num_instrs && distance <= SHORT_BRANCH_REACH; ++idx) {
+        const struct x86_instr *instr = relax->instrs[idx];
+        
+        if(is_relaxable_branch(instr) && (size_t)relax->label_index[instr->dst->n] <= index) {
+            queue_branch(relax, idx);
+        }
+        distance += relax->sizes[idx];
+    }
+}
+
+static int alignment_padding(uint64_t address, int alignment) {
+    return (alignment - (address & (alignment - 1))) & (alignment - 1);
+}
+
+static void resolve_labels(x86_encoder_function *func) {
     /* There are two forms for encoding jump/branch instructions with an immediate
      * value: a two-byte form with an 8-bit immediate value and a 5 or 6-byte
      * form with a 32-bit immediate value. We use the two-byte form wherever we
      * can and the longer form when the target is out of range for an 8-bit value.
-     * 
+     *
      * Changing the form of a jump instruction changes the address of the labels
-     * that follow that instruction. In turn, these address changes may change
-     * the form of other jump instructions for which the target label was out of
-     * range but is now in range. For this reason, we re-compute the label
-     * addresses in a loop until they don't change anymore. */
-    while(true) {
-        x86_encoder_context dummy_context;
+     * that follow that instruction. In turn, these address changes may put
+     * other jump instructions out of range. We start with the short form for
+     * all jumps and switch a jump to the long form when its displacement does
+     * not fit, which is never undone. When a jump grows, only the short jumps
+     * whose span includes it are checked again, so the whole instruction list
+     * is only encoded once, to find the size of the other instructions.
+     *
+     * The size of alignment padding depends on the address, so it is counted
+     * as its largest possible value while choosing the forms. The actual
+     * padding can only be smaller, which brings targets closer. */
+    struct relaxation relax;
+    relax.num_instrs = count_instructions(func->instrs);
+    relax.instrs = allocate_array(relax.num_instrs, sizeof(relax.instrs[0]));
+    relax.sizes = allocate_array(relax.num_instrs, sizeof(relax.sizes[0]));
+    relax.label_index = allocate_array(func->num_labels, sizeof(relax.label_index[0]));
+    relax.long_branches = allocate_array(relax.num_instrs, sizeof(relax.long_branches[0]));
+    relax.worklist = allocate_array(relax.num_instrs, sizeof(relax.worklist[0]));
+    relax.worklist_length = 0;
+    relax.queued = allocate_array(relax.num_instrs, sizeof(relax.queued[0]));
+    
+    for(int idx = 0; idx < func->num_labels; ++idx) {
+        relax.label_index[idx] = -1;
+    }
+    
+    x86_encoder_context dummy_context;
+    
+    struct state state;
+    initialize_state(&state, NULL, 0, func, &dummy_context);
     
-        struct state state;
-        initialize_state(&state, NULL, 0, func, &dummy_context);
+    size_t index = 0;
     
-        bool nochange = true;
+    for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
+        relax.instrs[index] = instr;
+        relax.long_branches[index] = false;
+        relax.queued[index] = false;
         
-        for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
-            if(instr->op == X86_INSTR_LABEL && func->labels[instr->dst->n] != state.address) {
-                func->labels[instr->dst->n] = state.address;
-                nochange = false;
-            }
-            
+        if(instr->op == X86_INSTR_LABEL) {
+            relax.label_index[instr->dst->n] = index;
+            relax.sizes[index] = 0;
+        } else if(instr->op == X86_INSTR_ALIGN) {
+            relax.sizes[index] = instr->n - 1;
+        } else if(is_relaxable_branch(instr)) {
+            relax.sizes[index] = 2;
+        } else {
+            size_t length = state.length;
             x86_encode_instruction(&state, instr);
+            relax.sizes[index] = state.length - length;
         }
         
-        if(nochange) {
-            break;
+        ++index;
+    }
+    
+    for(index = 0; index < relax.num_instrs; ++index) {
+        check_label_operand(relax.instrs[index]->dst, relax.label_index, func->num_labels);
+        check_label_operand(relax.instrs[index]->src, relax.label_index, func->num_labels);
+        
+        if(is_relaxable_branch(relax.instrs[index])) {
+            queue_branch(&relax, index);
         }
-    };
+    }
     
-    for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
-        if(instr->dst != NULL && instr->dst->type == X86_OPERAND_LABEL && func->labels[instr->dst->n] == 0) {
-            fprintf(stderr, "Error: instruction destination operand references undefined label (index %d)\n", instr->dst->n);
-            exit(EXIT_FAILURE); 
+    while(relax.worklist_length > 0) {
+        index = relax.worklist[--relax.worklist_length];
+        relax.queued[index] = false;
+        
+        if(short_branch_fits(&relax, index)) {
+            continue;
         }
         
-        if(instr->src != NULL && instr->src->type == X86_OPERAND_LABEL && func->labels[instr->src->n] == 0) {
-            fprintf(stderr, "Error: instruction source operand references undefined label (index %d)\n", instr->dst->n);
-            exit(EXIT_FAILURE); 
+        relax.long_branches[index] = true;
+        relax.sizes[index] = long_branch_size(relax.instrs[index]);
+        queue_spanning_branches(&relax, index);
+    }
+    
+    /* Now that the forms are final, a single pass gives the label addresses
+     * and the size of the function. */
+    uint64_t address = func->address;
+    
+    for(index = 0; index < relax.num_instrs; ++index) {
+        const struct x86_instr *instr = relax.instrs[index];
+        
+        if(instr->op == X86_INSTR_LABEL) {
+            func->labels[instr->dst->n] = address;
+        } else if(instr->op == X86_INSTR_ALIGN) {
+            address += alignment_padding(address, instr->n);
+        } else {
+            address += relax.sizes[index];
         }
-    }    
+    }
+    
+    func->size = address - func->address;
+    func->long_branches = relax.long_branches;
+    
+    free(relax.instrs);
+    free(relax.sizes);
+    free(relax.label_index);
+    free(relax.worklist);
+    free(relax.queued);
 }
 
 x86_encoder_function *x86_encoder_function_create(struct x86_instr *instrs, uint64_t address) {
@@ -599,18 +1177,7 @@ x86_encoder_function *x86_encoder_function_create(struct x86_instr *instrs, uint
     func->instrs = instrs;
     func->address = address;
     func->num_labels = count_labels(instrs);
-    
-    if(func->num_labels == 0) {
-        func->labels = NULL;
-        return func;
-    }
-    
-    func->labels = malloc(func->num_labels * sizeof(uint64_t));
-    
-    if(func->labels == NULL) {
-        fprintf(stderr, "Error: memory allocation (label array for x86 encoder)\n");
-        exit(EXIT_FAILURE);
-    }
+    func->labels = allocate_array(func->num_labels, sizeof(uint64_t));
     
     resolve_labels(func);
     
@@ -620,6 +1187,7 @@ x86_encoder_function *x86_encoder_function_create(struct x86_instr *instrs, uint
 void x86_encoder_function_free(x86_encoder_function *func) {
     if(func != NULL) {
         free(func->labels);
+        free(func->long_branches);
     }
     
     free(func);
@@ -638,8 +1206,7 @@ void x86_encoder_context_set_local(x86_encoder_context *ctx, int symbol, uint64_
 }
 
 size_t x86_encoder_compute_function_size(const x86_encoder_function *func) {
-    x86_encoder_context dummy_context;
-    return encode_for_x86(NULL, 0, func, &dummy_context);
+    return func->size;
 }
 
 size_t encode_for_x86(
@@ -647,9 +1214,20 @@ size_t encode_for_x86(
     size_t bufsize,
     const x86_encoder_function *func,
     x86_encoder_context *ctx
+) {
+    return encode_for_x86_with_relocations(buf, bufsize, func, ctx, NULL);
+}
+
+size_t encode_for_x86_with_relocations(
+    unsigned char *buf,
+    size_t bufsize,
+    const x86_encoder_function *func,
+    x86_encoder_context *ctx,
+    x86_encoder_relocations *relocations
 ) {
     struct state state;
     initialize_state(&state, buf, bufsize, func, ctx);
+    state.relocations = relocations;
     
     for(const struct x86_instr *instr = func->instrs; instr != NULL; instr = instr->next) {
         x86_encode_instruction(&state, instr);
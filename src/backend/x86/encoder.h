@@ -42,6 +42,19 @@ typedef struct {
     uint64_t externs[NUM_EXTERN_SYMBOLS];
 } x86_encoder_context;
 
+/* Position of the 32-bit displacement of a call to an external function in
+ * encoded code, which has to be patched if the code is moved. */
+typedef struct {
+    uint64_t address;
+    int symbol;
+} x86_encoder_relocation;
+
+typedef struct {
+    x86_encoder_relocation *entries;
+    size_t count;
+    size_t capacity;
+} x86_encoder_relocations;
+
 x86_encoder_function *x86_encoder_function_create(struct x86_instr *instrs, uint64_t address);
 
 void x86_encoder_function_free(x86_encoder_function *func);
@@ -61,4 +74,14 @@ size_t encode_for_x86(
     x86_encoder_context *ctx
 );
 
+/* Same as encode_for_x86(), and also appends the relocations of the code to
+ * the specified list, which must have room for them. */
+size_t encode_for_x86_with_relocations(
+    unsigned char *buf,
+    size_t bufsize,
+    const x86_encoder_function *func,
+    x86_encoder_context *ctx,
+    x86_encoder_relocations *relocations
+);
+
 #endif
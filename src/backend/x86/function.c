@@ -47,11 +47,9 @@ struct x86_function *x86_function_create(local_symbol symbol, struct x86_instr *
     return func;
 }
 
+/* The instructions belong to the arena they were allocated from (see
+ * arena.h), only the function itself is freed. */
 void x86_function_free(struct x86_function *func) {
-    if(func != NULL) {
-        x86_instr_free_tree(func->instrs);
-    }
-    
     free(func);
 }
 
@@ -30,7 +30,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
+#include "arena.h"
 #include "isa.h"
 
 char *x86_reg8_names[] = {
@@ -90,15 +90,46 @@ char *x86_reg64_names[] = {
     [X86_REG_R15] = "r15"
 };
 
+char *x86_xmm_names[] = {
+    [X86_REG_XMM0] = "xmm0",
+    [X86_REG_XMM1] = "xmm1",
+    [X86_REG_XMM2] = "xmm2",
+    [X86_REG_XMM3] = "xmm3",
+    [X86_REG_XMM4] = "xmm4",
+    [X86_REG_XMM5] = "xmm5",
+    [X86_REG_XMM6] = "xmm6",
+    [X86_REG_XMM7] = "xmm7",
+    [X86_REG_XMM8] = "xmm8",
+    [X86_REG_XMM9] = "xmm9",
+    [X86_REG_XMM10] = "xmm10",
+    [X86_REG_XMM11] = "xmm11",
+    [X86_REG_XMM12] = "xmm12",
+    [X86_REG_XMM13] = "xmm13",
+    [X86_REG_XMM14] = "xmm14",
+    [X86_REG_XMM15] = "xmm15"
+};
+
+char *x86_ymm_names[] = {
+    [X86_REG_XMM0] = "ymm0",
+    [X86_REG_XMM1] = "ymm1",
+    [X86_REG_XMM2] = "ymm2",
+    [X86_REG_XMM3] = "ymm3",
+    [X86_REG_XMM4] = "ymm4",
+    [X86_REG_XMM5] = "ymm5",
+    [X86_REG_XMM6] = "ymm6",
+    [X86_REG_XMM7] = "ymm7",
+    [X86_REG_XMM8] = "ymm8",
+    [X86_REG_XMM9] = "ymm9",
+    [X86_REG_XMM10] = "ymm10",
+    [X86_REG_XMM11] = "ymm11",
+    [X86_REG_XMM12] = "ymm12",
+    [X86_REG_XMM13] = "ymm13",
+    [X86_REG_XMM14] = "ymm14",
+    [X86_REG_XMM15] = "ymm15"
+};
+
 static struct x86_operand *oper_new(x86_operand_type type) {
-    struct x86_operand *operand = malloc(sizeof(struct x86_operand));
-    
-    if(operand == NULL) {
-        fprintf(stderr, "Error: memory allocation (operand)\n");
-        exit(EXIT_FAILURE);
-    }
-    
-    memset(operand, 0, sizeof(struct x86_operand));
+    struct x86_operand *operand = x86_arena_allocate(sizeof(struct x86_operand));
     
     operand->type = type;
     
@@ -123,6 +154,12 @@ struct x86_operand *x86_operand_new_imm32(int n) {
     return operand;
 }
 
+struct x86_operand *x86_operand_new_imm64(uint64_t value) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_IMM64);
+    operand->address = value;
+    return operand;
+}
+
 struct x86_operand *x86_operand_new_label(int n) {
     struct x86_operand *operand = oper_new(X86_OPERAND_LABEL);
     operand->n = n;
@@ -143,6 +180,58 @@ struct x86_operand *x86_operand_new_mem8_reg(x86_reg64 r1, x86_reg64 r2, int n)
     return operand;
 }
 
+struct x86_operand *x86_operand_new_mem8_base(x86_reg64 r1, int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM8_REG);
+    operand->r1 = r1;
+    operand->r2 = X86_NO_INDEX;
+    operand->n = n;
+    return operand;
+}
+
+struct x86_operand *x86_operand_new_mem128_label(int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM128_LABEL);
+    operand->n = n;
+    return operand;
+}
+
+struct x86_operand *x86_operand_new_mem128_reg(x86_reg64 r1, x86_reg64 r2, int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM128_REG);
+    operand->r1 = r1;
+    operand->r2 = r2;
+    operand->n = n;
+    return operand;
+}
+
+struct x86_operand *x86_operand_new_mem128_base(x86_reg64 r1, int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM128_REG);
+    operand->r1 = r1;
+    operand->r2 = X86_NO_INDEX;
+    operand->n = n;
+    return operand;
+}
+
+struct x86_operand *x86_operand_new_mem256_label(int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM256_LABEL);
+    operand->n = n;
+    return operand;
+}
+
+struct x86_operand *x86_operand_new_mem256_reg(x86_reg64 r1, x86_reg64 r2, int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM256_REG);
+    operand->r1 = r1;
+    operand->r2 = r2;
+    operand->n = n;
+    return operand;
+}
+
+struct x86_operand *x86_operand_new_mem256_base(x86_reg64 r1, int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM256_REG);
+    operand->r1 = r1;
+    operand->r2 = X86_NO_INDEX;
+    operand->n = n;
+    return operand;
+}
+
 struct x86_operand *x86_operand_new_mem64_extern(extern_symbol symbol) {
     struct x86_operand *operand = oper_new(X86_OPERAND_MEM64_EXTERN);
     operand->n = symbol;
@@ -155,6 +244,14 @@ struct x86_operand *x86_operand_new_mem64_local(local_symbol symbol) {
     return operand;
 }
 
+struct x86_operand *x86_operand_new_mem64_base(x86_reg64 r1, int n) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_MEM64_REG);
+    operand->r1 = r1;
+    operand->r2 = X86_NO_INDEX;
+    operand->n = n;
+    return operand;
+}
+
 struct x86_operand *x86_operand_new_mem64_rel(uint64_t address) {
     struct x86_operand *operand = oper_new(X86_OPERAND_MEM64_REL);
     operand->address = address;
@@ -179,14 +276,23 @@ struct x86_operand *x86_operand_new_reg64(x86_reg64 r) {
     return operand;
 }
 
-void x86_operand_free(struct x86_operand *operand) {
-    free(operand);
+struct x86_operand *x86_operand_new_xmm(x86_xmm r) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_XMM);
+    operand->r1 = r;
+    return operand;
+}
+
+struct x86_operand *x86_operand_new_ymm(x86_xmm r) {
+    struct x86_operand *operand = oper_new(X86_OPERAND_YMM);
+    operand->r1 = r;
+    return operand;
 }
 
 bool x86_operand_is_64bit(const struct x86_operand *oper) {
     switch(oper->type) {
     case X86_OPERAND_MEM64_EXTERN:
     case X86_OPERAND_MEM64_LOCAL:
+    case X86_OPERAND_MEM64_REG:
     case X86_OPERAND_REG64:
         return true;
     default:
@@ -199,6 +305,8 @@ bool x86_operand_is_register(const struct x86_operand *oper) {
     case X86_OPERAND_REG8:
     case X86_OPERAND_REG32:
     case X86_OPERAND_REG64:
+    case X86_OPERAND_XMM:
+    case X86_OPERAND_YMM:
         return true;
     default:
         return false;
@@ -208,8 +316,13 @@ bool x86_operand_is_register(const struct x86_operand *oper) {
 bool x86_operand_is_memory(const struct x86_operand *oper) {
     switch(oper->type) {
     case X86_OPERAND_MEM8_REG:
+    case X86_OPERAND_MEM128_LABEL:
+    case X86_OPERAND_MEM128_REG:
+    case X86_OPERAND_MEM256_LABEL:
+    case X86_OPERAND_MEM256_REG:
     case X86_OPERAND_MEM64_EXTERN:
     case X86_OPERAND_MEM64_LOCAL:
+    case X86_OPERAND_MEM64_REG:
         return true;
     default:
         return false;
@@ -221,6 +334,7 @@ bool x86_operand_is_immediate(const struct x86_operand *oper) {
     case X86_OPERAND_EXTERN:
     case X86_OPERAND_IMM8:
     case X86_OPERAND_IMM32:
+    case X86_OPERAND_IMM64:
     case X86_OPERAND_LABEL:
     case X86_OPERAND_LOCAL:
         return true;
@@ -268,14 +382,7 @@ static void check_both_operand_types(
 }
 
 static struct x86_instr *x86_instr_new(x86_instr_op op) {
-    struct x86_instr *instr = malloc(sizeof(struct x86_instr));
-    
-    if(instr == NULL) {
-        fprintf(stderr, "Error: memory allocation (instr)\n");
-        exit(EXIT_FAILURE);
-    }
-    
-    memset(instr, 0, sizeof(struct x86_instr));
+    struct x86_instr *instr = x86_arena_allocate(sizeof(struct x86_instr));
     
     instr->op = op;
     
@@ -292,6 +399,7 @@ struct x86_instr *x86_instr_new_add(struct x86_operand *dst, struct x86_operand
     const struct two_operand_types supported[] = {
         {X86_OPERAND_MEM8_REG, X86_OPERAND_IMM8},
         {X86_OPERAND_MEM8_REG, X86_OPERAND_REG8},
+        {X86_OPERAND_REG8, X86_OPERAND_IMM8},
         {X86_OPERAND_REG8, X86_OPERAND_REG8},
         {X86_OPERAND_REG32, X86_OPERAND_IMM32},
         {X86_OPERAND_REG32, X86_OPERAND_REG32},
@@ -325,7 +433,12 @@ struct x86_instr *x86_instr_new_and(struct x86_operand *dst, struct x86_operand
 }
 
 struct x86_instr *x86_instr_new_call(struct x86_operand *target) {
-    const x86_operand_type supported[] = {X86_OPERAND_EXTERN, X86_OPERAND_LOCAL};
+    const x86_operand_type supported[] = {
+        X86_OPERAND_EXTERN,
+        X86_OPERAND_LABEL,
+        X86_OPERAND_LOCAL,
+        X86_OPERAND_REG64,
+    };
     check_single_operand_type(target, supported, sizeof(supported), "call");
 
     struct x86_instr *instr = x86_instr_new(X86_INSTR_CALL);
@@ -351,11 +464,35 @@ struct x86_instr *x86_instr_new_cmp(struct x86_operand *dst, struct x86_operand
     return instr;
 }
 
-struct x86_instr *x86_instr_new_jl(struct x86_operand *target) {
-    const x86_operand_type supported[] = {X86_OPERAND_LABEL};
-    check_single_operand_type(target, supported, sizeof(supported), "conditional jump (jl)");
+struct x86_instr *x86_instr_new_dq(struct x86_operand *low, struct x86_operand *high) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_IMM64, X86_OPERAND_IMM64}
+    };
+    check_both_operand_types(low, high, supported, sizeof(supported), "dq");
     
-    struct x86_instr *instr = x86_instr_new(X86_INSTR_JL);
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_DQ);
+    instr->dst = low;
+    instr->src = high;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_imul(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_REG64, X86_OPERAND_REG64}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "imul");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_IMUL);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_jge(struct x86_operand *target) {
+    const x86_operand_type supported[] = {X86_OPERAND_LABEL, X86_OPERAND_LOCAL};
+    check_single_operand_type(target, supported, sizeof(supported), "conditional jump (jge)");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_JGE);
     instr->dst = target;
     return instr;
 }
@@ -369,26 +506,26 @@ struct x86_instr *x86_instr_new_jmp(struct x86_operand *target) {
     return instr;
 }
 
-struct x86_instr *x86_instr_new_jns(struct x86_operand *target) {
-    const x86_operand_type supported[] = {X86_OPERAND_LABEL};
-    check_single_operand_type(target, supported, sizeof(supported), "conditional jump (jns)");
+struct x86_instr *x86_instr_new_jnz(struct x86_operand *target) {
+    const x86_operand_type supported[] = {X86_OPERAND_LABEL, X86_OPERAND_LOCAL};
+    check_single_operand_type(target, supported, sizeof(supported), "conditional jump (jnz)");
     
-    struct x86_instr *instr = x86_instr_new(X86_INSTR_JNS);
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_JNZ);
     instr->dst = target;
     return instr;
 }
 
-struct x86_instr *x86_instr_new_jnz(struct x86_operand *target) {
-    const x86_operand_type supported[] = {X86_OPERAND_LABEL};
-    check_single_operand_type(target, supported, sizeof(supported), "conditional jump (jnz)");
+struct x86_instr *x86_instr_new_js(struct x86_operand *target) {
+    const x86_operand_type supported[] = {X86_OPERAND_LABEL, X86_OPERAND_LOCAL};
+    check_single_operand_type(target, supported, sizeof(supported), "conditional jump (js)");
     
-    struct x86_instr *instr = x86_instr_new(X86_INSTR_JNZ);
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_JS);
     instr->dst = target;
     return instr;
 }
 
 struct x86_instr *x86_instr_new_jz(struct x86_operand *target) {
-    const x86_operand_type supported[] = {X86_OPERAND_LABEL};
+    const x86_operand_type supported[] = {X86_OPERAND_LABEL, X86_OPERAND_LOCAL};
     check_single_operand_type(target, supported, sizeof(supported), "conditional jump (jz)");
     
     struct x86_instr *instr = x86_instr_new(X86_INSTR_JZ);
@@ -402,17 +539,35 @@ struct x86_instr *x86_instr_new_label(int n) {
     return instr;
 }
 
+struct x86_instr *x86_instr_new_lea(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_REG64, X86_OPERAND_MEM8_REG},
+        {X86_OPERAND_REG64, X86_OPERAND_MEM64_LOCAL}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "lea");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_LEA);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
 struct x86_instr *x86_instr_new_mov(struct x86_operand *dst, struct x86_operand *src) {
     const struct two_operand_types supported[] = {
         {X86_OPERAND_MEM8_REG, X86_OPERAND_REG8},
         {X86_OPERAND_MEM8_REG, X86_OPERAND_IMM8},
+        {X86_OPERAND_MEM64_LOCAL, X86_OPERAND_REG64},
+        {X86_OPERAND_MEM64_REG, X86_OPERAND_REG64},
+        {X86_OPERAND_REG8, X86_OPERAND_IMM8},
         {X86_OPERAND_REG8, X86_OPERAND_MEM8_REG},
         {X86_OPERAND_REG32, X86_OPERAND_IMM32},
         {X86_OPERAND_REG32, X86_OPERAND_REG32},
+        {X86_OPERAND_REG64, X86_OPERAND_IMM64},
         {X86_OPERAND_REG64, X86_OPERAND_LABEL},
         {X86_OPERAND_REG64, X86_OPERAND_LOCAL},
         {X86_OPERAND_REG64, X86_OPERAND_MEM64_EXTERN},
         {X86_OPERAND_REG64, X86_OPERAND_MEM64_LOCAL},
+        {X86_OPERAND_REG64, X86_OPERAND_MEM64_REG},
         {X86_OPERAND_REG64, X86_OPERAND_REG64},
     };
     check_both_operand_types(dst, src, supported, sizeof(supported), "mov");
@@ -423,9 +578,36 @@ struct x86_instr *x86_instr_new_mov(struct x86_operand *dst, struct x86_operand
     return instr;
 }
 
+struct x86_instr *x86_instr_new_movdqu(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_MEM128_REG, X86_OPERAND_XMM},
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_LABEL},
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_REG}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "movdqu");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_MOVDQU);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_movq(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_XMM, X86_OPERAND_REG64}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "movq");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_MOVQ);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
 struct x86_instr *x86_instr_new_movzx(struct x86_operand *dst, struct x86_operand *src) {
     const struct two_operand_types supported[] = {
         {X86_OPERAND_REG32, X86_OPERAND_MEM8_REG},
+        {X86_OPERAND_REG32, X86_OPERAND_REG8},
     };
     check_both_operand_types(dst, src, supported, sizeof(supported), "movzx");
     
@@ -453,6 +635,32 @@ struct x86_instr *x86_instr_new_or(struct x86_operand *dst, struct x86_operand *
     return instr;
 }
 
+struct x86_instr *x86_instr_new_paddb(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_LABEL},
+        {X86_OPERAND_XMM, X86_OPERAND_XMM}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "paddb");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_PADDB);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_pand(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_LABEL},
+        {X86_OPERAND_XMM, X86_OPERAND_XMM}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "pand");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_PAND);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
 struct x86_instr *x86_instr_new_pop(struct x86_operand *dst) {
     const x86_operand_type supported[] = {X86_OPERAND_REG64};
     check_single_operand_type(dst, supported, sizeof(supported), "pop");
@@ -462,6 +670,18 @@ struct x86_instr *x86_instr_new_pop(struct x86_operand *dst) {
     return instr;
 }
 
+struct x86_instr *x86_instr_new_punpcklqdq(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_XMM, X86_OPERAND_XMM}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "punpcklqdq");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_PUNPCKLQDQ);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
 struct x86_instr *x86_instr_new_push(struct x86_operand *src) {
     const x86_operand_type supported[] = {
         X86_OPERAND_IMM32,
@@ -483,14 +703,98 @@ struct x86_instr *x86_instr_new_segfault(void) {
     return x86_instr_new(X86_INSTR_SEGFAULT);
 }
 
-void x86_instr_free_node(struct x86_instr *instr) {
-    free(instr);
+struct x86_instr *x86_instr_new_sub(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_REG64, X86_OPERAND_IMM32},
+        {X86_OPERAND_REG64, X86_OPERAND_REG64}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "sub");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_SUB);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
 }
 
-void x86_instr_free_tree(struct x86_instr *instr) {
-    while(instr != NULL) {
-        struct x86_instr *next = instr->next;
-        x86_instr_free_node(instr);
-        instr = next;
-    }
+struct x86_instr *x86_instr_new_syscall(void) {
+    return x86_instr_new(X86_INSTR_SYSCALL);
+}
+
+struct x86_instr *x86_instr_new_vmovdqu(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_MEM128_REG, X86_OPERAND_XMM},
+        {X86_OPERAND_MEM256_REG, X86_OPERAND_YMM},
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_LABEL},
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_REG},
+        {X86_OPERAND_YMM, X86_OPERAND_MEM256_LABEL},
+        {X86_OPERAND_YMM, X86_OPERAND_MEM256_REG}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "vmovdqu");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_VMOVDQU);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_vmovq(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_XMM, X86_OPERAND_REG64}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "vmovq");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_VMOVQ);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_vpaddb(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_LABEL},
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_REG},
+        {X86_OPERAND_XMM, X86_OPERAND_XMM},
+        {X86_OPERAND_YMM, X86_OPERAND_MEM256_LABEL},
+        {X86_OPERAND_YMM, X86_OPERAND_MEM256_REG},
+        {X86_OPERAND_YMM, X86_OPERAND_YMM}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "vpaddb");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_VPADDB);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_vpand(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_LABEL},
+        {X86_OPERAND_XMM, X86_OPERAND_MEM128_REG},
+        {X86_OPERAND_XMM, X86_OPERAND_XMM},
+        {X86_OPERAND_YMM, X86_OPERAND_MEM256_LABEL},
+        {X86_OPERAND_YMM, X86_OPERAND_MEM256_REG},
+        {X86_OPERAND_YMM, X86_OPERAND_YMM}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "vpand");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_VPAND);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_vpbroadcastb(struct x86_operand *dst, struct x86_operand *src) {
+    const struct two_operand_types supported[] = {
+        {X86_OPERAND_YMM, X86_OPERAND_XMM}
+    };
+    check_both_operand_types(dst, src, supported, sizeof(supported), "vpbroadcastb");
+    
+    struct x86_instr *instr = x86_instr_new(X86_INSTR_VPBROADCASTB);
+    instr->dst = dst;
+    instr->src = src;
+    return instr;
+}
+
+struct x86_instr *x86_instr_new_vzeroupper(void) {
+    return x86_instr_new(X86_INSTR_VZEROUPPER);
 }
@@ -98,47 +98,100 @@ typedef enum {
 
 extern char *x86_reg64_names[];
 
+typedef enum {
+    X86_REG_XMM0 = 0,
+    X86_REG_XMM1 = 1,
+    X86_REG_XMM2 = 2,
+    X86_REG_XMM3 = 3,
+    X86_REG_XMM4 = 4,
+    X86_REG_XMM5 = 5,
+    X86_REG_XMM6 = 6,
+    X86_REG_XMM7 = 7,
+    X86_REG_XMM8 = 8,
+    X86_REG_XMM9 = 9,
+    X86_REG_XMM10 = 10,
+    X86_REG_XMM11 = 11,
+    X86_REG_XMM12 = 12,
+    X86_REG_XMM13 = 13,
+    X86_REG_XMM14 = 14,
+    X86_REG_XMM15 = 15
+} x86_xmm;
+
+extern char *x86_xmm_names[];
+
+/* The ymm registers extend the xmm registers with the same numbers. */
+extern char *x86_ymm_names[];
+
 typedef enum {
     X86_INSTR_ALIGN,
     X86_INSTR_ADD,
     X86_INSTR_AND,
     X86_INSTR_CALL,
     X86_INSTR_CMP,
-    X86_INSTR_JL,
+    X86_INSTR_DQ,
+    X86_INSTR_IMUL,
+    X86_INSTR_JGE,
     X86_INSTR_JMP,
-    X86_INSTR_JNS,
     X86_INSTR_JNZ,
+    X86_INSTR_JS,
     X86_INSTR_JZ,
     X86_INSTR_LABEL,
+    X86_INSTR_LEA,
     X86_INSTR_MOV,
+    X86_INSTR_MOVDQU,
+    X86_INSTR_MOVQ,
     X86_INSTR_MOVZX,
     X86_INSTR_OR,
+    X86_INSTR_PADDB,
+    X86_INSTR_PAND,
     X86_INSTR_POP,
+    X86_INSTR_PUNPCKLQDQ,
     X86_INSTR_PUSH,
     X86_INSTR_RET,
-    X86_INSTR_SEGFAULT
+    X86_INSTR_SEGFAULT,
+    X86_INSTR_SUB,
+    X86_INSTR_SYSCALL,
+    X86_INSTR_VMOVDQU,
+    X86_INSTR_VMOVQ,
+    X86_INSTR_VPADDB,
+    X86_INSTR_VPAND,
+    X86_INSTR_VPBROADCASTB,
+    X86_INSTR_VZEROUPPER
 } x86_instr_op;
 
 typedef enum {
     X86_OPERAND_EXTERN,
     X86_OPERAND_IMM8,
     X86_OPERAND_IMM32,
+    X86_OPERAND_IMM64,
     X86_OPERAND_LABEL,
     X86_OPERAND_LOCAL,
     X86_OPERAND_MEM8_REG,
+    X86_OPERAND_MEM128_LABEL,
+    X86_OPERAND_MEM128_REG,
+    X86_OPERAND_MEM256_LABEL,
+    X86_OPERAND_MEM256_REG,
     X86_OPERAND_MEM64_EXTERN,
     X86_OPERAND_MEM64_LOCAL,
+    X86_OPERAND_MEM64_REG,
     X86_OPERAND_MEM64_REL,
     X86_OPERAND_REG8,
     X86_OPERAND_REG32,
-    X86_OPERAND_REG64
+    X86_OPERAND_REG64,
+    X86_OPERAND_XMM,
+    X86_OPERAND_YMM
 } x86_operand_type;
 
+/* Value of r2 for register memory operands (X86_OPERAND_MEM*_REG) that have a
+ * base register but no index register. */
+#define X86_NO_INDEX (-1)
+
 struct x86_operand {
     x86_operand_type type;
     int r1;
     int r2;
     int n;
+    /* address for X86_OPERAND_MEM64_REL, value for X86_OPERAND_IMM64 */
     uint64_t address;
 };
 
@@ -148,16 +201,34 @@ struct x86_operand *x86_operand_new_imm8(int n);
 
 struct x86_operand *x86_operand_new_imm32(int n);
 
+struct x86_operand *x86_operand_new_imm64(uint64_t value);
+
 struct x86_operand *x86_operand_new_label(int n);
 
 struct x86_operand *x86_operand_new_local(local_symbol symbol);
 
 struct x86_operand *x86_operand_new_mem8_reg(x86_reg64 r1, x86_reg64 r2, int n);
 
+struct x86_operand *x86_operand_new_mem8_base(x86_reg64 r1, int n);
+
+struct x86_operand *x86_operand_new_mem128_label(int n);
+
+struct x86_operand *x86_operand_new_mem128_reg(x86_reg64 r1, x86_reg64 r2, int n);
+
+struct x86_operand *x86_operand_new_mem128_base(x86_reg64 r1, int n);
+
+struct x86_operand *x86_operand_new_mem256_label(int n);
+
+struct x86_operand *x86_operand_new_mem256_reg(x86_reg64 r1, x86_reg64 r2, int n);
+
+struct x86_operand *x86_operand_new_mem256_base(x86_reg64 r1, int n);
+
 struct x86_operand *x86_operand_new_mem64_extern(extern_symbol symbol);
 
 struct x86_operand *x86_operand_new_mem64_local(local_symbol symbol);
 
+struct x86_operand *x86_operand_new_mem64_base(x86_reg64 r1, int n);
+
 struct x86_operand *x86_operand_new_mem64_rel(uint64_t address);
 
 struct x86_operand *x86_operand_new_reg8(x86_reg8 r);
@@ -166,7 +237,9 @@ struct x86_operand *x86_operand_new_reg32(x86_reg32 r);
 
 struct x86_operand *x86_operand_new_reg64(x86_reg64 r);
 
-void x86_operand_free(struct x86_operand *oper);
+struct x86_operand *x86_operand_new_xmm(x86_xmm r);
+
+struct x86_operand *x86_operand_new_ymm(x86_xmm r);
 
 bool x86_operand_is_64bit(const struct x86_operand *oper);
 
@@ -194,34 +267,68 @@ struct x86_instr *x86_instr_new_call(struct x86_operand *target);
 
 struct x86_instr *x86_instr_new_cmp(struct x86_operand *dst, struct x86_operand *src);
 
-struct x86_instr *x86_instr_new_jl(struct x86_operand *target);
+/* 16 bytes of data: the low and high quadwords as 64-bit immediates */
+struct x86_instr *x86_instr_new_dq(struct x86_operand *low, struct x86_operand *high);
 
-struct x86_instr *x86_instr_new_jmp(struct x86_operand *target);
+struct x86_instr *x86_instr_new_imul(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_jge(struct x86_operand *target);
 
-struct x86_instr *x86_instr_new_jns(struct x86_operand *target);
+struct x86_instr *x86_instr_new_jmp(struct x86_operand *target);
 
 struct x86_instr *x86_instr_new_jnz(struct x86_operand *target);
 
+struct x86_instr *x86_instr_new_js(struct x86_operand *target);
+
 struct x86_instr *x86_instr_new_jz(struct x86_operand *target);
 
 struct x86_instr *x86_instr_new_label(int n);
 
+/* The memory operand only provides the address, its size is ignored. */
+struct x86_instr *x86_instr_new_lea(struct x86_operand *dst, struct x86_operand *src);
+
 struct x86_instr *x86_instr_new_mov(struct x86_operand *dst, struct x86_operand *src);
 
+struct x86_instr *x86_instr_new_movdqu(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_movq(struct x86_operand *dst, struct x86_operand *src);
+
 struct x86_instr *x86_instr_new_movzx(struct x86_operand *dst, struct x86_operand *src);
 
 struct x86_instr *x86_instr_new_or(struct x86_operand *dst, struct x86_operand *src);
 
+struct x86_instr *x86_instr_new_paddb(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_pand(struct x86_operand *dst, struct x86_operand *src);
+
 struct x86_instr *x86_instr_new_pop(struct x86_operand *dst);
 
+struct x86_instr *x86_instr_new_punpcklqdq(struct x86_operand *dst, struct x86_operand *src);
+
 struct x86_instr *x86_instr_new_push(struct x86_operand *src);
 
 struct x86_instr *x86_instr_new_ret(void);
 
 struct x86_instr *x86_instr_new_segfault(void);
 
-void x86_instr_free_node(struct x86_instr *instr);
+struct x86_instr *x86_instr_new_sub(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_syscall(void);
+
+/* The AVX instructions below operate on either xmm or ymm registers. They have
+ * a destination that is also their first source (e.g. vpaddb dst, dst, src) so
+ * they fit the two-operand model. */
+
+struct x86_instr *x86_instr_new_vmovdqu(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_vmovq(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_vpaddb(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_vpand(struct x86_operand *dst, struct x86_operand *src);
+
+struct x86_instr *x86_instr_new_vpbroadcastb(struct x86_operand *dst, struct x86_operand *src);
 
-void x86_instr_free_tree(struct x86_instr *instr);
+struct x86_instr *x86_instr_new_vzeroupper(void);
 
 #endif
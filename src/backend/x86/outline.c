@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "outline.h"
+#include "../../app/hash.h"
+#include "../../ir/query.h"
+
+struct x86_outline_site {
+    const struct node *loop;
+    /* index of the class of the loop in the loops array */
+    size_t index;
+};
+
+static void *allocate_array(size_t count, size_t size) {
+    /* never ask malloc() for zero bytes so NULL always means failure */
+    void *array = malloc(count > 0 ? count * size : 1);
+    
+    if(array == NULL) {
+        fprintf(stderr, "Error: memory allocation (x86 outline)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return array;
+}
+
+static size_t count_loops(const struct node *root) {
+    size_t count = 0;
+    
+    for(const struct node *node = root; node != NULL; node = node->next) {
+        if(node_is_loop(node)) {
+            count += 1 + count_loops(node->body);
+        }
+    }
+    
+    return count;
+}
+
+/* Positions are ignored, as in node_is_equal(). */
+static uint64_t hash_node_fields(const struct node *node) {
+    uint64_t hash = hash_int(HASH_INITIAL, node->type);
+    hash = hash_int(hash, node->n);
+    return hash_int(hash, node->offset);
+}
+
+static void add_site(struct x86_outline *outline, const struct node *loop, uint64_t hash, int size) {
+    size_t mask = outline->num_buckets - 1;
+    size_t bucket = hash & mask;
+    
+    while(outline->buckets[bucket] != 0) {
+        size_t index = outline->buckets[bucket] - 1;
+        struct x86_outlined_loop *outlined = &outline->loops[index];
+        
+        if(outlined->hash == hash && node_is_equal(outlined->loop, loop)) {
+            ++outlined->occurrences;
+            outline->sites[outline->num_sites].loop = loop;
+            outline->sites[outline->num_sites].index = index;
+            ++outline->num_sites;
+            return;
+        }
+        
+        bucket = (bucket + 1) & mask;
+    }
+    
+    size_t index = outline->num_loops++;
+    struct x86_outlined_loop *outlined = &outline->loops[index];
+    outlined->loop = loop;
+    outlined->hash = hash;
+    outlined->occurrences = 1;
+    outlined->size = size;
+    outlined->label = -1;
+    
+    outline->buckets[bucket] = index + 1;
+    outline->sites[outline->num_sites].loop = loop;
+    outline->sites[outline->num_sites].index = index;
+    ++outline->num_sites;
+}
+
+/* Adds the loops of a list of nodes, and of their bodies, to the table, and
+ * returns the hash of the list. The hash of each loop is computed from the
+ * hash of its body, so each node is hashed once. */
+static uint64_t add_loops(struct x86_outline *outline, const struct node *list, int *size) {
+    uint64_t hash = HASH_INITIAL;
+    *size = 0;
+    
+    for(const struct node *node = list; node != NULL; node = node->next) {
+        uint64_t node_hash = hash_node_fields(node);
+        ++*size;
+        
+        if(node_is_loop(node)) {
+            int body_size;
+            node_hash = hash_int(node_hash, add_loops(outline, node->body, &body_size));
+            add_site(outline, node, node_hash, body_size + 1);
+            *size += body_size;
+        }
+        
+        hash = hash_int(hash, node_hash);
+    }
+    
+    return hash;
+}
+
+static int compare_sites(const void *left, const void *right) {
+    uintptr_t left_loop = (uintptr_t)((const struct x86_outline_site *)left)->loop;
+    uintptr_t right_loop = (uintptr_t)((const struct x86_outline_site *)right)->loop;
+    
+    return (left_loop > right_loop) - (left_loop < right_loop);
+}
+
+void x86_outline_initialize(struct x86_outline *outline, const struct node *root) {
+    size_t count = count_loops(root);
+    
+    /* at most half full */
+    outline->num_buckets = 16;
+    
+    while(outline->num_buckets < 2 * count) {
+        outline->num_buckets *= 2;
+    }
+    
+    outline->buckets = allocate_array(outline->num_buckets, sizeof(outline->buckets[0]));
+    
+    for(size_t idx = 0; idx < outline->num_buckets; ++idx) {
+        outline->buckets[idx] = 0;
+    }
+    
+    outline->loops = allocate_array(count, sizeof(outline->loops[0]));
+    outline->num_loops = 0;
+    outline->sites = allocate_array(count, sizeof(outline->sites[0]));
+    outline->num_sites = 0;
+    
+    int size;
+    add_loops(outline, root, &size);
+    
+    qsort(outline->sites, outline->num_sites, sizeof(outline->sites[0]), compare_sites);
+}
+
+void x86_outline_free(struct x86_outline *outline) {
+    free(outline->loops);
+    free(outline->buckets);
+    free(outline->sites);
+}
+
+struct x86_outlined_loop *x86_outline_find(const struct x86_outline *outline, const struct node *loop) {
+    struct x86_outline_site key;
+    key.loop = loop;
+    
+    const struct x86_outline_site *site = bsearch(
+        &key,
+        outline->sites,
+        outline->num_sites,
+        sizeof(outline->sites[0]),
+        compare_sites
+    );
+    
+    if(site == NULL) {
+        return NULL;
+    }
+    
+    struct x86_outlined_loop *outlined = &outline->loops[site->index];
+    
+    if(outlined->occurrences < 2 || outlined->size < X86_MIN_OUTLINED_NODES) {
+        return NULL;
+    }
+    
+    return outlined;
+}
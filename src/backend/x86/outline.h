@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BFC_X86_OUTLINE_H
+#define BFC_X86_OUTLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../../ir/node.h"
+
+/* Loops with fewer nodes than this, the loop itself and the nodes of its body
+ * included, are never outlined: their code is not much larger than the call
+ * and the function prologue and epilogue that would replace it. */
+#define X86_MIN_OUTLINED_NODES 6
+
+/* A class of identical loops (see node_is_equal()). */
+struct x86_outlined_loop {
+    /* first loop of the class, from which the function is generated */
+    const struct node *loop;
+    uint64_t hash;
+    int occurrences;
+    /* number of nodes, the loop itself included */
+    int size;
+    /* label of the function, -1 as long as it is not called */
+    int label;
+};
+
+struct x86_outline_site;
+
+/* Structural hash table of the loops of a program, used to generate the code
+ * of loops that appear several times once, as a local function called from
+ * each of them. */
+struct x86_outline {
+    struct x86_outlined_loop *loops;
+    size_t num_loops;
+    /* open addressing table of the indexes of the loops plus one, zero for
+     * empty */
+    size_t *buckets;
+    size_t num_buckets;
+    /* class of each loop node of the program, sorted by node address */
+    struct x86_outline_site *sites;
+    size_t num_sites;
+};
+
+void x86_outline_initialize(struct x86_outline *outline, const struct node *root);
+
+void x86_outline_free(struct x86_outline *outline);
+
+/* Returns the class of a loop of the program if it is worth outlining, NULL
+ * otherwise. */
+struct x86_outlined_loop *x86_outline_find(const struct x86_outline *outline, const struct node *loop);
+
+#endif
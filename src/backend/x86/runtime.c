@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include "builder.h"
+#include "runtime.h"
+
+/* Linux x86-64 system call numbers */
+#define SYS_READ        0
+#define SYS_WRITE       1
+#define SYS_EXIT_GROUP  231
+
+#define STDIN_FD        0
+#define STDOUT_FD       1
+#define STDERR_FD       2
+
+/* The functions of the runtime only clobber registers that are not preserved
+ * across calls by the System V ABI, like the C library functions they
+ * replace. The syscall instruction itself clobbers rcx and r11. */
+
+static void append_syscall(struct x86_builder *builder, int number) {
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EAX),
+        x86_operand_new_imm32(number)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_syscall());
+}
+
+static void append_exit(struct x86_builder *builder, int status) {
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDI),
+        x86_operand_new_imm32(status)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_call(
+        x86_operand_new_local(LOCAL_EXIT_PROGRAM)
+    ));
+}
+
+static void append_write_error(struct x86_builder *builder, local_symbol message) {
+    x86_builder_append_instr(builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RSI),
+        x86_operand_new_local(message)
+    ));
+    x86_builder_append_instr(builder, x86_instr_new_call(
+        x86_operand_new_local(LOCAL_WRITE_ERROR)
+    ));
+}
+
+struct x86_instr *x86_runtime_generate_start(void) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    /* The stack pointer is aligned on 16 bytes at the entry point, so it is
+     * aligned as the ABI requires once the call pushes the return address. */
+    x86_builder_append_instr(&builder, x86_instr_new_call(
+        x86_operand_new_local(LOCAL_MAIN)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDI),
+        x86_operand_new_reg32(X86_REG_EAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_call(
+        x86_operand_new_local(LOCAL_EXIT_PROGRAM)
+    ));
+    
+    return x86_builder_get_first(&builder);
+}
+
+struct x86_instr *x86_runtime_generate_fail_too_far(local_symbol message) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    append_write_error(&builder, message);
+    append_exit(&builder, EXIT_FAILURE);
+    
+    return x86_builder_get_first(&builder);
+}
+
+struct x86_instr *x86_runtime_generate_check_input(void) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    const int label_eoi = 1;
+    const int label_die = 2;
+    const int label_done = 3;
+    
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        x86_operand_new_reg32(X86_REG_EDI),
+        x86_operand_new_imm32(0)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jge(
+        x86_operand_new_label(label_done)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        x86_operand_new_reg32(X86_REG_EDI),
+        x86_operand_new_imm32(-1)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jz(
+        x86_operand_new_label(label_eoi)
+    ));
+    
+    append_write_error(&builder, LOCAL_MSG_FERR);
+    x86_builder_append_instr(&builder, x86_instr_new_jmp(
+        x86_operand_new_label(label_die)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_eoi));
+    append_write_error(&builder, LOCAL_MSG_EOI);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_die));
+    append_exit(&builder, EXIT_FAILURE);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_done));
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    return x86_builder_get_first(&builder);
+}
+
+struct x86_instr *x86_runtime_generate_read_byte(void) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    const int label_available = 1;
+    const int label_eoi = 2;
+    const int label_error = 3;
+    
+    /* rax: position of the next byte in the input buffer */
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_mem64_local(LOCAL_INPUT_POSITION)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RDX),
+        x86_operand_new_mem64_local(LOCAL_INPUT_LENGTH)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_reg64(X86_REG_RDX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jnz(
+        x86_operand_new_label(label_available)
+    ));
+    
+    /* The buffer is empty. Pending output is written first so that a prompt
+     * is visible before the program waits for the answer, as it would be with
+     * a line buffered standard output. */
+    x86_builder_append_instr(&builder, x86_instr_new_call(
+        x86_operand_new_local(LOCAL_FLUSH_OUTPUT)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDI),
+        x86_operand_new_imm32(STDIN_FD)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RSI),
+        x86_operand_new_local(LOCAL_INPUT_BUFFER)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDX),
+        x86_operand_new_imm32(X86_RUNTIME_BUFFER_SIZE)
+    ));
+    append_syscall(&builder, SYS_READ);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_or(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_js(
+        x86_operand_new_label(label_error)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jz(
+        x86_operand_new_label(label_eoi)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_mem64_local(LOCAL_INPUT_LENGTH),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EAX),
+        x86_operand_new_imm32(0)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_available));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RCX),
+        x86_operand_new_local(LOCAL_INPUT_BUFFER)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_movzx(
+        x86_operand_new_reg32(X86_REG_EDX),
+        x86_operand_new_mem8_reg(X86_REG_RCX, X86_REG_RAX, 0)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_add(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_imm32(1)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_mem64_local(LOCAL_INPUT_POSITION),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EAX),
+        x86_operand_new_reg32(X86_REG_EDX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_eoi));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EAX),
+        x86_operand_new_imm32(-1)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_error));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EAX),
+        x86_operand_new_imm32(-2)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    return x86_builder_get_first(&builder);
+}
+
+struct x86_instr *x86_runtime_generate_write_byte(void) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    const int label_done = 1;
+    
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_mem64_local(LOCAL_OUTPUT_COUNT)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RCX),
+        x86_operand_new_local(LOCAL_OUTPUT_BUFFER)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDX),
+        x86_operand_new_reg32(X86_REG_EDI)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_mem8_reg(X86_REG_RCX, X86_REG_RAX, 0),
+        x86_operand_new_reg8(X86_REG_DL)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_add(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_imm32(1)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_mem64_local(LOCAL_OUTPUT_COUNT),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_imm32(X86_RUNTIME_BUFFER_SIZE)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jnz(
+        x86_operand_new_label(label_done)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_call(
+        x86_operand_new_local(LOCAL_FLUSH_OUTPUT)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_done));
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    return x86_builder_get_first(&builder);
+}
+
+struct x86_instr *x86_runtime_generate_flush_output(void) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    const int label_loop = 1;
+    const int label_done = 2;
+    
+    /* rsi: start of the data left to write, rdx: its size */
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RSI),
+        x86_operand_new_local(LOCAL_OUTPUT_BUFFER)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg64(X86_REG_RDX),
+        x86_operand_new_mem64_local(LOCAL_OUTPUT_COUNT)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_loop));
+    x86_builder_append_instr(&builder, x86_instr_new_or(
+        x86_operand_new_reg64(X86_REG_RDX),
+        x86_operand_new_reg64(X86_REG_RDX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jz(
+        x86_operand_new_label(label_done)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDI),
+        x86_operand_new_imm32(STDOUT_FD)
+    ));
+    append_syscall(&builder, SYS_WRITE);
+    
+    /* On error, the buffered output is dropped, as the C library does. */
+    x86_builder_append_instr(&builder, x86_instr_new_or(
+        x86_operand_new_reg64(X86_REG_RAX),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_js(
+        x86_operand_new_label(label_done)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jz(
+        x86_operand_new_label(label_done)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_add(
+        x86_operand_new_reg64(X86_REG_RSI),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_sub(
+        x86_operand_new_reg64(X86_REG_RDX),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jmp(
+        x86_operand_new_label(label_loop)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_done));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EAX),
+        x86_operand_new_imm32(0)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_mem64_local(LOCAL_OUTPUT_COUNT),
+        x86_operand_new_reg64(X86_REG_RAX)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    return x86_builder_get_first(&builder);
+}
+
+struct x86_instr *x86_runtime_generate_exit_program(void) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    x86_builder_append_instr(&builder, x86_instr_new_push(
+        x86_operand_new_reg64(X86_REG_RDI)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_call(
+        x86_operand_new_local(LOCAL_FLUSH_OUTPUT)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_pop(
+        x86_operand_new_reg64(X86_REG_RDI)
+    ));
+    append_syscall(&builder, SYS_EXIT_GROUP);
+    
+    return x86_builder_get_first(&builder);
+}
+
+struct x86_instr *x86_runtime_generate_write_error(void) {
+    struct x86_builder builder;
+    x86_builder_initialize_empty(&builder);
+    
+    const int label_loop = 1;
+    const int label_end = 2;
+    
+    /* rdx: length of the string */
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDX),
+        x86_operand_new_imm32(0)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_loop));
+    x86_builder_append_instr(&builder, x86_instr_new_cmp(
+        x86_operand_new_mem8_reg(X86_REG_RSI, X86_REG_RDX, 0),
+        x86_operand_new_imm8(0)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jz(
+        x86_operand_new_label(label_end)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_add(
+        x86_operand_new_reg64(X86_REG_RDX),
+        x86_operand_new_imm32(1)
+    ));
+    x86_builder_append_instr(&builder, x86_instr_new_jmp(
+        x86_operand_new_label(label_loop)
+    ));
+    
+    x86_builder_append_instr(&builder, x86_instr_new_label(label_end));
+    x86_builder_append_instr(&builder, x86_instr_new_mov(
+        x86_operand_new_reg32(X86_REG_EDI),
+        x86_operand_new_imm32(STDERR_FD)
+    ));
+    append_syscall(&builder, SYS_WRITE);
+    x86_builder_append_instr(&builder, x86_instr_new_ret());
+    
+    return x86_builder_get_first(&builder);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BFC_X86_RUNTIME_H
+#define BFC_X86_RUNTIME_H
+
+#include "../common/symbols.h"
+#include "isa.h"
+
+/* Runtime of static executables (see -static), which make system calls
+ * directly instead of calling the C library. Input and output go through
+ * buffers of this size in the .bss section. */
+#define X86_RUNTIME_BUFFER_SIZE 65536
+
+/* Entry point: calls main() then exits with its return value. */
+struct x86_instr *x86_runtime_generate_start(void);
+
+/* Write a message and exit with a failure status. */
+struct x86_instr *x86_runtime_generate_fail_too_far(local_symbol message);
+
+/* Exits with an error message if the value returned by read_byte() is not a
+ * byte (first argument). */
+struct x86_instr *x86_runtime_generate_check_input(void);
+
+/* Returns the next input byte, -1 at end of input or -2 on error. */
+struct x86_instr *x86_runtime_generate_read_byte(void);
+
+/* Buffers the byte passed as first argument for output. */
+struct x86_instr *x86_runtime_generate_write_byte(void);
+
+struct x86_instr *x86_runtime_generate_flush_output(void);
+
+/* Flushes the output and exits with the status passed as first argument. */
+struct x86_instr *x86_runtime_generate_exit_program(void);
+
+/* Writes the null-terminated string passed in rsi to the standard error. */
+struct x86_instr *x86_runtime_generate_write_error(void);
+
+#endif
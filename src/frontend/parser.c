@@ -35,11 +35,6 @@
 #include "../ir/builder.h"
 #include "parser.h"
 
-struct position {
-    int line;
-    int column;
-};
-
 static void copy_position(struct position *dest, const struct position *src) {
     dest->line = src->line;
     dest->column = src->column;
@@ -84,6 +79,11 @@ static void consume(struct state *state) {
     read_char(state);
 }
 
+static void append_node(struct builder *builder, struct node *node, const struct position *position) {
+    copy_position(&node->position, position);
+    builder_append_node(builder, node);
+}
+
 static struct node *parse_instructions(struct state *state, int loop_level, const struct position *loop_start) {
     struct builder builder;
     builder_initialize_empty(&builder);
@@ -91,27 +91,27 @@ static struct node *parse_instructions(struct state *state, int loop_level, cons
     while(state->lookahead != EOF) {
         switch(state->lookahead) {
         case '+':
-            builder_append_node(&builder, node_new_add(1, 0));
+            append_node(&builder, node_new_add(1, 0), &state->position);
             consume(state);
             break;
         case '-':
-            builder_append_node(&builder, node_new_add(-1, 0));
+            append_node(&builder, node_new_add(-1, 0), &state->position);
             consume(state);
             break;
         case '>':
-            builder_append_node(&builder, node_new_right(1));
+            append_node(&builder, node_new_right(1), &state->position);
             consume(state);
             break;
         case '<':
-            builder_append_node(&builder, node_new_right(-1));
+            append_node(&builder, node_new_right(-1), &state->position);
             consume(state);
             break;
         case '.':
-            builder_append_node(&builder, node_new_out(0));
+            append_node(&builder, node_new_out(0), &state->position);
             consume(state);
             break;
         case ',':
-            builder_append_node(&builder, node_new_in(0));
+            append_node(&builder, node_new_in(0), &state->position);
             consume(state);
             break;
         case '[':
@@ -127,7 +127,7 @@ static struct node *parse_instructions(struct state *state, int loop_level, cons
                  * called instance of this function expects the '[' character to
                  * have been consumed. */
                 struct node *body = parse_instructions(state, loop_level + 1, &nested_start);
-                builder_append_node(&builder, node_new_loop(body, 0));
+                append_node(&builder, node_new_loop(body, 0), &nested_start);
             }
             break;
         case ']':
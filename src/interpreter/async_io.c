@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE /* for fopencookie() */
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "async_io.h"
+
+/* Powers of two, so positions in a ring are found with a mask. */
+#define OUTPUT_RING_SIZE (4 * 1024 * 1024)
+#define INPUT_RING_SIZE (1024 * 1024)
+
+/* Size of the buffer of the streams, i.e. of the blocks copied to and from
+ * the rings. */
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+/* A ring buffer with a single producer and a single consumer. The producer
+ * only stores head and the consumer only stores tail, both counts of bytes
+ * that only grow, so data moves without a lock. The lock and condition are
+ * only for a side that has to sleep until the ring is no longer full or
+ * empty, and are only taken by the other side when someone sleeps. */
+struct ring {
+    char *data;
+    size_t size;
+    size_t head;
+    size_t tail;
+    /* set by the producer once it is done */
+    bool closed;
+    /* errno of the failed read() or write(), 0 if none */
+    int error;
+    int sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static struct ring input_ring;
+static struct ring output_ring;
+static pthread_t writer_thread;
+
+static void initialize_ring(struct ring *ring, size_t size) {
+    ring->data = malloc(size);
+    
+    if(ring->data == NULL) {
+        fprintf(stderr, "Error: memory allocation (I/O ring buffer)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->closed = false;
+    ring->error = 0;
+    ring->sleepers = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+}
+
+static size_t get_used(struct ring *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+}
+
+static bool is_closed(struct ring *ring) {
+    return __atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST);
+}
+
+/* The error of the writer is checked by the main thread as it produces. */
+static int get_error(struct ring *ring) {
+    return __atomic_load_n(&ring->error, __ATOMIC_SEQ_CST);
+}
+
+static void set_error(struct ring *ring, int error) {
+    __atomic_store_n(&ring->error, error, __ATOMIC_SEQ_CST);
+}
+
+static bool can_consume(struct ring *ring) {
+    return get_used(ring) > 0 || is_closed(ring);
+}
+
+static bool can_produce(struct ring *ring) {
+    return get_used(ring) < ring->size;
+}
+
+/* Called after head, tail or closed changes. Paired with the count of
+ * sleepers in wait_for(), either the sleeper sees the change or this sees
+ * the sleeper. */
+static void wake_up(struct ring *ring) {
+    if(__atomic_load_n(&ring->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->cond);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+static void wait_for(struct ring *ring, bool (*is_ready)(struct ring *)) {
+    if(is_ready(ring)) {
+        return;
+    }
+    
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+    
+    while(!is_ready(ring)) {
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    }
+    
+    __atomic_sub_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void advance(struct ring *ring, size_t *position, size_t count) {
+    __atomic_store_n(position, *position + count, __ATOMIC_SEQ_CST);
+    wake_up(ring);
+}
+
+static void close_ring(struct ring *ring, int error) {
+    set_error(ring, error);
+    __atomic_store_n(&ring->closed, true, __ATOMIC_SEQ_CST);
+    wake_up(ring);
+}
+
+/* Copies between a buffer and the ring, in two parts if it wraps around. */
+static void copy_to_ring(struct ring *ring, const char *buffer, size_t count) {
+    size_t offset = ring->head & (ring->size - 1);
+    size_t first = count < ring->size - offset ? count : ring->size - offset;
+    
+    memcpy(&ring->data[offset], buffer, first);
+    memcpy(ring->data, &buffer[first], count - first);
+}
+
+static void copy_from_ring(struct ring *ring, char *buffer, size_t count) {
+    size_t offset = ring->tail & (ring->size - 1);
+    size_t first = count < ring->size - offset ? count : ring->size - offset;
+    
+    memcpy(buffer, &ring->data[offset], first);
+    memcpy(&buffer[first], ring->data, count - first);
+}
+
+/* The writer hands the largest contiguous part of the ring to each write().
+ * After a write error, the output is dropped so the program never waits for
+ * room. */
+static void *run_writer(void *arg) {
+    struct ring *ring = arg;
+    
+    while(true) {
+        wait_for(ring, can_consume);
+        
+        size_t used = get_used(ring);
+        
+        if(used == 0) {
+            return NULL;
+        }
+        
+        size_t offset = ring->tail & (ring->size - 1);
+        size_t count = used < ring->size - offset ? used : ring->size - offset;
+        
+        if(get_error(ring) == 0) {
+            ssize_t written = write(STDOUT_FILENO, &ring->data[offset], count);
+            
+            if(written < 0 && errno == EINTR) {
+                continue;
+            }
+            
+            if(written < 0) {
+                set_error(ring, errno);
+            } else {
+                count = written;
+            }
+        }
+        
+        advance(ring, &ring->tail, count);
+    }
+}
+
+/* The reader reads ahead as much as fits in the contiguous free part of the
+ * ring, until the end of the input or an error. */
+static void *run_reader(void *arg) {
+    struct ring *ring = arg;
+    
+    while(true) {
+        wait_for(ring, can_produce);
+        
+        size_t offset = ring->head & (ring->size - 1);
+        size_t room = ring->size - get_used(ring);
+        size_t count = room < ring->size - offset ? room : ring->size - offset;
+        
+        ssize_t count_read = read(STDIN_FILENO, &ring->data[offset], count);
+        
+        if(count_read < 0 && errno == EINTR) {
+            continue;
+        }
+        
+        if(count_read <= 0) {
+            close_ring(ring, count_read < 0 ? errno : 0);
+            return NULL;
+        }
+        
+        advance(ring, &ring->head, count_read);
+    }
+}
+
+static ssize_t read_stream(void *cookie, char *buffer, size_t size) {
+    struct ring *ring = cookie;
+    
+    wait_for(ring, can_consume);
+    
+    size_t count = get_used(ring);
+    
+    if(count == 0) {
+        if(get_error(ring) != 0) {
+            errno = get_error(ring);
+            return -1;
+        }
+        return 0;
+    }
+    
+    if(count > size) {
+        count = size;
+    }
+    
+    copy_from_ring(ring, buffer, count);
+    advance(ring, &ring->tail, count);
+    
+    return count;
+}
+
+/* Returns a short count, which the C library takes as an error, once the
+ * writer has failed. */
+static ssize_t write_stream(void *cookie, const char *buffer, size_t size) {
+    struct ring *ring = cookie;
+    size_t done = 0;
+    
+    while(done < size && get_error(ring) == 0) {
+        wait_for(ring, can_produce);
+        
+        size_t count = ring->size - get_used(ring);
+        
+        if(count > size - done) {
+            count = size - done;
+        }
+        
+        copy_to_ring(ring, &buffer[done], count);
+        advance(ring, &ring->head, count);
+        done += count;
+    }
+    
+    return done;
+}
+
+/* Only the main thread uses the streams, so they are not locked on each
+ * character. */
+static FILE *open_stream(struct ring *ring, const char *mode) {
+    cookie_io_functions_t functions;
+    memset(&functions, 0, sizeof(functions));
+    functions.read = read_stream;
+    functions.write = write_stream;
+    
+    FILE *f = fopencookie(ring, mode, functions);
+    
+    if(f == NULL) {
+        fprintf(stderr, "Error: cannot open stream on I/O ring buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    setvbuf(f, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+    __fsetlocking(f, FSETLOCKING_BYCALLER);
+    
+    return f;
+}
+
+/* Runs at exit, before the C library flushes the streams, so the output
+ * still in the stream and the ring is written first. The reader may be
+ * blocked on the input and is left alone. */
+static void stop_output(void) {
+    fflush(stdout);
+    close_ring(&output_ring, get_error(&output_ring));
+    pthread_join(writer_thread, NULL);
+}
+
+static void start_thread(pthread_t *thread, void *(*function)(void *), void *arg) {
+    int error = pthread_create(thread, NULL, function, arg);
+    
+    if(error != 0) {
+        fprintf(stderr, "Error: cannot create I/O thread: %s\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void async_io_start(void) {
+    initialize_ring(&input_ring, INPUT_RING_SIZE);
+    initialize_ring(&output_ring, OUTPUT_RING_SIZE);
+    
+    pthread_t reader_thread;
+    start_thread(&reader_thread, run_reader, &input_ring);
+    pthread_detach(reader_thread);
+    
+    start_thread(&writer_thread, run_writer, &output_ring);
+    
+    if(atexit(stop_output) != 0) {
+        fprintf(stderr, "Error: cannot register I/O ring buffer cleanup\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    /* The GNU C library allows assigning the standard streams, which every
+     * engine then uses without knowing. */
+    fflush(stdout);
+    stdin = open_stream(&input_ring, "r");
+    stdout = open_stream(&output_ring, "w");
+}
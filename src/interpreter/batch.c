@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for clock_gettime() and sysconf() */
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "mapped_input.h"
+
+#define TAPE_SIZE 30000
+
+/* Size of the buffer of each input and output stream. */
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+struct batch {
+    const jit_compiled_program *compiled;
+    const char *input_dir;
+    const char *output_dir;
+    char **names;
+    size_t num_names;
+    /* next input to run, shared by the workers */
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+struct worker {
+    struct batch *batch;
+    pthread_t thread;
+    unsigned char *tape;
+    char *input_buffer;
+    char *output_buffer;
+    size_t num_failures;
+    long long bytes_read;
+    long long bytes_written;
+};
+
+static void *allocate(size_t size) {
+    void *ptr = malloc(size);
+    
+    if(ptr == NULL) {
+        fprintf(stderr, "Error: memory allocation (batch)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return ptr;
+}
+
+static char *join_path(const char *dir, const char *name) {
+    size_t dir_length = strlen(dir);
+    size_t name_length = strlen(name);
+    char *path = allocate(dir_length + name_length + 2);
+    
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '/';
+    memcpy(&path[dir_length + 1], name, name_length + 1);
+    
+    return path;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Lists the regular files of the input directory, sorted by name so the
+ * order in which they are handed out does not depend on the file system. */
+static void list_inputs(struct batch *batch) {
+    DIR *dir = opendir(batch->input_dir);
+    
+    if(dir == NULL) {
+        fprintf(stderr, "Error: cannot open input directory '%s': %s\n", batch->input_dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    size_t capacity = 64;
+    batch->names = allocate(capacity * sizeof(batch->names[0]));
+    batch->num_names = 0;
+    
+    struct dirent *entry;
+    
+    while((entry = readdir(dir)) != NULL) {
+        char *path = join_path(batch->input_dir, entry->d_name);
+        struct stat st;
+        bool is_file = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+        
+        free(path);
+        
+        if(! is_file) {
+            continue;
+        }
+        
+        if(batch->num_names == capacity) {
+            capacity *= 2;
+            batch->names = realloc(batch->names, capacity * sizeof(batch->names[0]));
+            
+            if(batch->names == NULL) {
+                fprintf(stderr, "Error: memory allocation (batch)\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        size_t length = strlen(entry->d_name);
+        char *name = allocate(length + 1);
+        memcpy(name, entry->d_name, length + 1);
+        batch->names[batch->num_names++] = name;
+    }
+    
+    closedir(dir);
+    
+    qsort(batch->names, batch->num_names, sizeof(batch->names[0]), compare_names);
+}
+
+static void report_status(const char *name, jit_status status, int error) {
+    switch(status) {
+    case X86_STATUS_SUCCESS:
+        break;
+    case X86_STATUS_TOO_FAR_RIGHT:
+        fprintf(stderr, "Error: %s: memory position out of bounds (overflow - too far right)\n", name);
+        break;
+    case X86_STATUS_TOO_FAR_LEFT:
+        fprintf(stderr, "Error: %s: memory position out of bounds (underflow - too far left)\n", name);
+        break;
+    case X86_STATUS_END_OF_INPUT:
+        fprintf(stderr, "Error: %s: reached end of input\n", name);
+        break;
+    case X86_STATUS_INPUT_ERROR:
+        fprintf(stderr, "Error: %s: when reading input: %s\n", name, strerror(error));
+        break;
+    }
+}
+
+/* Opens a stream for the exclusive use of the calling worker. Its buffer is
+ * reused from one input to the next and, since no other thread touches it,
+ * the C library is told not to lock it on each character. */
+static FILE *open_stream(const char *path, const char *mode, char *buffer) {
+    FILE *f = fopen(path, mode);
+    
+    if(f == NULL) {
+        return NULL;
+    }
+    
+    setvbuf(f, buffer, _IOFBF, STREAM_BUFFER_SIZE);
+    __fsetlocking(f, FSETLOCKING_BYCALLER);
+    
+    return f;
+}
+
+/* Runs the program with the specified streams, which it closes. Returns
+ * false if the input could not be run to completion. */
+static bool run_streams(struct worker *worker, const char *name, const char *output_path, FILE *input, FILE *output) {
+    memset(worker->tape, 0, TAPE_SIZE + JIT_TAPE_PADDING);
+    
+    jit_io_context context;
+    context.input = input;
+    context.output = output;
+    
+    struct mapped_input mapped;
+    mapped_input_open(&mapped, input, &context);
+    
+    errno = 0;
+    jit_status status = jit_compiled_program_get_main(worker->batch->compiled)(worker->tape, TAPE_SIZE, &context);
+    report_status(name, status, errno);
+    
+    mapped_input_close(&mapped, &context);
+    
+    worker->bytes_read += ftell(input);
+    worker->bytes_written += ftell(output);
+    
+    fclose(input);
+    
+    if(fclose(output) != 0) {
+        fprintf(stderr, "Error: when writing output file '%s': %s\n", output_path, strerror(errno));
+        return false;
+    }
+    
+    return status == X86_STATUS_SUCCESS;
+}
+
+/* Returns false if the input could not be run to completion. */
+static bool run_input(struct worker *worker, const char *name) {
+    struct batch *batch = worker->batch;
+    char *input_path = join_path(batch->input_dir, name);
+    char *output_path = join_path(batch->output_dir, name);
+    bool success = false;
+    
+    FILE *input = open_stream(input_path, "rb", worker->input_buffer);
+    FILE *output = NULL;
+    
+    if(input == NULL) {
+        fprintf(stderr, "Error: cannot open input file '%s': %s\n", input_path, strerror(errno));
+    } else if((output = open_stream(output_path, "wb", worker->output_buffer)) == NULL) {
+        fprintf(stderr, "Error: cannot open output file '%s': %s\n", output_path, strerror(errno));
+        fclose(input);
+    } else {
+        success = run_streams(worker, name, output_path, input, output);
+    }
+    
+    free(input_path);
+    free(output_path);
+    
+    return success;
+}
+
+static void *run_worker(void *arg) {
+    struct worker *worker = arg;
+    struct batch *batch = worker->batch;
+    
+    while(true) {
+        pthread_mutex_lock(&batch->lock);
+        size_t index = batch->next;
+        
+        if(index < batch->num_names) {
+            ++batch->next;
+        }
+        pthread_mutex_unlock(&batch->lock);
+        
+        if(index >= batch->num_names) {
+            return NULL;
+        }
+        
+        if(! run_input(worker, batch->names[index])) {
+            ++worker->num_failures;
+        }
+    }
+}
+
+static int get_num_workers(const struct options *options, size_t num_inputs) {
+    long num_workers = options->jobs;
+    
+    if(num_workers == 0) {
+        num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+        
+        if(num_workers < 1) {
+            num_workers = 1;
+        }
+    }
+    
+    /* no point in threads that would have nothing to do */
+    if((size_t)num_workers > num_inputs) {
+        num_workers = num_inputs > 0 ? num_inputs : 1;
+    }
+    
+    return num_workers;
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void batch_run_program(const jit_compiled_program *compiled, const struct options *options) {
+    struct batch batch;
+    batch.compiled = compiled;
+    batch.input_dir = options->batch_dir;
+    batch.output_dir = options->output_dir;
+    batch.next = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+    
+    list_inputs(&batch);
+    
+    if(mkdir(batch.output_dir, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: cannot create output directory '%s': %s\n", batch.output_dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    int num_workers = get_num_workers(options, batch.num_names);
+    struct worker *workers = allocate(num_workers * sizeof(workers[0]));
+    
+    double start = get_time();
+    
+    for(int idx = 0; idx < num_workers; ++idx) {
+        struct worker *worker = &workers[idx];
+        worker->batch = &batch;
+        worker->tape = allocate(TAPE_SIZE + JIT_TAPE_PADDING);
+        worker->input_buffer = allocate(STREAM_BUFFER_SIZE);
+        worker->output_buffer = allocate(STREAM_BUFFER_SIZE);
+        worker->num_failures = 0;
+        worker->bytes_read = 0;
+        worker->bytes_written = 0;
+        
+        int error = pthread_create(&worker->thread, NULL, run_worker, worker);
+        
+        if(error != 0) {
+            fprintf(stderr, "Error: cannot create worker thread: %s\n", strerror(error));
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    size_t num_failures = 0;
+    long long bytes_read = 0;
+    long long bytes_written = 0;
+    
+    for(int idx = 0; idx < num_workers; ++idx) {
+        struct worker *worker = &workers[idx];
+        
+        pthread_join(worker->thread, NULL);
+        
+        num_failures += worker->num_failures;
+        bytes_read += worker->bytes_read;
+        bytes_written += worker->bytes_written;
+        
+        free(worker->tape);
+        free(worker->input_buffer);
+        free(worker->output_buffer);
+    }
+    
+    double elapsed = get_time() - start;
+    
+    /* guard against a zero interval on coarse clocks */
+    double rate_time = elapsed > 0 ? elapsed : 1e-9;
+    
+    fprintf(
+        stderr,
+        "batch: %zu inputs (%zu failed) on %d threads in %.3f s: %.1f inputs/s, "
+        "%.2f MB/s read, %.2f MB/s written\n",
+        batch.num_names,
+        num_failures,
+        num_workers,
+        elapsed,
+        batch.num_names / rate_time,
+        bytes_read / rate_time / 1e6,
+        bytes_written / rate_time / 1e6
+    );
+    
+    for(size_t idx = 0; idx < batch.num_names; ++idx) {
+        free(batch.names[idx]);
+    }
+    free(batch.names);
+    free(workers);
+    pthread_mutex_destroy(&batch.lock);
+    
+    if(num_failures > 0) {
+        exit(EXIT_FAILURE);
+    }
+}
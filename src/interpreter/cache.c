@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for mkstemp() */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "../app/hash.h"
+#include "../backend/x86/cpu.h"
+
+/* to be incremented when the format of the entries or the code generated for
+ * the same key changes in a way the key does not capture */
+#define CACHE_VERSION       1
+#define CACHE_SUFFIX        ".bfjit"
+#define CACHE_TEMP_SUFFIX   ".XXXXXX"
+#define READ_CHUNK_SIZE     4096
+
+/* What precedes the code in an entry, to detect files that were not written
+ * for the program, e.g. on a hash collision. */
+struct entry_header {
+    char magic[8];
+    uint64_t key;
+    uint64_t source_size;
+};
+
+static const char entry_magic[8] = "BFCACHE\1";
+
+struct key {
+    uint64_t hash;
+    uint64_t source_size;
+};
+
+/* Only the options that change the generated code are part of the key. The
+ * JIT compiler uses native by default, which depends on the processor. */
+static uint64_t hash_options(uint64_t hash, const struct options *options) {
+    option_march march = options->march;
+    
+    if(march == MARCH_DEFAULT) {
+        march = MARCH_NATIVE;
+    }
+    
+    if(march == MARCH_NATIVE) {
+        march = x86_cpu_has_avx2() ? MARCH_AVX2 : MARCH_BASELINE;
+    }
+    
+    hash = hash_int(hash, options->from_ir);
+    hash = hash_int(hash, options->incremental);
+    hash = hash_int(hash, options->optimization_level);
+    hash = hash_int(hash, options->no_check);
+    hash = hash_string(hash, options->passes);
+    hash = hash_int(hash, options->align_loops);
+    hash = hash_int(hash, options->promote_registers);
+    hash = hash_int(hash, options->vectorize);
+    hash = hash_int(hash, options->absolute_pointer);
+    hash = hash_int(hash, options->outline_loops);
+    return hash_int(hash, march);
+}
+
+static bool compute_key(struct key *key, const struct options *options) {
+    FILE *file = fopen(options->filename, "r");
+    
+    if(file == NULL) {
+        return false;
+    }
+    
+    uint64_t hash = hash_int(HASH_INITIAL, CACHE_VERSION);
+    hash = hash_executable(hash);
+    hash = hash_options(hash, options);
+    
+    unsigned char chunk[READ_CHUNK_SIZE];
+    size_t size = 0;
+    size_t length;
+    
+    while((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        hash = hash_bytes(hash, chunk, length);
+        size += length;
+    }
+    
+    bool success = !ferror(file);
+    fclose(file);
+    
+    key->hash = hash;
+    key->source_size = size;
+    
+    return success;
+}
+
+static char *get_entry_filename(const char *directory, const struct key *key, const char *suffix) {
+    /* 16 hexadecimal digits for the hash */
+    size_t length = strlen(directory) + 1 + 16 + strlen(CACHE_SUFFIX) + strlen(suffix) + 1;
+    char *filename = malloc(length);
+    
+    if(filename == NULL) {
+        fprintf(stderr, "Error: memory allocation (JIT cache)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    snprintf(filename, length, "%s/%016" PRIx64 CACHE_SUFFIX "%s", directory, key->hash, suffix);
+    
+    return filename;
+}
+
+/* Remarks and dumps are printed by the optimization passes, which do not run
+ * when the code comes from the cache. */
+static bool is_cacheable(const struct options *options) {
+    return options->jit_cache != NULL && !options->remarks_missed && !options->print_after_all;
+}
+
+jit_compiled_program *jit_cache_load(const struct options *options) {
+    struct key key;
+    
+    if(!is_cacheable(options) || !compute_key(&key, options)) {
+        return NULL;
+    }
+    
+    char *filename = get_entry_filename(options->jit_cache, &key, "");
+    FILE *file = fopen(filename, "rb");
+    
+    free(filename);
+    
+    if(file == NULL) {
+        return NULL;
+    }
+    
+    struct entry_header header;
+    jit_compiled_program *compiled = NULL;
+    
+    if(
+        fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, entry_magic, sizeof(header.magic)) == 0 &&
+        header.key == key.hash &&
+        header.source_size == key.source_size
+    ) {
+        compiled = jit_compiled_program_load(file);
+    }
+    
+    fclose(file);
+    
+    return compiled;
+}
+
+static bool write_entry(FILE *file, const jit_compiled_program *compiled, const struct key *key) {
+    struct entry_header header;
+    memcpy(header.magic, entry_magic, sizeof(header.magic));
+    header.key = key->hash;
+    header.source_size = key->source_size;
+    
+    return fwrite(&header, sizeof(header), 1, file) == 1 && jit_compiled_program_save(compiled, file);
+}
+
+void jit_cache_store(const jit_compiled_program *compiled, const struct options *options) {
+    struct key key;
+    
+    if(!is_cacheable(options) || !compute_key(&key, options)) {
+        return;
+    }
+    
+    if(mkdir(options->jit_cache, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Warning: cannot create JIT cache directory: %s\n", strerror(errno));
+        return;
+    }
+    
+    /* The entry is written under a temporary name and renamed once complete,
+     * so concurrent runs of the same program never load a partial entry. */
+    char *temp_filename = get_entry_filename(options->jit_cache, &key, CACHE_TEMP_SUFFIX);
+    int fd = mkstemp(temp_filename);
+    
+    if(fd < 0) {
+        fprintf(stderr, "Warning: cannot write to JIT cache directory: %s\n", strerror(errno));
+        free(temp_filename);
+        return;
+    }
+    
+    /* mkstemp() creates the file readable by its owner only */
+    fchmod(fd, 0644);
+    
+    FILE *file = fdopen(fd, "wb");
+    
+    if(file == NULL) {
+        close(fd);
+        unlink(temp_filename);
+        free(temp_filename);
+        return;
+    }
+    
+    bool success = write_entry(file, compiled, &key);
+    
+    if(fclose(file) != 0) {
+        success = false;
+    }
+    
+    char *filename = get_entry_filename(options->jit_cache, &key, "");
+    
+    if(!success || rename(temp_filename, filename) < 0) {
+        unlink(temp_filename);
+    }
+    
+    free(filename);
+    free(temp_filename);
+}
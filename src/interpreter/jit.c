@@ -28,13 +28,129 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include "../backend/jit.h"
+#include "../backend/stencil/jit.h"
+#include "batch.h"
+#include "cache.h"
 #include "jit.h"
+#include "mapped_input.h"
+#include "server.h"
 
-void jit_interpreter_run_program(const struct node *program) {
-    jit_compiled_program *compiled = jit_compiled_program_create(program);
+/* The baseline JIT produces code much faster than the x86 code generator but
+ * only a fixed sequence of instructions per node, so it is the default for
+ * the optimization levels where the code generator does not do more. */
+static bool use_baseline_jit(const struct options *options) {
+    /* Its code uses a tape of its own, so only one copy can run at a time,
+     * and exits on error instead of returning a status. */
+    if(options->batch_dir != NULL || options->server_socket != NULL) {
+        return false;
+    }
     
-    jit_compiled_program_get_main(compiled)();
+    if(options->baseline_jit == TOGGLE_DEFAULT) {
+        return options->optimization_level < 2;
+    }
+    
+    return options->baseline_jit == TOGGLE_ON;
+}
+
+#define TAPE_SIZE 30000
+
+int jit_interpreter_run_compiled_program(const jit_compiled_program *compiled) {
+    unsigned char *tape = calloc(TAPE_SIZE + JIT_TAPE_PADDING, 1);
+    
+    if(tape == NULL) {
+        fprintf(stderr, "Error: memory allocation (JIT tape)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    jit_io_context context;
+    context.input = stdin;
+    context.output = stdout;
+    
+    struct mapped_input mapped;
+    mapped_input_open(&mapped, stdin, &context);
+    
+    jit_status status = jit_compiled_program_get_main(compiled)(tape, TAPE_SIZE, &context);
+    
+    mapped_input_close(&mapped, &context);
+    free(tape);
+    
+    switch(status) {
+    case X86_STATUS_SUCCESS:
+        return EXIT_SUCCESS;
+    case X86_STATUS_TOO_FAR_RIGHT:
+        fprintf(stderr, "Error: memory position out of bounds (overflow - too far right)\n");
+        break;
+    case X86_STATUS_TOO_FAR_LEFT:
+        fprintf(stderr, "Error: memory position out of bounds (underflow - too far left)\n");
+        break;
+    case X86_STATUS_END_OF_INPUT:
+        fprintf(stderr, "Error: reached end of input\n");
+        break;
+    case X86_STATUS_INPUT_ERROR:
+        perror("Error when reading input");
+        break;
+    }
+    
+    return EXIT_FAILURE;
+}
+
+/* Runs the compiled program the way the options say: once with the standard
+ * streams, on the inputs of -batch or for each client of -server. */
+static void run_compiled_program(const jit_compiled_program *compiled, const struct options *options) {
+    if(options->batch_dir != NULL) {
+        batch_run_program(compiled, options);
+    } else if(options->server_socket != NULL) {
+        server_run_program(compiled, options);
+    } else if(jit_interpreter_run_compiled_program(compiled) != EXIT_SUCCESS) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void jit_interpreter_run_program(const struct node *program, const struct options *options) {
+    if(use_baseline_jit(options)) {
+        stencil_compiled_program *compiled = stencil_compiled_program_create(program);
+        
+        stencil_compiled_program_get_main(compiled)();
+        
+        stencil_compiled_program_free(compiled);
+        return;
+    }
+    
+    jit_compiled_program *compiled = jit_compiled_program_create(program, options);
+    
+    if(compiled == NULL) {
+        fprintf(stderr, "Error: memory allocation (JIT code)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    /* before running it, since the program can end with an error */
+    if(options->jit_cache != NULL) {
+        jit_cache_store(compiled, options);
+    }
+    
+    run_compiled_program(compiled, options);
+    
+    jit_compiled_program_free(compiled);
+}
+
+bool jit_interpreter_run_cached_program(const struct options *options) {
+    /* Only the code of the x86 code generator is cached, the baseline JIT is
+     * fast enough without. */
+    if(options->jit_cache == NULL || use_baseline_jit(options)) {
+        return false;
+    }
+    
+    jit_compiled_program *compiled = jit_cache_load(options);
+    
+    if(compiled == NULL) {
+        return false;
+    }
+    
+    run_compiled_program(compiled, options);
     
     jit_compiled_program_free(compiled);
+    return true;
 }
@@ -31,8 +31,20 @@
 #ifndef BFC_JIT_INTERPRETER_H
 #define BFC_JIT_INTERPRETER_H
 
+#include <stdbool.h>
+#include "../app/options.h"
+#include "../backend/jit.h"
 #include "../ir/node.h"
 
-void jit_interpreter_run_program(const struct node *program);
+void jit_interpreter_run_program(const struct node *program, const struct options *options);
+
+/* Runs the program from the code cache (see -jit-cache) if it is there.
+ * Returns false if it has to be compiled with jit_interpreter_run_program(). */
+bool jit_interpreter_run_cached_program(const struct options *options);
+
+/* Runs a program compiled by the x86 code generator once, on a new tape with
+ * the standard streams. Errors are reported on standard error. Returns the
+ * exit status for the process. */
+int jit_interpreter_run_compiled_program(const jit_compiled_program *compiled);
 
 #endif
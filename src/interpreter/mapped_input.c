@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for fileno(), fseeko() and posix_madvise() */
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "mapped_input.h"
+
+void mapped_input_open(struct mapped_input *mapped, FILE *f, jit_io_context *context) {
+    mapped->f = f;
+    mapped->data = NULL;
+    mapped->size = 0;
+    context->input_position = NULL;
+    context->input_end = NULL;
+    
+    /* streams that are not on a file descriptor have none */
+    int fd = fileno(f);
+    struct stat st;
+    
+    if(fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+    
+    /* The stream may not be at the start of the file, e.g. when it is
+     * shared with a shell that already read part of it. */
+    off_t offset = ftello(f);
+    
+    if(offset < 0 || offset >= st.st_size) {
+        return;
+    }
+    
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    
+    if(data == MAP_FAILED) {
+        return;
+    }
+    
+    /* whatever is appended to the file from now on is read from the stream */
+    if(fseeko(f, st.st_size, SEEK_SET) < 0) {
+        munmap(data, st.st_size);
+        return;
+    }
+    
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+    
+    mapped->data = data;
+    mapped->size = st.st_size;
+    context->input_position = (const unsigned char *)data + offset;
+    context->input_end = (const unsigned char *)data + st.st_size;
+}
+
+void mapped_input_close(struct mapped_input *mapped, const jit_io_context *context) {
+    if(mapped->data == NULL) {
+        return;
+    }
+    
+    if(context->input_position < context->input_end) {
+        off_t consumed = context->input_position - (const unsigned char *)mapped->data;
+        
+        /* The C library may fill its buffer when seeking, flushing an input
+         * stream puts the file offset back where the stream is. */
+        if(fseeko(mapped->f, consumed, SEEK_SET) == 0) {
+            fflush(mapped->f);
+        }
+    }
+    
+    munmap(mapped->data, mapped->size);
+}
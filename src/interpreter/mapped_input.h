@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BFC_MAPPED_INPUT_H
+#define BFC_MAPPED_INPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "../backend/jit.h"
+
+struct mapped_input {
+    FILE *f;
+    void *data;
+    size_t size;
+};
+
+/* If the stream is on a regular file, maps what is left of the file and has
+ * the program read it from memory before going back to the stream, which is
+ * moved past the mapped part. Otherwise, or if the file cannot be mapped,
+ * the program reads from the stream as usual. */
+void mapped_input_open(struct mapped_input *mapped, FILE *f, jit_io_context *context);
+
+/* Unmaps the file and, if the program did not read all of the mapped part,
+ * moves the stream back to the first byte it did not read, so the next
+ * reader of the file, e.g. another process sharing it, starts there. */
+void mapped_input_close(struct mapped_input *mapped, const jit_io_context *context);
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for sigaction() and SCM_RIGHTS */
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "jit.h"
+#include "server.h"
+
+/* A request is a single byte sent along with the standard input, output and
+ * error of the client. The reply is the exit status of the run, also a single
+ * byte, sent by the child process once the output is flushed. If the child
+ * dies without sending it, the client sees the connection close. */
+#define NUM_STREAMS 3
+
+static void set_address(struct sockaddr_un *address, const char *path) {
+    if(strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+}
+
+static int create_socket(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    
+    if(fd < 0) {
+        perror("Error when creating socket");
+        exit(EXIT_FAILURE);
+    }
+    
+    return fd;
+}
+
+/* Receives the request of the client into the standard streams of the
+ * calling process. Returns false if the client did not send a request. */
+static bool receive_streams(int connection) {
+    char byte;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(NUM_STREAMS * sizeof(int))];
+    } control;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    
+    if(recvmsg(connection, &msg, 0) <= 0) {
+        return false;
+    }
+    
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    
+    if(cmsg == NULL
+        || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(NUM_STREAMS * sizeof(int))) {
+        return false;
+    }
+    
+    int fds[NUM_STREAMS];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    
+    for(int idx = 0; idx < NUM_STREAMS; ++idx) {
+        if(dup2(fds[idx], idx) < 0) {
+            return false;
+        }
+        close(fds[idx]);
+    }
+    
+    return true;
+}
+
+/* Runs in the child process forked for a client, on a copy of the server's
+ * memory, so the program is not compiled again. */
+static void serve_client(const jit_compiled_program *compiled, int connection) {
+    if(! receive_streams(connection)) {
+        _exit(EXIT_FAILURE);
+    }
+    
+    int status = jit_interpreter_run_compiled_program(compiled);
+    
+    /* all the output must be out by the time the client returns */
+    if(fflush(stdout) != 0) {
+        status = EXIT_FAILURE;
+    }
+    
+    unsigned char reply = status;
+    
+    if(write(connection, &reply, 1) != 1) {
+        status = EXIT_FAILURE;
+    }
+    
+    _exit(status);
+}
+
+void server_run_program(const jit_compiled_program *compiled, const struct options *options) {
+    struct sockaddr_un address;
+    set_address(&address, options->server_socket);
+    
+    /* Replace the socket left behind by a previous server, but nothing else. */
+    struct stat st;
+    
+    if(stat(options->server_socket, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(options->server_socket);
+    }
+    
+    int listener = create_socket();
+    
+    if(bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "Error: cannot bind socket '%s': %s\n", options->server_socket, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    if(listen(listener, SOMAXCONN) < 0) {
+        perror("Error when listening on socket");
+        exit(EXIT_FAILURE);
+    }
+    
+    /* The children report to their client directly, so the server never
+     * waits for them and they are reaped by the system. */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+    
+    /* Nothing must be left in the buffers the children inherit. */
+    fflush(NULL);
+    
+    while(true) {
+        int connection = accept(listener, NULL, NULL);
+        
+        if(connection < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("Error when accepting connection");
+            exit(EXIT_FAILURE);
+        }
+        
+        pid_t pid = fork();
+        
+        if(pid == 0) {
+            close(listener);
+            serve_client(compiled, connection);
+        }
+        
+        if(pid < 0) {
+            /* the client sees its connection close without a reply */
+            perror("Error when creating process");
+        }
+        
+        close(connection);
+    }
+}
+
+int server_connect(const struct options *options) {
+    struct sockaddr_un address;
+    set_address(&address, options->server_socket);
+    
+    int connection = create_socket();
+    
+    if(connect(connection, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "Error: cannot connect to server '%s': %s\n", options->server_socket, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    
+    char byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(NUM_STREAMS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(NUM_STREAMS * sizeof(int));
+    
+    int fds[NUM_STREAMS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    
+    if(sendmsg(connection, &msg, 0) != 1) {
+        perror("Error when sending request");
+        exit(EXIT_FAILURE);
+    }
+    
+    unsigned char reply;
+    ssize_t count;
+    
+    do {
+        count = read(connection, &reply, 1);
+    } while(count < 0 && errno == EINTR);
+    
+    if(count != 1) {
+        fprintf(stderr, "Error: the server did not report the end of the run\n");
+        return EXIT_FAILURE;
+    }
+    
+    close(connection);
+    
+    return reply;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dump.h"
+#include "query.h"
+
+#define INDENT "    "
+
+static const char *node_type_names[] = {
+    [NODE_ADD]          = "add",
+    [NODE_ADD2]         = "add2",
+    [NODE_SET]          = "set",
+    [NODE_RIGHT]        = "right",
+    [NODE_IN]           = "in",
+    [NODE_OUT]          = "out",
+    [NODE_LOOP]         = "loop",
+    [NODE_STATIC_LOOP]  = "static_loop",
+    [NODE_CHECK_RIGHT]  = "check_right",
+    [NODE_CHECK_LEFT]   = "check_left",
+};
+
+static void dump_indent(FILE *f, int loop_level) {
+    for(int idx = 0; idx < loop_level; ++idx) {
+        fprintf(f, INDENT);
+    }
+}
+
+static void dump_recursive(FILE *f, const struct node *node, int loop_level) {
+    while(node != NULL) {
+        dump_indent(f, loop_level);
+        fprintf(f, "%s", node_type_names[node->type]);
+        
+        switch(node->type) {
+        case NODE_ADD:
+        case NODE_SET:
+            fprintf(f, " %d @%d", node->n, node->offset);
+            break;
+        case NODE_ADD2:
+            fprintf(f, " @%d += @%d", node->offset, node->n);
+            break;
+        case NODE_RIGHT:
+            fprintf(f, " %d", node->n);
+            break;
+        case NODE_IN:
+        case NODE_OUT:
+        case NODE_LOOP:
+        case NODE_STATIC_LOOP:
+        case NODE_CHECK_RIGHT:
+        case NODE_CHECK_LEFT:
+            fprintf(f, " @%d", node->offset);
+            break;
+        }
+        
+        if(node->position.line > 0) {
+            fprintf(f, " ; %d:%d", node->position.line, node->position.column);
+        }
+        
+        fprintf(f, "\n");
+        
+        if(node_is_loop(node)) {
+            dump_recursive(f, node->body, loop_level + 1);
+            dump_indent(f, loop_level);
+            fprintf(f, "end\n");
+        }
+        
+        node = node->next;
+    }
+}
+
+void tree_dump(FILE *f, const struct node *root) {
+    dump_recursive(f, root, 0);
+}
@@ -115,11 +115,16 @@ struct node *node_new_check_left(int offset) {
     return node;
 }
 
+void node_copy_position(struct node *dest, const struct node *src) {
+    dest->position = src->position;
+}
+
 struct node *node_clone(struct node *node) {
     struct node *clone = node_new(node->type);
     
     clone->n = node->n;
     clone->offset = node->offset;
+    node_copy_position(clone, node);
     
     if(node_is_loop(node)) {
         clone->body = node_clone_tree(node->body);
@@ -60,6 +60,11 @@ typedef enum {
     NODE_CHECK_LEFT,
 } node_type;
 
+struct position {
+    int line;
+    int column;
+};
+
 struct node {
     /* node type */
     node_type type;
@@ -71,6 +76,9 @@ struct node {
     struct node *next;
     /* for NODE_LOOP nodes only: first node inside the loop body */
     struct node *body;
+    /* position in the source program of the instruction this node was
+     * generated from (line zero if unknown) */
+    struct position position;
 };
 
 struct node *node_new_add(int n, int offset);
@@ -93,6 +101,8 @@ struct node *node_new_check_right(int offset);
 
 struct node *node_new_check_left(int offset);
 
+void node_copy_position(struct node *dest, const struct node *src);
+
 struct node *node_clone(struct node *node);
 
 struct node *node_clone_tree(struct node *root);
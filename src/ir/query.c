@@ -52,3 +52,30 @@ bool tree_has_node_type(const struct node *root, node_type type) {
     
     return false;
 }
+
+bool tree_is_equal(const struct node *left, const struct node *right) {
+    /* positions are deliberately ignored: two trees are equal if they
+     * describe the same program */
+    while(left != NULL && right != NULL) {
+        if(left->type != right->type || left->n != right->n || left->offset != right->offset) {
+            return false;
+        }
+        
+        if(node_is_loop(left) && !tree_is_equal(left->body, right->body)) {
+            return false;
+        }
+        
+        left = left->next;
+        right = right->next;
+    }
+    
+    return left == NULL && right == NULL;
+}
+
+bool node_is_equal(const struct node *left, const struct node *right) {
+    if(left->type != right->type || left->n != right->n || left->offset != right->offset) {
+        return false;
+    }
+    
+    return !node_is_loop(left) || tree_is_equal(left->body, right->body);
+}
@@ -38,4 +38,10 @@ bool node_is_loop(const struct node *node);
 
 bool tree_has_node_type(const struct node *root, node_type type);
 
+bool tree_is_equal(const struct node *left, const struct node *right);
+
+/* Compares two nodes, including the body of loops, but not the nodes that
+ * follow them. */
+bool node_is_equal(const struct node *left, const struct node *right);
+
 #endif
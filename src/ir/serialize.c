@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "builder.h"
+#include "query.h"
+#include "serialize.h"
+
+/* to be incremented whenever the header, the records or the meaning of the
+ * node types change */
+#define FORMAT_VERSION      1
+/* written in the byte order of the machine, so a file written on a machine
+ * with the other byte order is recognized */
+#define BYTE_ORDER_MARK     0x01020304
+
+struct header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t optimization_level;
+    uint32_t num_records;
+};
+
+struct record {
+    int32_t type;
+    int32_t n;
+    int32_t offset;
+    /* number of records in the body of a loop, including those of nested
+     * loops, and zero for other nodes */
+    int32_t body_size;
+};
+
+static const char magic[4] = {'B', 'F', 'I', 'R'};
+
+uint32_t tree_count_records(const struct node *node) {
+    uint32_t count = 0;
+    
+    for(; node != NULL; node = node->next) {
+        ++count;
+        
+        if(node_is_loop(node)) {
+            count += tree_count_records(node->body);
+        }
+    }
+    
+    return count;
+}
+
+/* Fills the records of the nodes and of their bodies and returns their
+ * number, which is the body size of the parent loop. */
+static uint32_t fill_records(struct record *records, const struct node *node) {
+    uint32_t count = 0;
+    
+    for(; node != NULL; node = node->next) {
+        struct record *record = &records[count++];
+        record->type = node->type;
+        record->n = node->n;
+        record->offset = node->offset;
+        record->body_size = 0;
+        
+        if(node_is_loop(node)) {
+            record->body_size = fill_records(&records[count], node->body);
+            count += record->body_size;
+        }
+    }
+    
+    return count;
+}
+
+bool tree_write_records(FILE *f, const struct node *root) {
+    uint32_t count = tree_count_records(root);
+    /* never ask malloc() for zero bytes so NULL always means failure */
+    struct record *records = malloc(count > 0 ? count * sizeof(struct record) : 1);
+    
+    if(records == NULL) {
+        fprintf(stderr, "Error: memory allocation (IR records)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    fill_records(records, root);
+    
+    bool success = fwrite(records, sizeof(struct record), count, f) == count;
+    
+    free(records);
+    
+    return success;
+}
+
+bool tree_serialize(FILE *f, const struct node *root, int optimization_level) {
+    struct header header;
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = FORMAT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.optimization_level = optimization_level;
+    header.num_records = tree_count_records(root);
+    
+    if(fwrite(&header, sizeof(header), 1, f) != 1) {
+        return false;
+    }
+    
+    return tree_write_records(f, root);
+}
+
+static struct node *new_node(const struct record *record, struct node *body) {
+    switch(record->type) {
+    case NODE_ADD:
+        return node_new_add(record->n, record->offset);
+    case NODE_ADD2:
+        return node_new_add2(record->offset, record->n);
+    case NODE_SET:
+        return node_new_set(record->n, record->offset);
+    case NODE_RIGHT:
+        return node_new_right(record->n);
+    case NODE_IN:
+        return node_new_in(record->offset);
+    case NODE_OUT:
+        return node_new_out(record->offset);
+    case NODE_LOOP:
+        return node_new_loop(body, record->offset);
+    case NODE_STATIC_LOOP:
+        return node_new_static_loop(body, record->offset);
+    case NODE_CHECK_RIGHT:
+        return node_new_check_right(record->offset);
+    case NODE_CHECK_LEFT:
+        return node_new_check_left(record->offset);
+    default:
+        return NULL;
+    }
+}
+
+/* Frees the nodes built so far if a record is invalid. */
+static bool read_records(struct node **nodes, const struct record *records, uint32_t count) {
+    struct builder builder;
+    builder_initialize_empty(&builder);
+    
+    uint32_t index = 0;
+    
+    while(index < count) {
+        const struct record *record = &records[index++];
+        bool is_loop = record->type == NODE_LOOP || record->type == NODE_STATIC_LOOP;
+        struct node *body = NULL;
+        
+        if(record->body_size < 0 || (!is_loop && record->body_size != 0)) {
+            node_free(builder_get_first(&builder));
+            return false;
+        }
+        
+        uint32_t body_size = record->body_size;
+        
+        if(body_size > count - index || !read_records(&body, &records[index], body_size)) {
+            node_free(builder_get_first(&builder));
+            return false;
+        }
+        
+        index += body_size;
+        
+        struct node *node = new_node(record, body);
+        
+        if(node == NULL) {
+            node_free(body);
+            node_free(builder_get_first(&builder));
+            return false;
+        }
+        
+        builder_append_node(&builder, node);
+    }
+    
+    *nodes = builder_get_first(&builder);
+    return true;
+}
+
+bool tree_deserialize(
+    struct node **root,
+    int *optimization_level,
+    const void *data,
+    size_t size
+) {
+    const struct header *header = data;
+    
+    if(size < sizeof(struct header)) {
+        return false;
+    }
+    
+    if(memcmp(header->magic, magic, sizeof(magic)) != 0) {
+        return false;
+    }
+    
+    if(header->version != FORMAT_VERSION || header->byte_order != BYTE_ORDER_MARK) {
+        return false;
+    }
+    
+    if(size - sizeof(struct header) != (size_t)header->num_records * sizeof(struct record)) {
+        return false;
+    }
+    
+    if(header->optimization_level < 0 || header->optimization_level > 3) {
+        return false;
+    }
+    
+    *optimization_level = header->optimization_level;
+    
+    return tree_read_records(root, header + 1, header->num_records);
+}
+
+bool tree_read_records(struct node **root, const void *records, uint32_t count) {
+    return read_records(root, records, count);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BFC_IR_SERIALIZE_H
+#define BFC_IR_SERIALIZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "node.h"
+
+/* Binary format of optimized programs (.bfir files, see -emit-ir and
+ * -from-ir): a header followed by one fixed-size record per node, in
+ * program order, with the body of each loop right after the loop's record.
+ * The records are aligned, so they can be read in place from a mapping of
+ * the file. Source positions are not kept since they are only used by the
+ * remarks of the optimization passes, which do not run on these programs. */
+
+/* Writes the program with the optimization level it was optimized at.
+ * Returns false on write error. */
+bool tree_serialize(FILE *f, const struct node *root, int optimization_level);
+
+/* Builds the tree of a program written by tree_serialize(). Returns false if
+ * the data is not a valid program for this version of the format. */
+bool tree_deserialize(
+    struct node **root,
+    int *optimization_level,
+    const void *data,
+    size_t size
+);
+
+/* The records alone, for files that store several programs (see
+ * -incremental). A record is IR_RECORD_SIZE bytes and 4-byte aligned. */
+#define IR_RECORD_SIZE 16
+
+uint32_t tree_count_records(const struct node *root);
+
+/* Returns false on write error. */
+bool tree_write_records(FILE *f, const struct node *root);
+
+/* Builds the tree of the specified number of records, which must be in
+ * bounds. Returns false if a record is invalid. */
+bool tree_read_records(struct node **root, const void *records, uint32_t count);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE /* for fopencookie() */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../app/options.h"
+#include "../backend/jit.h"
+#include "../frontend/parser.h"
+#include "../ir/node.h"
+#include "../optimizations/optimizations.h"
+#include "libbf.h"
+
+#define TAPE_SIZE 30000
+
+struct bf_program {
+    jit_compiled_program *compiled;
+};
+
+/* The parser exits on unmatched brackets, so they are checked first. */
+static bool has_matching_brackets(const char *source, size_t length) {
+    size_t depth = 0;
+    
+    for(size_t idx = 0; idx < length; ++idx) {
+        if(source[idx] == '[') {
+            ++depth;
+        } else if(source[idx] == ']') {
+            if(depth == 0) {
+                return false;
+            }
+            --depth;
+        }
+    }
+    
+    return depth == 0;
+}
+
+bf_status bf_compile(const char *source, size_t length, int optimization_level, bf_program **program) {
+    if(program == NULL || (source == NULL && length > 0) || optimization_level < 0 || optimization_level > 3) {
+        return BF_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if(! has_matching_brackets(source, length)) {
+        return BF_ERROR_SYNTAX;
+    }
+    
+    struct options options;
+    options_set_defaults(&options);
+    options.optimization_level = optimization_level;
+    
+    /* fmemopen() may not accept an empty buffer, and there is nothing to
+     * parse in it anyway */
+    struct node *parsed = NULL;
+    
+    if(length > 0) {
+        FILE *f = fmemopen((void *)source, length, "r");
+        
+        if(f == NULL) {
+            return BF_ERROR_MEMORY;
+        }
+        
+        parsed = parse_program(f);
+        fclose(f);
+    }
+    
+    struct node *optimized = run_optimizations(parsed, &options);
+    node_free(parsed);
+    
+    bf_program *result = malloc(sizeof(bf_program));
+    
+    if(result == NULL) {
+        node_free(optimized);
+        return BF_ERROR_MEMORY;
+    }
+    
+    result->compiled = jit_compiled_program_create(optimized, &options);
+    node_free(optimized);
+    
+    if(result->compiled == NULL) {
+        free(result);
+        return BF_ERROR_MEMORY;
+    }
+    
+    *program = result;
+    return BF_SUCCESS;
+}
+
+void bf_program_free(bf_program *program) {
+    if(program == NULL) {
+        return;
+    }
+    
+    jit_compiled_program_free(program->compiled);
+    free(program);
+}
+
+static ssize_t read_stream(void *cookie, char *buffer, size_t size) {
+    const bf_io *io = cookie;
+    
+    if(io->read == NULL) {
+        return 0;
+    }
+    
+    return io->read(io->user, buffer, size);
+}
+
+/* The C library expects 0, not -1, when a write fails. */
+static ssize_t write_stream(void *cookie, const char *buffer, size_t size) {
+    const bf_io *io = cookie;
+    
+    if(io->write == NULL) {
+        return size;
+    }
+    
+    ssize_t count = io->write(io->user, buffer, size);
+    
+    return count < 0 ? 0 : count;
+}
+
+/* Opens a stream on the callbacks. Only the calling thread uses it, so it is
+ * not locked on each character. */
+static FILE *open_stream(const bf_io *io, const char *mode) {
+    cookie_io_functions_t functions;
+    memset(&functions, 0, sizeof(functions));
+    functions.read = read_stream;
+    functions.write = write_stream;
+    
+    FILE *f = fopencookie((void *)io, mode, functions);
+    
+    if(f != NULL) {
+        __fsetlocking(f, FSETLOCKING_BYCALLER);
+    }
+    
+    return f;
+}
+
+/* The input_size bytes of input_data are read before the input stream,
+ * directly by the generated code. */
+static bf_status run_streams(
+    const bf_program *program,
+    FILE *input,
+    FILE *output,
+    const char *input_data,
+    size_t input_size
+) {
+    unsigned char *tape = calloc(TAPE_SIZE + JIT_TAPE_PADDING, 1);
+    
+    if(tape == NULL) {
+        return BF_ERROR_MEMORY;
+    }
+    
+    jit_io_context context;
+    context.input = input;
+    context.output = output;
+    context.input_position = NULL;
+    context.input_end = NULL;
+    
+    if(input_size > 0) {
+        context.input_position = (const unsigned char *)input_data;
+        context.input_end = context.input_position + input_size;
+    }
+    
+    jit_status status = jit_compiled_program_get_main(program->compiled)(tape, TAPE_SIZE, &context);
+    
+    free(tape);
+    
+    /* the output is flushed in any case, but an error of the program comes
+     * first */
+    bool output_failed = fflush(output) != 0 || ferror(output);
+    
+    switch(status) {
+    case X86_STATUS_SUCCESS:
+        break;
+    case X86_STATUS_TOO_FAR_RIGHT:
+        return BF_ERROR_TOO_FAR_RIGHT;
+    case X86_STATUS_TOO_FAR_LEFT:
+        return BF_ERROR_TOO_FAR_LEFT;
+    case X86_STATUS_END_OF_INPUT:
+        return BF_ERROR_END_OF_INPUT;
+    case X86_STATUS_INPUT_ERROR:
+        return BF_ERROR_INPUT;
+    }
+    
+    return output_failed ? BF_ERROR_OUTPUT : BF_SUCCESS;
+}
+
+static bf_status run_io(const bf_program *program, const bf_io *io, const char *input_data, size_t input_size) {
+    FILE *input = open_stream(io, "r");
+    
+    if(input == NULL) {
+        return BF_ERROR_MEMORY;
+    }
+    
+    FILE *output = open_stream(io, "w");
+    
+    if(output == NULL) {
+        fclose(input);
+        return BF_ERROR_MEMORY;
+    }
+    
+    bf_status status = run_streams(program, input, output, input_data, input_size);
+    
+    fclose(input);
+    fclose(output);
+    
+    return status;
+}
+
+bf_status bf_run(const bf_program *program, const bf_io *io) {
+    if(program == NULL || io == NULL) {
+        return BF_ERROR_INVALID_ARGUMENT;
+    }
+    
+    return run_io(program, io, NULL, 0);
+}
+
+struct output_buffer {
+    char *data;
+    size_t size;
+    size_t position;
+};
+
+/* Copies what fits, a short count telling the C library the rest failed. */
+static ssize_t write_buffer(void *user, const char *buffer, size_t size) {
+    struct output_buffer *output = user;
+    size_t count = output->size - output->position;
+    
+    if(count > size) {
+        count = size;
+    }
+    
+    memcpy(&output->data[output->position], buffer, count);
+    output->position += count;
+    
+    return count;
+}
+
+/* The input is read by the generated code where it is, and the input stream
+ * only has the end of the input. */
+bf_status bf_run_buffers(
+    const bf_program *program,
+    const char *input,
+    size_t input_size,
+    char *output,
+    size_t output_size,
+    size_t *output_length
+) {
+    if(program == NULL || (input == NULL && input_size > 0) || (output == NULL && output_size > 0)) {
+        return BF_ERROR_INVALID_ARGUMENT;
+    }
+    
+    struct output_buffer buffer;
+    buffer.data = output;
+    buffer.size = output_size;
+    buffer.position = 0;
+    
+    bf_io io;
+    io.read = NULL;
+    io.write = write_buffer;
+    io.user = &buffer;
+    
+    bf_status status = run_io(program, &io, input, input_size);
+    
+    if(output_length != NULL) {
+        *output_length = buffer.position;
+    }
+    
+    return status;
+}
+
+const char *bf_status_message(bf_status status) {
+    switch(status) {
+    case BF_SUCCESS:
+        return "success";
+    case BF_ERROR_SYNTAX:
+        return "unmatched '[' or ']'";
+    case BF_ERROR_INVALID_ARGUMENT:
+        return "invalid argument";
+    case BF_ERROR_MEMORY:
+        return "memory allocation";
+    case BF_ERROR_TOO_FAR_RIGHT:
+        return "memory position out of bounds (overflow - too far right)";
+    case BF_ERROR_TOO_FAR_LEFT:
+        return "memory position out of bounds (underflow - too far left)";
+    case BF_ERROR_END_OF_INPUT:
+        return "reached end of input";
+    case BF_ERROR_INPUT:
+        return "error when reading input";
+    case BF_ERROR_OUTPUT:
+        return "error when writing output";
+    }
+    
+    return "unknown status";
+}
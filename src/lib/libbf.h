@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBBF_H
+#define LIBBF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#if defined(__GNUC__)
+#define BF_API __attribute__((visibility("default")))
+#else
+#define BF_API
+#endif
+
+typedef enum {
+    BF_SUCCESS = 0,
+    /* the program has an unmatched '[' or ']' */
+    BF_ERROR_SYNTAX,
+    /* the optimization level is not between 0 and 3 */
+    BF_ERROR_INVALID_ARGUMENT,
+    /* memory could not be allocated, or the machine code made executable */
+    BF_ERROR_MEMORY,
+    /* the program moved past the end of the tape */
+    BF_ERROR_TOO_FAR_RIGHT,
+    /* the program moved before the start of the tape */
+    BF_ERROR_TOO_FAR_LEFT,
+    /* the program read past the end of its input */
+    BF_ERROR_END_OF_INPUT,
+    /* the read callback failed */
+    BF_ERROR_INPUT,
+    /* the output buffer is full or the write callback failed */
+    BF_ERROR_OUTPUT
+} bf_status;
+
+/* A program compiled to machine code. It has no state of its own, so it can
+ * be run any number of times, by several threads at once. */
+typedef struct bf_program bf_program;
+
+/* Callbacks through which a run reads its input and writes its output. Both
+ * are buffered, so they are called with blocks of bytes rather than for each
+ * instruction of the program. */
+typedef struct {
+    /* Reads up to size bytes into buffer. Returns the number of bytes read,
+     * 0 at the end of the input or -1 on error. */
+    ssize_t (*read)(void *user, char *buffer, size_t size);
+    /* Writes the size bytes of buffer. Returns the number of bytes written,
+     * anything less than size being an error. */
+    ssize_t (*write)(void *user, const char *buffer, size_t size);
+    /* passed as is to the callbacks */
+    void *user;
+} bf_io;
+
+/* Parses, optimizes and compiles the length bytes of source at the specified
+ * optimization level (0 to 3, 3 being the default of bf). On success, stores
+ * the compiled program in *program. Several threads can compile programs at
+ * once: the compiler keeps its working memory per thread. */
+BF_API bf_status bf_compile(const char *source, size_t length, int optimization_level, bf_program **program);
+
+BF_API void bf_program_free(bf_program *program);
+
+/* Runs the program on a new tape with the callbacks of io for input and
+ * output. The output written before an error is still passed to the write
+ * callback. */
+BF_API bf_status bf_run(const bf_program *program, const bf_io *io);
+
+/* Runs the program on a new tape with the input_size bytes of input as its
+ * input. The output is written to the output_size bytes of output and the
+ * number of bytes written is stored in *output_length, which can be NULL. */
+BF_API bf_status bf_run_buffers(
+    const bf_program *program,
+    const char *input,
+    size_t input_size,
+    char *output,
+    size_t output_size,
+    size_t *output_length
+);
+
+/* Returns a description of the status, e.g. for an error message. */
+BF_API const char *bf_status_message(bf_status status);
+
+#endif
@@ -189,13 +189,12 @@ static struct node *insert_bound_checks_recursive(
         builder_append_tree(&builder, builder_get_first(&segment_builder));
         
         if(node != NULL) {
-            builder_append_node(
-                &builder,
-                node_new_loop(
-                    insert_bound_checks_recursive(node->body, loop_level + 1, node->offset),
-                    node->offset
-                )
+            struct node *loop = node_new_loop(
+                insert_bound_checks_recursive(node->body, loop_level + 1, node->offset),
+                node->offset
             );
+            node_copy_position(loop, node);
+            builder_append_node(&builder, loop);
             /* When we get back from a nested loop, that loop's offset is known
              * to be safe to access (and this loop's offset might not be because
              * we have no idea how the nested loop has affected the data pointer). */
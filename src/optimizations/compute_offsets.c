@@ -32,13 +32,15 @@
 #include <stddef.h>
 #include "../ir/builder.h"
 #include "compute_offsets.h"
+#include "remarks.h"
 
 /* forward declaration since this function is mutually recursive with
  * compute_offsets(). */
 static struct node *loop_elimination_recursive(
-    struct node *node,
+    struct node *loop,
     int loop_level,
-    int loop_offset
+    int loop_offset,
+    const struct options *options
 );
 
 static int compute_scanning_offset(struct node *node) {
@@ -58,7 +60,8 @@ static struct node *compute_offsets_in_body(
     struct node *node,
     int loop_level,
     int loop_offset,
-    int scanning_offset
+    int scanning_offset,
+    const struct options *options
 ) {
     struct builder builder;
     builder_initialize_empty(&builder);
@@ -70,24 +73,23 @@ static struct node *compute_offsets_in_body(
     int offset = loop_offset - scanning_offset;
     
     while(node != NULL) {
+        struct node *offset_node = NULL;
+        
         switch(node->type) {
         case NODE_RIGHT:
             offset += node->n;
             break;
         case NODE_ADD:
-            builder_append_node(&builder, node_new_add(node->n, node->offset + offset));
+            offset_node = node_new_add(node->n, node->offset + offset);
             break;
         case NODE_IN:
-            builder_append_node(&builder, node_new_in(node->offset + offset));
+            offset_node = node_new_in(node->offset + offset);
             break;
         case NODE_OUT:
-            builder_append_node(&builder, node_new_out(node->offset + offset));
+            offset_node = node_new_out(node->offset + offset);
             break;
         case NODE_LOOP:
-            builder_append_node(
-                &builder,
-                loop_elimination_recursive(node->body, loop_level + 1, offset)
-            );
+            offset_node = loop_elimination_recursive(node, loop_level + 1, offset, options);
             break;
         case NODE_SET:
         case NODE_ADD2:
@@ -98,17 +100,35 @@ static struct node *compute_offsets_in_body(
             break;
         }
         
+        if(offset_node != NULL) {
+            node_copy_position(offset_node, node);
+            builder_append_node(&builder, offset_node);
+        }
+        
         node = node->next;
     }
     
+    /* The next part of the program expects the data pointer on the cell
+     * where this part left off. */
+    if(loop_level == 0 && options->program_part != PART_WHOLE && offset != 0) {
+        builder_append_node(&builder, node_new_right(offset));
+    }
+    
     return builder_get_first(&builder);
 }
 
-static bool loop_body_is_static(struct node *node) {
+static bool loop_body_is_static(
+    const struct node *loop,
+    struct node *node,
+    const struct options *options
+) {
     while(node != NULL) {
         switch(node->type) {
         case NODE_RIGHT:
+            remark_missed(options, loop, "offsets", "net pointer shift is %d", node->n);
+            return false;
         case NODE_LOOP:
+            remark_missed(options, loop, "offsets", "contains a non-static loop");
             return false;
         default:
             break;
@@ -120,24 +140,28 @@ static bool loop_body_is_static(struct node *node) {
 }
 
 static struct node *loop_elimination_recursive(
-    struct node *node,
+    struct node *loop,
     int loop_level,
-    int loop_offset
+    int loop_offset,
+    const struct options *options
 ) {
+    int scanning_offset = compute_scanning_offset(loop->body);
+    
     struct node *body = compute_offsets_in_body(
-        node,
+        loop->body,
         loop_level,
         loop_offset,
-        compute_scanning_offset(node)
+        scanning_offset,
+        options
     );
     
-    if(loop_body_is_static(body)) {
+    if(loop_body_is_static(loop, body, options)) {
         return node_new_static_loop(body, loop_offset);
     } else {
         return node_new_loop(body, loop_offset);
     }
 }
 
-struct node *compute_offsets(struct node *node) {
-    return compute_offsets_in_body(node, 0, 0, 0);
+struct node *compute_offsets(struct node *node, const struct options *options) {
+    return compute_offsets_in_body(node, 0, 0, 0, options);
 }
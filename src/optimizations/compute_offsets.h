@@ -31,8 +31,9 @@
 #ifndef BFC_OPTIMIZATIONS_COMPUTE_OFFSETS_H
 #define BFC_OPTIMIZATIONS_COMPUTE_OFFSETS_H
 
+#include "../app/options.h"
 #include "../ir/node.h"
 
-struct node *compute_offsets(struct node *node);
+struct node *compute_offsets(struct node *node, const struct options *options);
 
 #endif
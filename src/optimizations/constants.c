@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../ir/builder.h"
+#include "constants.h"
+
+/* This pass propagates the values of memory cells that are known at compile
+ * time. At the start of the program, the data pointer is at position zero and
+ * all cells are zero, so, until the first non-static loop, the offsets of the
+ * top-level nodes are absolute positions and the value of any cell that was
+ * only assigned constants is known. This allows additions to be turned into
+ * assignments and loops on cells known to be zero to be removed. */
+
+#define MEMORY_SIZE 30000
+
+#define UNKNOWN -1
+
+struct state {
+    int *values;
+};
+
+static void initialize_state(struct state *state) {
+    state->values = malloc(MEMORY_SIZE * sizeof(int));
+    
+    if(state->values == NULL) {
+        fprintf(stderr, "Error: memory allocation (constants)\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    /* all cells are zero-initialized */
+    for(int idx = 0; idx < MEMORY_SIZE; ++idx) {
+        state->values[idx] = 0;
+    }
+}
+
+static void free_state(struct state *state) {
+    free(state->values);
+}
+
+static int get_value(const struct state *state, int offset) {
+    /* Accesses out of bounds are left alone so the bound checks, which are
+     * inserted later, still catch them. */
+    if(offset < 0 || offset >= MEMORY_SIZE) {
+        return UNKNOWN;
+    }
+    return state->values[offset];
+}
+
+static void set_value(struct state *state, int offset, int value) {
+    if(offset >= 0 && offset < MEMORY_SIZE) {
+        state->values[offset] = value;
+    }
+}
+
+static void forget_static_loop_body(struct state *state, const struct node *node) {
+    while(node != NULL) {
+        switch(node->type) {
+        case NODE_ADD:
+        case NODE_SET:
+        case NODE_ADD2:
+        case NODE_IN:
+            set_value(state, node->offset, UNKNOWN);
+            break;
+        case NODE_STATIC_LOOP:
+            forget_static_loop_body(state, node->body);
+            break;
+        default:
+            break;
+        }
+        node = node->next;
+    }
+}
+
+static struct node *propagate_constant(struct state *state, struct node *node) {
+    int value = get_value(state, node->offset);
+    
+    switch(node->type) {
+    case NODE_ADD:
+        if(value == UNKNOWN) {
+            return node_clone(node);
+        }
+        value = (value + node->n) & 0xff;
+        set_value(state, node->offset, value);
+        return node_new_set(value, node->offset);
+    case NODE_SET:
+        if(value == (node->n & 0xff)) {
+            return NULL;
+        }
+        set_value(state, node->offset, node->n & 0xff);
+        return node_clone(node);
+    case NODE_ADD2:
+        if(get_value(state, node->n) == 0) {
+            return NULL;
+        }
+        if(value != UNKNOWN && get_value(state, node->n) != UNKNOWN) {
+            value = (value + get_value(state, node->n)) & 0xff;
+            set_value(state, node->offset, value);
+            return node_new_set(value, node->offset);
+        }
+        set_value(state, node->offset, UNKNOWN);
+        return node_clone(node);
+    case NODE_IN:
+        set_value(state, node->offset, UNKNOWN);
+        return node_clone(node);
+    case NODE_STATIC_LOOP:
+        if(value == 0) {
+            return NULL;
+        }
+        forget_static_loop_body(state, node->body);
+        /* the loop only exits once its cell is zero */
+        set_value(state, node->offset, 0);
+        return node_clone(node);
+    default:
+        return node_clone(node);
+    }
+}
+
+struct node *propagate_constants(struct node *node) {
+    struct state state;
+    initialize_state(&state);
+    
+    struct builder builder;
+    builder_initialize_empty(&builder);
+    
+    while(node != NULL) {
+        if(node->type == NODE_LOOP) {
+            if(get_value(&state, node->offset) == 0) {
+                node = node->next;
+                continue;
+            }
+            
+            /* A non-static loop moves the data pointer by an unknown amount,
+             * after which nothing is known about the cells relative to it. */
+            break;
+        }
+        
+        struct node *propagated = propagate_constant(&state, node);
+        
+        if(propagated != NULL) {
+            node_copy_position(propagated, node);
+            builder_append_node(&builder, propagated);
+        }
+        
+        node = node->next;
+    }
+    
+    free_state(&state);
+    
+    if(node != NULL) {
+        builder_append_tree(&builder, node_clone_tree(node));
+    }
+    
+    return builder_get_first(&builder);
+}
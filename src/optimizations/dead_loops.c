@@ -38,7 +38,7 @@
  * on entry. Such loops are likely to be comments that contain instruction
  * characters. */
 
-struct node *remove_dead_loops_recursive(struct node *node, int level) {
+struct node *remove_dead_loops_recursive(struct node *node, int level, bool after_loop) {
     struct builder builder;
     builder_initialize_empty(&builder);
     
@@ -49,21 +49,24 @@ struct node *remove_dead_loops_recursive(struct node *node, int level) {
      * 
      * is_zero indicates the current cell is zero. It is initialized differently
      * at the beginning of the program (level == 0) but is relevant at all loop
-     * levels. */
+     * levels. A part of a program starts right after a loop, so its current
+     * cell is also zero. */
     bool is_zero = (level == 0);
     
     /* all_zero true means *all* memory is known to be zero. It is only relevant
      * at the beginning of the program. */
-    bool all_zero = (level == 0);
+    bool all_zero = (level == 0) && !after_loop;
     
     while(node != NULL) {
         switch(node->type) {
         case NODE_LOOP:
             if(!is_zero) {
-                struct node *body = remove_dead_loops_recursive(node->body, level + 1);
+                struct node *body = remove_dead_loops_recursive(node->body, level + 1, after_loop);
                 
                 if(body != NULL) {
-                    builder_append_node(&builder, node_new_loop(body, 0));
+                    struct node *loop = node_new_loop(body, 0);
+                    node_copy_position(loop, node);
+                    builder_append_node(&builder, loop);
                 }
             }
             /* On exiting a loop, the current cell is known to be zero. */
@@ -92,6 +95,6 @@ struct node *remove_dead_loops_recursive(struct node *node, int level) {
     return builder_get_first(&builder);
 }
 
-struct node *remove_dead_loops(struct node *node) {
-    return remove_dead_loops_recursive(node, 0);
+struct node *remove_dead_loops(struct node *node, bool after_loop) {
+    return remove_dead_loops_recursive(node, 0, after_loop);
 }
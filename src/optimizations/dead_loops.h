@@ -31,8 +31,11 @@
 #ifndef BFC_OPTIMIZATIONS_DEAD_LOOPS_H
 #define BFC_OPTIMIZATIONS_DEAD_LOOPS_H
 
+#include <stdbool.h>
 #include "../ir/node.h"
 
-struct node *remove_dead_loops(struct node *node);
+/* after_loop: the program is a part of a larger one that starts right after
+ * a loop instead of at the start of the program (see -incremental) */
+struct node *remove_dead_loops(struct node *node, bool after_loop);
 
 #endif
@@ -32,22 +32,40 @@
 #include <stddef.h>
 #include "../ir/builder.h"
 #include "loops.h"
-
-static struct node *fallback(struct node *loop) {
-    return node_new_static_loop(optimize_loops(loop->body), loop->offset);
+#include "remarks.h"
+
+static struct node *fallback(struct node *loop, const struct options *options) {
+    struct node *static_loop = node_new_static_loop(
+        optimize_loops(loop->body, options),
+        loop->offset
+    );
+    node_copy_position(static_loop, loop);
+    return static_loop;
 }
 
-static struct node *generate_single_offset(struct node *loop, int loop_increment) {
+static struct node *generate_single_offset(
+    struct node *loop,
+    int loop_increment,
+    const struct options *options
+) {
     if((loop_increment & 1) == 0) {
-        return fallback(loop);
+        remark_missed(options, loop, "loops", "counter step is %d", loop_increment);
+        return fallback(loop, options);
     }
 
-    return node_new_set(0, loop->offset);
+    struct node *set = node_new_set(0, loop->offset);
+    node_copy_position(set, loop);
+    return set;
 }
 
-static struct node *generate_multi_offset(struct node *loop, int loop_increment) {
+static struct node *generate_multi_offset(
+    struct node *loop,
+    int loop_increment,
+    const struct options *options
+) {
     if(loop_increment != -1) {
-        return fallback(loop);
+        remark_missed(options, loop, "loops", "counter step is %d", loop_increment);
+        return fallback(loop, options);
     }
 
     struct builder builder;
@@ -61,20 +79,34 @@ static struct node *generate_multi_offset(struct node *loop, int loop_increment)
         }
 
         if(node->n != 1) {
+            remark_missed(
+                options,
+                loop,
+                "loops",
+                "coefficient is %d at offset %d",
+                node->n,
+                node->offset - loop->offset
+            );
             needs_loop = true;
             continue;
         }
 
-        builder_append_node(&builder, node_new_add2(node->offset, loop->offset));
+        struct node *add2 = node_new_add2(node->offset, loop->offset);
+        node_copy_position(add2, node);
+        builder_append_node(&builder, add2);
     }
 
     if(!needs_loop) {
-        builder_append_node(&builder, node_new_set(0, loop->offset));
+        struct node *set = node_new_set(0, loop->offset);
+        node_copy_position(set, loop);
+        builder_append_node(&builder, set);
     } else {
         struct builder body_builder;
         builder_initialize_empty(&body_builder);
 
-        builder_append_node(&body_builder, node_new_add(-1, loop->offset));
+        struct node *counter = node_new_add(-1, loop->offset);
+        node_copy_position(counter, loop);
+        builder_append_node(&body_builder, counter);
 
         for(struct node *node = loop->body; node != NULL; node = node->next) {
             if(node->offset == loop->offset || node->n == 1) {
@@ -84,22 +116,29 @@ static struct node *generate_multi_offset(struct node *loop, int loop_increment)
             builder_append_node(&body_builder, node_clone(node));
         }
 
-        builder_append_node(
-            &builder,
-            node_new_static_loop(builder_get_first(&body_builder), loop->offset)
+        struct node *static_loop = node_new_static_loop(
+            builder_get_first(&body_builder),
+            loop->offset
         );
+        node_copy_position(static_loop, loop);
+        builder_append_node(&builder, static_loop);
     }
 
     return builder_get_first(&builder);
 }
 
-static struct node *process_static_loop(struct node *loop) {
+static struct node *process_static_loop(struct node *loop, const struct options *options) {
     bool single_offset = true;
     int loop_increment = 0;
 
     for(struct node *node = loop->body; node != NULL; node = node->next) {
         if(node->type != NODE_ADD) {
-            return fallback(loop);
+            if(node->type == NODE_IN || node->type == NODE_OUT) {
+                remark_missed(options, loop, "loops", "contains I/O");
+            } else {
+                remark_missed(options, loop, "loops", "contains a nested loop");
+            }
+            return fallback(loop, options);
         }
 
         if(node->offset == loop->offset) {
@@ -110,23 +149,27 @@ static struct node *process_static_loop(struct node *loop) {
     }
 
     if(single_offset) {
-        return generate_single_offset(loop, loop_increment);
+        return generate_single_offset(loop, loop_increment, options);
     } else {
-        return generate_multi_offset(loop, loop_increment);
+        return generate_multi_offset(loop, loop_increment, options);
     }
 }
 
-struct node *optimize_loops(struct node *node) {
+struct node *optimize_loops(struct node *node, const struct options *options) {
+    struct node *loop;
+
     struct builder builder;
     builder_initialize_empty(&builder);
 
     while(node != NULL) {
         switch(node->type) {
         case NODE_LOOP:
-             builder_append_node(&builder, node_new_loop(optimize_loops(node->body), node->offset));
-             break;
+            loop = node_new_loop(optimize_loops(node->body, options), node->offset);
+            node_copy_position(loop, node);
+            builder_append_node(&builder, loop);
+            break;
         case NODE_STATIC_LOOP:
-            builder_append_tree(&builder, process_static_loop(node));
+            builder_append_tree(&builder, process_static_loop(node, options));
             break;
         default:
             builder_append_node(&builder, node_clone(node));
@@ -31,8 +31,9 @@
 #ifndef BFC_OPTIMIZATIONS_LOOPS_H
 #define BFC_OPTIMIZATIONS_LOOPS_H
 
+#include "../app/options.h"
 #include "../ir/node.h"
 
-struct node *optimize_loops(struct node *node);
+struct node *optimize_loops(struct node *node, const struct options *options);
 
 #endif
@@ -28,47 +28,35 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "../app/options.h" 
-#include "bound_checks.h"
-#include "compute_offsets.h"
-#include "dead_loops.h"
-#include "loops.h"
+#include <stddef.h>
+#include "../app/options.h"
 #include "optimizations.h"
-#include "run_length.h"
+#include "passes.h"
+
+/* Default pipelines for each optimization level. -O1 is the cheap tier
+ * intended for quick JIT runs: it only merges runs of instructions, removes
+ * dead loops and folds pointer moves into offsets. The bound checks of a
+ * static loop are placed before the loop, so dead loops have to be removed
+ * before offsets turns them into static loops. -O2 also replaces simple loops
+ * by assignments and multiplications, and -O3 then propagates the cell values
+ * known at compile time. Bound checks are added at the end of each of these by
+ * run_pass_pipeline(). */
+static const char *default_pipelines[] = {
+    "",
+    "rle,dce,offsets",
+    "rle,dce,offsets,loops",
+    "rle,dce,offsets,loops,constants",
+};
 
 struct node *run_optimizations(struct node *program, const struct options *options) {
     /* memory allocation contract: caller is responsible for freeing the
      * original (if it so chooses). This function is only responsible for
      * freeing any intermediate trees it creates. */
-     
-    if(options->optimization_level == 0) {
-        if(options->no_check) {
-            return node_clone_tree(program);
-        }
-        return insert_bound_checks(program);
-    }
-    
-    struct node *run_length = run_length_optimize(program);
-    
-    struct node *no_dead_loops = remove_dead_loops(run_length);
-    
-    node_free(run_length);
+    const char *pipeline = options->passes;
     
-    struct node *with_offsets = compute_offsets(no_dead_loops);
-    
-    node_free(no_dead_loops);
-
-    struct node *loop_optimized = optimize_loops(with_offsets);
-
-    node_free(with_offsets);
-    
-    if(options->no_check) {
-        return loop_optimized;
+    if(pipeline == NULL) {
+        pipeline = default_pipelines[options->optimization_level];
     }
     
-    struct node *with_checks = insert_bound_checks(loop_optimized);
-    
-    node_free(loop_optimized);
-     
-    return with_checks;
+    return run_pass_pipeline(program, pipeline, options);
 }
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2023 Philippe Aubertin.
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of other contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ir/dump.h"
+#include "../ir/query.h"
+#include "bound_checks.h"
+#include "compute_offsets.h"
+#include "constants.h"
+#include "dead_loops.h"
+#include "loops.h"
+#include "passes.h"
+#include "run_length.h"
+
+#define MAX_PIPELINE_LENGTH     32
+#define MAX_GROUP_LENGTH        8
+#define MAX_PASS_NAME_LENGTH    16
+
+/* Upper bound on the number of times a group is repeated to reach a fixed
+ * point, in case two passes keep undoing each other's work. */
+#define MAX_ITERATIONS          100
+
+/* Passes can only run on the form of the tree they were written for. These
+ * are the successive forms the tree takes. */
+typedef enum {
+    /* as produced by the parser, with NODE_RIGHT nodes */
+    STAGE_RAW           = 1 << 0,
+    /* data pointer moves folded into offsets (compute_offsets) */
+    STAGE_OFFSETS       = 1 << 1,
+    /* bound checks inserted, no further transformations possible */
+    STAGE_CHECKED       = 1 << 2,
+} stage;
+
+struct pass {
+    const char *name;
+    struct node *(*run)(struct node *node, const struct options *options);
+    /* bit mask of the stages this pass accepts */
+    int accepts;
+    stage produces;
+};
+
+struct group {
+    const struct pass *passes[MAX_GROUP_LENGTH];
+    int length;
+    bool repeat;
+};
+
+struct pipeline {
+    struct group groups[MAX_PIPELINE_LENGTH];
+    int length;
+};
+
+static struct node *run_run_length(struct node *node, const struct options *options) {
+    return run_length_optimize(node);
+}
+
+static struct node *run_dead_loops(struct node *node, const struct options *options) {
+    return remove_dead_loops(node, options->program_part == PART_NEXT);
+}
+
+static struct node *run_constants(struct node *node, const struct options *options) {
+    /* Nothing is known about the cells at the start of a part of a program
+     * beyond the current one, which is not enough to propagate anything. */
+    if(options->program_part == PART_NEXT) {
+        return node_clone_tree(node);
+    }
+    
+    return propagate_constants(node);
+}
+
+static struct node *run_bound_checks(struct node *node, const struct options *options) {
+    return insert_bound_checks(node);
+}
+
+static const struct pass passes[] = {
+    {"rle",         run_run_length,     STAGE_RAW,                  STAGE_RAW},
+    {"dce",         run_dead_loops,     STAGE_RAW,                  STAGE_RAW},
+    {"offsets",     compute_offsets,    STAGE_RAW,                  STAGE_OFFSETS},
+    {"loops",       optimize_loops,     STAGE_OFFSETS,              STAGE_OFFSETS},
+    {"constants",   run_constants,      STAGE_OFFSETS,              STAGE_OFFSETS},
+    {"checks",      run_bound_checks,   STAGE_RAW | STAGE_OFFSETS,  STAGE_CHECKED},
+    {NULL,          NULL,               0,                          0},
+};
+
+static const struct pass *find_pass(const char *name) {
+    for(const struct pass *pass = passes; pass->name != NULL; ++pass) {
+        if(strcmp(pass->name, name) == 0) {
+            return pass;
+        }
+    }
+    
+    return NULL;
+}
+
+static void pipeline_error(const char *pipeline, const char *message) {
+    fprintf(stderr, "Error: invalid pass pipeline '%s': %s\n", pipeline, message);
+    exit(EXIT_FAILURE);
+}
+
+static const char *parse_pass(struct group *group, const char *pipeline, const char *current) {
+    char name[MAX_PASS_NAME_LENGTH];
+    size_t length = strcspn(current, ",()*");
+    
+    if(length == 0) {
+        pipeline_error(pipeline, "empty pass name");
+    }
+    
+    if(length >= sizeof(name)) {
+        pipeline_error(pipeline, "pass name too long");
+    }
+    
+    memcpy(name, current, length);
+    name[length] = '\0';
+    
+    const struct pass *pass = find_pass(name);
+    
+    if(pass == NULL) {
+        fprintf(stderr, "Error: unknown optimization pass '%s'\n", name);
+        exit(EXIT_FAILURE);
+    }
+    
+    if(group->length >= MAX_GROUP_LENGTH) {
+        pipeline_error(pipeline, "too many passes in group");
+    }
+    
+    group->passes[group->length++] = pass;
+    
+    return current + length;
+}
+
+static void parse_pipeline(struct pipeline *result, const char *pipeline) {
+    const char *current = pipeline;
+    
+    result->length = 0;
+    
+    while(*current != '\0') {
+        if(result->length >= MAX_PIPELINE_LENGTH) {
+            pipeline_error(pipeline, "too many passes");
+        }
+        
+        struct group *group = &result->groups[result->length++];
+        group->length = 0;
+        group->repeat = false;
+        
+        if(*current == '(') {
+            ++current;
+            
+            while(true) {
+                current = parse_pass(group, pipeline, current);
+                
+                if(*current != ',') {
+                    break;
+                }
+                ++current;
+            }
+            
+            if(*current != ')') {
+                pipeline_error(pipeline, "expected ')'");
+            }
+            ++current;
+            
+            if(*current != '*') {
+                pipeline_error(pipeline, "expected '*' after group");
+            }
+        } else {
+            current = parse_pass(group, pipeline, current);
+        }
+        
+        if(*current == '*') {
+            group->repeat = true;
+            ++current;
+        }
+        
+        if(*current == ',') {
+            ++current;
+            
+            if(*current == '\0') {
+                pipeline_error(pipeline, "trailing comma");
+            }
+        } else if(*current != '\0') {
+            pipeline_error(pipeline, "expected ','");
+        }
+    }
+}
+
+static bool pipeline_has_pass(const struct pipeline *pipeline, const char *name) {
+    for(int idx = 0; idx < pipeline->length; ++idx) {
+        const struct group *group = &pipeline->groups[idx];
+        
+        for(int pass_idx = 0; pass_idx < group->length; ++pass_idx) {
+            if(strcmp(group->passes[pass_idx]->name, name) == 0) {
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
+static stage check_pass_stage(const struct pass *pass, const char *previous, stage current) {
+    if((pass->accepts & current) == 0) {
+        fprintf(
+            stderr,
+            "Error: optimization pass '%s' cannot run after '%s'\n",
+            pass->name,
+            previous
+        );
+        exit(EXIT_FAILURE);
+    }
+    
+    return pass->produces;
+}
+
+/* Make sure each pass receives the form of the tree it was written for
+ * before running anything. */
+static void validate_pipeline(const struct pipeline *pipeline) {
+    stage current = STAGE_RAW;
+    const char *previous = "parser";
+    
+    for(int idx = 0; idx < pipeline->length; ++idx) {
+        const struct group *group = &pipeline->groups[idx];
+        
+        /* a repeated group must also accept its own output */
+        int iterations = group->repeat ? 2 : 1;
+        
+        for(int iteration = 0; iteration < iterations; ++iteration) {
+            for(int pass_idx = 0; pass_idx < group->length; ++pass_idx) {
+                current = check_pass_stage(group->passes[pass_idx], previous, current);
+                previous = group->passes[pass_idx]->name;
+            }
+        }
+    }
+}
+
+static struct node *run_pass(
+    const struct pass *pass,
+    struct node *node,
+    const struct options *options
+) {
+    struct node *result = pass->run(node, options);
+    
+    if(options->print_after_all) {
+        fprintf(stderr, "*** IR dump after %s ***\n", pass->name);
+        tree_dump(stderr, result);
+    }
+    
+    return result;
+}
+
+static struct node *run_group(
+    const struct group *group,
+    struct node *node,
+    const struct options *options
+) {
+    /* memory allocation contract: same as run_pass_pipeline() */
+    struct node *current = node;
+    
+    for(int iteration = 0; iteration < MAX_ITERATIONS; ++iteration) {
+        struct node *input = current;
+        
+        for(int idx = 0; idx < group->length; ++idx) {
+            struct node *next = run_pass(group->passes[idx], current, options);
+            
+            if(current != node && current != input) {
+                node_free(current);
+            }
+            current = next;
+        }
+        
+        bool changed = !tree_is_equal(input, current);
+        
+        if(input != node) {
+            node_free(input);
+        }
+        
+        if(!group->repeat || !changed) {
+            break;
+        }
+    }
+    
+    return current;
+}
+
+struct node *run_pass_pipeline(
+    struct node *program,
+    const char *pipeline,
+    const struct options *options
+) {
+    /* memory allocation contract: caller is responsible for freeing the
+     * original (if it so chooses). This function is only responsible for
+     * freeing any intermediate trees it creates. */
+    struct pipeline parsed;
+    parse_pipeline(&parsed, pipeline);
+    
+    /* Bound checks are always inserted last unless they were explicitly
+     * disabled or placed by the user. */
+    if(!options->no_check && !pipeline_has_pass(&parsed, "checks")) {
+        if(parsed.length >= MAX_PIPELINE_LENGTH) {
+            pipeline_error(pipeline, "too many passes");
+        }
+        
+        struct group *group = &parsed.groups[parsed.length++];
+        group->passes[0] = find_pass("checks");
+        group->length = 1;
+        group->repeat = false;
+    }
+    
+    validate_pipeline(&parsed);
+    
+    struct node *current = program;
+    
+    for(int idx = 0; idx < parsed.length; ++idx) {
+        struct node *next = run_group(&parsed.groups[idx], current, options);
+        
+        if(current != program) {
+            node_free(current);
+        }
+        current = next;
+    }
+    
+    if(current == program) {
+        return node_clone_tree(program);
+    }
+    
+    return current;
+}
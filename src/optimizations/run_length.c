@@ -33,6 +33,7 @@
 #include "run_length.h"
 
 static struct node *optimize_sequence(struct builder *builder, struct node *node) {
+    const struct node *first = node;
     node_type type = node->type;
     int n = 0;
     
@@ -42,16 +43,16 @@ static struct node *optimize_sequence(struct builder *builder, struct node *node
     }
     
     if(n != 0) {
-        switch(type) {
-        case NODE_ADD:
-            builder_append_node(builder, node_new_add(n, 0));
-            break;
-        case NODE_RIGHT:
-            builder_append_node(builder, node_new_right(n));
-            break;
-        default:
-            break;
+        struct node *optimized;
+        
+        if(type == NODE_ADD) {
+            optimized = node_new_add(n, 0);
+        } else {
+            optimized = node_new_right(n);
         }
+        
+        node_copy_position(optimized, first);
+        builder_append_node(builder, optimized);
     }
     
     return node;
@@ -73,7 +74,9 @@ struct node *run_length_optimize(struct node *node) {
             
             /* Maybe we optimized the whole body away. */
             if(body != NULL) {
-                builder_append_node(&builder, node_new_loop(body, 0));
+                struct node *loop = node_new_loop(body, 0);
+                node_copy_position(loop, node);
+                builder_append_node(&builder, loop);
             }
         }
             node = node->next;